@@ -15,8 +15,11 @@ class Lake {
 	const size_t blockSize_;
 	mutable std::vector<std::unique_ptr<uint8_t[]>> blocks_;
 	mutable uint8_t *arena_, *pos_;
+	mutable size_t bytesAllocated_ = 0;
 	
 	static constexpr size_t DefaultBlockSize = 48 * 1024;
+	// all allocations are aligned for pointers and doubles
+	static constexpr size_t Alignment = 8;
 	
 	void addBlock(size_t sizeInBytes) const {
 		blocks_.emplace_back(new uint8_t[sizeInBytes]);
@@ -34,7 +37,7 @@ public:
 	Lake() : Lake(DefaultBlockSize) {}
 	
 	void* allocate(size_t n) const {
-		if (pos_ + n - arena_ > blockSize_) {
+		if (static_cast<size_t>(pos_ - arena_) + n > blockSize_) {
 			if (n > blockSize_)
 				addBlock(n + blockSize_); // single-use large block
 			else
@@ -42,11 +45,24 @@ public:
 		}
 		
 		auto result = pos_;
-		pos_ += (n + 3) & ~3;
+		auto aligned = (n + Alignment - 1) & ~(Alignment - 1);
+		pos_ += aligned;
+		bytesAllocated_ += aligned;
 		return result;
 	}
 	
-	void deallocate(void* p, size_t n) const {
+	void deallocate(void*, size_t) const {
+	}
+	
+	size_t bytesAllocated() const { return bytesAllocated_; }
+	size_t blockCount() const { return blocks_.size(); }
+	
+	// forget all allocations, keeping the first block for the next ones;
+	// nothing allocated from the Lake may be used after this
+	void reset() {
+		blocks_.resize(1);
+		pos_ = arena_ = blocks_.front().get();
+		bytesAllocated_ = 0;
 	}
 };
 
@@ -94,6 +110,15 @@ inline bool operator!=(const AllocAdapter<T, Alloc>&, const AllocAdapter<U, Allo
 template <typename T>
 using LakeAllocator = AllocAdapter<T, Lake>;
 
+
+// Arena allocators release all of their memory at once when the arena
+// goes away, so individual blocks need not be handed back to them.
+template <typename Alloc>
+struct is_arena_allocator : std::false_type {};
+
+template <typename T>
+struct is_arena_allocator<AllocAdapter<T, Lake>> : std::true_type {};
+
 	
 } // ns krystal
 
@@ -0,0 +1,604 @@
+// krystal_bench.cpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+// Benchmarks the DOM and SAX parsers over the perftests files and a set of
+// generated corpora, reporting throughput, latency percentiles, allocations
+// and arena usage per parse. A parse is timed including the destruction of
+// its document. Run from the repository root or point --data at perftests.
+// Other modes time what builds on a parse: profiling, reading char by char,
+// streaming elements, parsing on several threads, recording a tape, schema
+// validation and diffing.
+//
+//   krystal_bench [--json] [--data dir] [--filter text] [--mode text] [--threads n] [--iterations n] [--min-time ms]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "krystal.hpp"
+
+using namespace krystal;
+
+
+// count all heap allocations of the process, of all threads
+namespace {
+	std::atomic<size_t> allocCount { 0 }, allocBytes { 0 };
+}
+
+void* operator new(std::size_t size) {
+	allocCount.fetch_add(1, std::memory_order_relaxed);
+	allocBytes.fetch_add(size, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+
+struct Options {
+	bool json = false;
+	std::string dataDir = "test/perftests";
+	std::string filter, modeFilter;
+	unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+	size_t iterations = 0;      // 0 runs for at least minTime
+	size_t warmup = 2;
+	size_t minIterations = 10, maxIterations = 10000;
+	std::chrono::milliseconds minTime { 500 };
+};
+
+
+struct Corpus {
+	std::string name, json;
+};
+
+
+struct Result {
+	std::string corpus, mode;
+	size_t bytes = 0, iterations = 0;
+	double mbPerSec = 0, docsPerSec = 0;
+	double p50Micros = 0, p99Micros = 0;
+	double allocsPerParse = 0, allocBytesPerParse = 0;
+	size_t peakArenaBytes = 0;
+};
+
+
+// SAX delegate that only counts, a final non-virtual class so the reader inlines it
+struct CountingDelegate final {
+	size_t values = 0;
+	
+	bool nullValue() { ++values; return true; }
+	bool falseValue() { ++values; return true; }
+	bool trueValue() { ++values; return true; }
+	bool numberValue(double) { ++values; return true; }
+	bool stringValue(StringRef, bool) { ++values; return true; }
+	bool arrayBegin() { ++values; return true; }
+	bool arrayEnd() { return true; }
+	bool objectBegin() { ++values; return true; }
+	bool objectEnd() { return true; }
+	void error(const ParseError&) {}
+};
+
+// where counts go that nothing else reads, so the compiler cannot drop their work
+static volatile size_t valuesSink = 0;
+
+
+
+static std::string readTextFile(const std::string& path) {
+	std::ifstream file { path, std::ios::binary };
+	if (! file.is_open())
+		throw std::runtime_error("Cannot open " + path);
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	return contents.str();
+}
+
+
+// small deterministic generator so every run parses the same corpora
+class Random {
+	uint64_t state_;
+	
+public:
+	explicit Random(uint64_t seed) : state_{seed} {}
+	
+	uint32_t next() {
+		state_ = state_ * 6364136223846793005ull + 1442695040888963407ull;
+		return static_cast<uint32_t>(state_ >> 33);
+	}
+	
+	uint32_t below(uint32_t bound) { return next() % bound; }
+};
+
+
+static std::string numberCorpus() {
+	Random random { 1 };
+	std::string json { "[" };
+	char buffer[32];
+	for (int ix = 0; ix < 200000; ++ix) {
+		switch (ix % 4) {
+			case 0: std::snprintf(buffer, sizeof(buffer), "%u", random.next()); break;
+			case 1: std::snprintf(buffer, sizeof(buffer), "-%u.%u", random.below(100000), random.below(1000)); break;
+			case 2: std::snprintf(buffer, sizeof(buffer), "%u.%ue-%u", random.below(10), random.below(1000000), random.below(300)); break;
+			default: std::snprintf(buffer, sizeof(buffer), "%.17g", random.next() / 4294967296.0); break;
+		}
+		if (ix)
+			json += ',';
+		json += buffer;
+	}
+	return json + "]";
+}
+
+
+static std::string stringCorpus() {
+	static const char* pieces[] = {
+		"lorem ipsum ", "dolor \\\"sit\\\" amet ", "tab\\tand\\nnewline ", "caf\\u00e9 ",
+		"na\xC3\xAFve r\xC3\xA9sum\xC3\xA9 ", "smile \\ud83d\\ude00 ", "back\\\\slash ", "\xE6\x97\xA5\xE6\x9C\xAC "
+	};
+	Random random { 2 };
+	std::string json { "[" };
+	for (int ix = 0; ix < 50000; ++ix) {
+		json += ix ? ",\"" : "\"";
+		auto count = 1 + random.below(6);
+		for (uint32_t piece = 0; piece < count; ++piece)
+			json += pieces[random.below(8)];
+		json += '"';
+	}
+	return json + "]";
+}
+
+
+static std::string unicodeCorpus() {
+	// mostly multi-byte text in long runs, with some \u escapes of all lengths
+	static const char* pieces[] = {
+		"\xCE\xB1\xCE\xBB\xCF\x86\xCE\xB1 \xCE\xB2\xCE\xAE\xCF\x84\xCE\xB1 ", "\xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82 ",
+		"\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E\xE3\x81\xAE\xE6\x96\x87 ", "\xED\x95\x9C\xEA\xB5\xAD\xEC\x96\xB4 ",
+		"\xF0\x9F\x98\x80\xF0\x9F\x8E\x89 ", "\\u00e9\\u00e8 ", "\\u65e5\\u672c ", "\\ud83d\\ude00 "
+	};
+	Random random { 4 };
+	std::string json { "[" };
+	for (int ix = 0; ix < 50000; ++ix) {
+		json += ix ? ",\"" : "\"";
+		auto count = 2 + random.below(8);
+		for (uint32_t piece = 0; piece < count; ++piece)
+			json += pieces[random.below(random.below(4) ? 5 : 8)];
+		json += '"';
+	}
+	return json + "]";
+}
+
+
+static std::string literalCorpus() {
+	// records of flags, mostly true, false and null with few keys per value
+	static const char* values[] = { "true", "false", "null" };
+	Random random { 5 };
+	std::string json { "[" };
+	for (int ix = 0; ix < 20000; ++ix) {
+		json += ix ? ",{\"flags\":[" : "{\"flags\":[";
+		for (int flag = 0; flag < 16; ++flag)
+			json += std::string(flag ? "," : "") + values[random.below(3)];
+		json += "],\"on\":";
+		json += values[random.below(2)];
+		json += ",\"parent\":null}";
+	}
+	return json + "]";
+}
+
+
+static std::string recordCorpus() {
+	// records that all conform to RecordSchema
+	Random random { 6 };
+	std::string json { "[" };
+	for (int ix = 0; ix < 20000; ++ix) {
+		json += ix ? ",{\"id\":" : "{\"id\":";
+		json += std::to_string(ix);
+		json += ",\"name\":\"record " + std::to_string(random.next()) + "\",\"tags\":[";
+		for (uint32_t tag = 0, count = random.below(8); tag < count; ++tag)
+			json += std::string(tag ? "," : "") + "\"t" + std::to_string(random.below(100)) + '"';
+		json += "],\"text\":\"lorem ipsum dolor sit amet, consectetur adipiscing elit\",\"flag\":";
+		json += random.below(2) ? "true}" : "false}";
+	}
+	return json + "]";
+}
+
+static const char* RecordSchema = R"({"type": "array", "items": {
+	"type": "object", "required": ["id", "name", "flag"], "additionalProperties": false,
+	"properties": {
+		"id": {"type": "integer", "minimum": 0},
+		"name": {"type": "string", "maxLength": 64},
+		"tags": {"type": "array", "maxItems": 8},
+		"text": {"type": "string"},
+		"flag": {"type": "boolean"}
+	}
+}})";
+
+
+static std::string nestedCorpus() {
+	// just under the reader's default maximum depth
+	const int depth = 250;
+	std::string json { "[" };
+	for (int ix = 0; ix < 200; ++ix) {
+		if (ix)
+			json += ',';
+		for (int level = 0; level < depth; ++level)
+			json += "{\"a\":[";
+		json += std::to_string(ix);
+		for (int level = 0; level < depth; ++level)
+			json += "]}";
+	}
+	return json + "]";
+}
+
+
+template <typename ValueClass>
+static void writePretty(std::string& out, const ValueClass& value, int indent) {
+	auto newline = [&](int level) {
+		out += '\n';
+		out.append(static_cast<size_t>(level), '\t');
+	};
+	auto writeString = [&](const std::string& str) {
+		out += '"';
+		for (auto ch : str) {
+			if (ch == '"' || ch == '\\') {
+				out += '\\';
+				out += ch;
+			}
+			else if (static_cast<unsigned char>(ch) < 0x20) {
+				char escape[8];
+				std::snprintf(escape, sizeof(escape), "\\u%04x", ch);
+				out += escape;
+			}
+			else
+				out += ch;
+		}
+		out += '"';
+	};
+	
+	switch (value.type()) {
+		case ValueKind::Null: out += "null"; break;
+		case ValueKind::False: out += "false"; break;
+		case ValueKind::True: out += "true"; break;
+		case ValueKind::Number: {
+			char buffer[32];
+			std::snprintf(buffer, sizeof(buffer), "%.17g", value.number());
+			out += buffer;
+			break;
+		}
+		case ValueKind::String: writeString(value.string()); break;
+		case ValueKind::Array:
+		case ValueKind::Object: {
+			bool isObject = value.isObject();
+			out += isObject ? '{' : '[';
+			bool first = true;
+			for (auto item : value.items()) {
+				out += first ? "" : ",";
+				first = false;
+				newline(indent + 1);
+				if (isObject) {
+					writeString(item.key.str());
+					out += ": ";
+				}
+				writePretty(out, item.value, indent + 1);
+			}
+			if (! first)
+				newline(indent);
+			out += isObject ? '}' : ']';
+			break;
+		}
+	}
+}
+
+
+// a JSON Patch that adds a member to every 50th object and an element to every 50th array
+template <typename ValueClass>
+static void addMutations(Value& patch, const ValueClass& value, const std::string& path, size_t& containers) {
+	if (! value.isContainer())
+		return;
+	if (containers++ % 50 == 0) {
+		auto& op = patch.emplace_back(ObjectOrder::InsertionOrder);
+		op.emplace("op", Value{ "add" });
+		op.emplace("path", Value{ path + (value.isObject() ? "/mutated" : "/-") });
+		op.emplace("value", Value{ static_cast<int>(containers) });
+	}
+	for (auto item : value.items()) {
+		std::string token;
+		for (auto ch : value.isObject() ? item.key.str() : std::to_string(item.index))
+			token += ch == '~' ? "~0" : ch == '/' ? "~1" : std::string(1, ch);
+		addMutations(patch, item.value, path + '/' + token, containers);
+	}
+}
+
+
+static std::vector<Corpus> loadCorpora(const Options& options) {
+	std::vector<Corpus> corpora;
+	for (auto name : { "tiny", "teensy", "medium-large", "rapidjson-insane", "large-but-boring" })
+		corpora.push_back({ name, readTextFile(options.dataDir + "/" + name + ".json") });
+	
+	corpora.push_back({ "numbers", numberCorpus() });
+	corpora.push_back({ "strings", stringCorpus() });
+	corpora.push_back({ "unicode", unicodeCorpus() });
+	corpora.push_back({ "literals", literalCorpus() });
+	corpora.push_back({ "records", recordCorpus() });
+	corpora.push_back({ "nested", nestedCorpus() });
+	
+	std::string pretty;
+	writePretty(pretty, parseString(corpora[2].json).root(), 0);
+	corpora.push_back({ "pretty", std::move(pretty) });
+	
+	corpora.erase(std::remove_if(corpora.begin(), corpora.end(), [&](const Corpus& corpus) {
+		return corpus.name.find(options.filter) == std::string::npos;
+	}), corpora.end());
+	return corpora;
+}
+
+
+// nearest-rank percentile of sorted durations
+static double percentile(const std::vector<double>& sorted, double p) {
+	auto rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+	return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+
+// parse returns the number of arena bytes the parse used, copies is the
+// number of times it parses the corpus
+template <typename Parse>
+static Result measure(const Corpus& corpus, const char* mode, const Options& options, Parse parse, size_t copies = 1) {
+	using namespace std::chrono;
+	
+	for (size_t ix = 0; ix < options.warmup; ++ix)
+		parse(corpus.json);
+	
+	Result result;
+	result.corpus = corpus.name;
+	result.mode = mode;
+	result.bytes = corpus.json.size() * copies;
+	
+	std::vector<double> micros;
+	size_t allocs = 0, bytes = 0;
+	auto start = steady_clock::now();
+	
+	for (;;) {
+		size_t countBefore = allocCount, bytesBefore = allocBytes;
+		auto t0 = steady_clock::now();
+		auto arena = parse(corpus.json);
+		auto t1 = steady_clock::now();
+		allocs += allocCount - countBefore;
+		bytes += allocBytes - bytesBefore;
+		
+		micros.push_back(duration<double, std::micro>(t1 - t0).count());
+		result.peakArenaBytes = std::max(result.peakArenaBytes, arena);
+		
+		auto done = micros.size();
+		if (options.iterations ? done == options.iterations
+			: done == options.maxIterations || (done >= options.minIterations && steady_clock::now() - start >= options.minTime))
+			break;
+	}
+	
+	double totalMicros = 0;
+	for (auto us : micros)
+		totalMicros += us;
+	auto iterations = static_cast<double>(micros.size());
+	std::sort(micros.begin(), micros.end());
+	
+	result.iterations = micros.size();
+	result.mbPerSec = (result.bytes * iterations) / totalMicros;
+	result.docsPerSec = iterations / (totalMicros / 1e6);
+	result.p50Micros = percentile(micros, 0.5);
+	result.p99Micros = percentile(micros, 0.99);
+	result.allocsPerParse = allocs / iterations;
+	result.allocBytesPerParse = bytes / iterations;
+	return result;
+}
+
+
+static void printTable(const std::vector<Result>& results) {
+	std::printf("%-18s %-10s %9s %6s %9s %10s %10s %10s %12s %12s\n",
+		"corpus", "mode", "bytes", "runs", "MB/s", "docs/s", "p50 us", "p99 us", "allocs", "arena bytes");
+	for (auto& r : results)
+		std::printf("%-18s %-10s %9zu %6zu %9.1f %10.1f %10.1f %10.1f %12.1f %12zu\n",
+			r.corpus.c_str(), r.mode.c_str(), r.bytes, r.iterations, r.mbPerSec, r.docsPerSec,
+			r.p50Micros, r.p99Micros, r.allocsPerParse, r.peakArenaBytes);
+}
+
+
+static void printJSON(const std::vector<Result>& results) {
+	std::printf("{\n\t\"benchmark\": \"krystal\",\n\t\"results\": [");
+	for (size_t ix = 0; ix < results.size(); ++ix) {
+		auto& r = results[ix];
+		std::printf("%s\n\t\t{ \"corpus\": \"%s\", \"mode\": \"%s\", \"bytes\": %zu, \"iterations\": %zu, "
+			"\"mbPerSec\": %.3f, \"docsPerSec\": %.3f, \"p50Micros\": %.3f, \"p99Micros\": %.3f, "
+			"\"allocsPerParse\": %.3f, \"allocBytesPerParse\": %.1f, \"peakArenaBytes\": %zu }",
+			ix ? "," : "", r.corpus.c_str(), r.mode.c_str(), r.bytes, r.iterations,
+			r.mbPerSec, r.docsPerSec, r.p50Micros, r.p99Micros,
+			r.allocsPerParse, r.allocBytesPerParse, r.peakArenaBytes);
+	}
+	std::printf("\n\t]\n}\n");
+}
+
+
+static bool parseOptions(int argc, char* argv[], Options& options) {
+	for (int ix = 1; ix < argc; ++ix) {
+		std::string arg { argv[ix] };
+		bool hasValue = ix + 1 < argc;
+		
+		if (arg == "--json")
+			options.json = true;
+		else if (arg == "--data" && hasValue)
+			options.dataDir = argv[++ix];
+		else if (arg == "--filter" && hasValue)
+			options.filter = argv[++ix];
+		else if (arg == "--mode" && hasValue)
+			options.modeFilter = argv[++ix];
+		else if (arg == "--threads" && hasValue)
+			options.threads = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++ix], nullptr, 10)));
+		else if (arg == "--iterations" && hasValue)
+			options.iterations = std::max<size_t>(1, std::strtoul(argv[++ix], nullptr, 10));
+		else if (arg == "--min-time" && hasValue)
+			options.minTime = std::chrono::milliseconds { std::strtol(argv[++ix], nullptr, 10) };
+		else {
+			std::cerr << "usage: " << argv[0] << " [--json] [--data dir] [--filter text] [--mode text] [--threads n] [--iterations n] [--min-time ms]\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+
+int main(int argc, char* argv[]) {
+	Options options;
+	if (! parseOptions(argc, argv, options))
+		return 1;
+	
+	std::vector<Corpus> corpora;
+	try {
+		corpora = loadCorpora(options);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << " (use --data to point at the perftests directory)\n";
+		return 1;
+	}
+	
+	std::vector<Result> results;
+	for (auto& corpus : corpora) {
+		ParseError error;
+		parseString(corpus.json, error);
+		if (error) {
+			std::cerr << corpus.name << ": " << error.message() << '\n';
+			return 1;
+		}
+		
+		auto run = [&](const char* mode, auto parse, size_t copies) {
+			if (std::string{ mode }.find(options.modeFilter) != std::string::npos)
+				results.push_back(measure(corpus, mode, options, parse, copies));
+		};
+		
+		run("dom", [](const std::string& json) {
+			return parseString(json).memoryUsed();
+		}, 1);
+		
+		run("sax", [](const std::string& json) {
+			CountingDelegate delegate;
+			BasicReader<CountingDelegate> reader { delegate };
+			ReaderStream<std::string::const_iterator> stream { json.begin(), json.end() };
+			reader.parseDocument(stream);
+			valuesSink = delegate.values;
+			return size_t{0};
+		}, 1);
+		
+		// the cost of UTF-8 validation is the difference with sax
+		run("sax-raw", [](const std::string& json) {
+			CountingDelegate delegate;
+			BasicReader<CountingDelegate> reader { delegate };
+			reader.setValidateUTF8(false);
+			ReaderStream<std::string::const_iterator> stream { json.begin(), json.end() };
+			reader.parseDocument(stream);
+			valuesSink = delegate.values;
+			return size_t{0};
+		}, 1);
+		
+		// input that is not contiguous is read char by char
+		run("dom-chars", [](const std::string& json) {
+			std::istringstream input { json };
+			return parseStream(input).memoryUsed();
+		}, 1);
+		
+		run("profile", [](const std::string& json) {
+			ParseProfile profile;
+			return parseProfiled(json, profile).memoryUsed();
+		}, 1);
+		
+		// one document per element of the top-level array, reusing its memory
+		if (corpus.json[0] == '[') {
+			run("elements", [](const std::string& json) {
+				size_t elements = 0;
+				for (auto& element : streamArray(json))
+					elements += element.memoryUsed();
+				return elements;
+			}, 1);
+		}
+		
+		run("parallel", [&options](const std::string& json) {
+			return parseParallel(json, ObjectOrder::Unordered, options.threads).memoryUsed();
+		}, 1);
+		
+		// independent parses of the corpus on every thread, the scaling of all readers together
+		run("threads", [&options](const std::string& json) {
+			std::vector<std::thread> threads;
+			std::vector<size_t> arenas(options.threads);
+			for (unsigned ix = 0; ix < options.threads; ++ix)
+				threads.emplace_back([&, ix]{ arenas[ix] = parseString(json).memoryUsed(); });
+			for (auto& thread : threads)
+				thread.join();
+			return arenas[0];
+		}, options.threads);
+		
+		run("record", [](const std::string& json) {
+			EventTape tape;
+			record(json, tape);
+			return tape.memoryUsed();
+		}, 1);
+		
+		// events recorded once and replayed, what every consumer after the first pays
+		EventTape tape;
+		record(corpus.json, tape);
+		run("replay", [&tape](const std::string&) {
+			CountingDelegate delegate;
+			tape.replay(delegate);
+			valuesSink = delegate.values;
+			return size_t{0};
+		}, 1);
+		
+		if (corpus.name == "records") {
+			auto schema = parseSchema(RecordSchema);
+			run("validate", [&schema](const std::string& json) {
+				SchemaViolation violation;
+				valuesSink = validate(json, schema, violation);
+				return size_t{0};
+			}, 1);
+			run("validated", [&schema](const std::string& json) {
+				SchemaViolation violation;
+				return parseValidated(json, schema, violation).memoryUsed();
+			}, 1);
+		}
+		
+		// a diff with a copy of the corpus that has a change in every 50th container,
+		// parsed separately and as a clone that shares all unchanged values
+		const auto from = parseString(corpus.json);
+		Value mutations { ValueKind::Array };
+		size_t containers = 0;
+		addMutations(mutations, from.root(), "", containers);
+		auto to = parseString(corpus.json);
+		applyPatch(to, mutations);
+		auto cloned = from.clone();
+		applyPatch(cloned, mutations);
+		
+		run("diff", [&](const std::string&) {
+			return diffPatch(from, to).memoryUsed();
+		}, 1);
+		run("diff-clone", [&](const std::string&) {
+			return diffPatch(from, cloned).memoryUsed();
+		}, 1);
+		run("merge-diff", [&](const std::string&) {
+			return diffMergePatch(from, to).memoryUsed();
+		}, 1);
+	}
+	
+	if (options.json)
+		printJSON(results);
+	else
+		printTable(results);
+	return 0;
+}
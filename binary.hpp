@@ -0,0 +1,647 @@
+// binary.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_BINARY_H
+#define KRYSTAL_BINARY_H
+
+#include "reader.hpp"
+#include "document.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace krystal {
+
+
+/*
+ MessagePack and CBOR documents are read by a BasicBinaryReader, which
+ calls the same delegate handlers as the JSON reader, so a DocumentBuilder
+ or any other delegate can be used with all three formats. Object keys are
+ passed to stringValue() just like JSON keys, definite length strings point
+ straight into the input.
+
+ All integer and float types become numbers. Values that JSON cannot
+ represent (MessagePack bin and ext, CBOR byte strings and simple values)
+ fail with ErrorCode::UnsupportedType, CBOR tags are skipped.
+ Errors report their offset in bytes, as column on line 1.
+*/
+
+
+template <typename Delegate, BinaryFormat Format>
+class BasicBinaryReader {
+	using FormatTag = std::integral_constant<BinaryFormat, Format>;
+	using MessagePackTag = std::integral_constant<BinaryFormat, BinaryFormat::MessagePack>;
+	using CBORTag = std::integral_constant<BinaryFormat, BinaryFormat::CBOR>;
+	
+	// containers being read, a count of the items left in each
+	struct Frame {
+		size_t remaining;
+		bool indefinite; // a CBOR container that ends with a break, not a count
+		bool isObject;
+		bool atKey;
+	};
+	
+	// what reading one item yielded, scalars are passed to the delegate right away
+	enum class Item : uint8_t {
+		Scalar,
+		Array,
+		Object,
+		Break // end of an indefinite length CBOR container
+	};
+	
+	Delegate& delegate_;
+	ParseError error_;
+	const uint8_t *first_ = nullptr, *pos_ = nullptr, *last_ = nullptr;
+	std::vector<Frame> containers_;
+	size_t maxDepth_;
+	
+	bool fail(ErrorCode code, const uint8_t* at) {
+		int found = at < last_ ? *at : -1;
+		error_.code = (found < 0 && code != ErrorCode::Aborted) ? ErrorCode::UnexpectedEnd : code;
+		error_.offset = at - first_;
+		error_.line = 1;
+		error_.column = static_cast<int>(error_.offset) + 1;
+		error_.found = found;
+		delegate_.error(error_);
+		return false;
+	}
+	
+	bool aborted() { return fail(ErrorCode::Aborted, pos_); }
+	
+	bool has(size_t bytes) const { return static_cast<size_t>(last_ - pos_) >= bytes; }
+	
+	// both formats are big endian
+	uint64_t readUInt(size_t bytes) {
+		uint64_t value = 0;
+		for (size_t ix = 0; ix < bytes; ++ix)
+			value = (value << 8) | *pos_++;
+		return value;
+	}
+	
+	double readFloat(size_t bytes) {
+		if (bytes == 4) {
+			auto bits = static_cast<uint32_t>(readUInt(4));
+			float value;
+			std::memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+		
+		auto bits = readUInt(8);
+		double value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+	
+	static double halfFloat(uint32_t half) {
+		auto exponent = static_cast<int>((half >> 10) & 0x1f);
+		auto mantissa = static_cast<double>(half & 0x3ff);
+		double value;
+		if (exponent == 0)
+			value = std::ldexp(mantissa, -24);
+		else if (exponent != 31)
+			value = std::ldexp(mantissa + 1024, exponent - 25);
+		else
+			value = mantissa == 0 ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+		return (half & 0x8000) ? -value : value;
+	}
+	
+	bool number(double num) {
+		return delegate_.numberValue(num) || aborted();
+	}
+	
+	bool string(size_t length) {
+		if (! has(length))
+			return fail(ErrorCode::UnexpectedEnd, last_);
+		StringRef str { reinterpret_cast<const char*>(pos_), length };
+		pos_ += length;
+		return delegate_.stringValue(str, false) || aborted();
+	}
+	
+	
+	// MessagePack
+	bool readItem(Item& item, uint64_t& count, bool&, bool isKey, MessagePackTag) {
+		auto start = pos_;
+		auto type = *pos_++;
+		item = Item::Scalar;
+		
+		// sizes of the variable length fields of str, array and map types
+		auto sized = [&](size_t bytes, uint64_t& size) {
+			if (! has(bytes))
+				return fail(ErrorCode::UnexpectedEnd, last_);
+			size = readUInt(bytes);
+			return true;
+		};
+		
+		if (type <= 0x7f || type >= 0xe0) {
+			if (isKey)
+				return fail(ErrorCode::ExpectedStringKey, start);
+			return number(static_cast<int8_t>(type));
+		}
+		if (type >= 0xa0 && type <= 0xbf)
+			return string(type & 0x1f);
+		if (type == 0xd9 || type == 0xda || type == 0xdb) {
+			uint64_t length = 0;
+			return sized(size_t{1} << (type - 0xd9), length) && string(static_cast<size_t>(length));
+		}
+		if (isKey)
+			return fail(ErrorCode::ExpectedStringKey, start);
+		
+		if (type <= 0x8f || (type >= 0x90 && type <= 0x9f)) {
+			item = type <= 0x8f ? Item::Object : Item::Array;
+			count = type & 0x0f;
+			return true;
+		}
+		
+		switch (type) {
+			case 0xc0: return delegate_.nullValue() || aborted();
+			case 0xc2: return delegate_.falseValue() || aborted();
+			case 0xc3: return delegate_.trueValue() || aborted();
+			
+			case 0xca: case 0xcb: {
+				size_t bytes = type == 0xca ? 4 : 8;
+				if (! has(bytes))
+					return fail(ErrorCode::UnexpectedEnd, last_);
+				return number(readFloat(bytes));
+			}
+			
+			case 0xcc: case 0xcd: case 0xce: case 0xcf: {
+				size_t bytes = size_t{1} << (type - 0xcc);
+				if (! has(bytes))
+					return fail(ErrorCode::UnexpectedEnd, last_);
+				return number(static_cast<double>(readUInt(bytes)));
+			}
+			
+			case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+				size_t bytes = size_t{1} << (type - 0xd0);
+				if (! has(bytes))
+					return fail(ErrorCode::UnexpectedEnd, last_);
+				// sign extend from the top bit of the field
+				auto bits = readUInt(bytes);
+				auto shift = 64 - 8 * bytes;
+				auto value = static_cast<int64_t>(bits << shift) >> shift;
+				return number(static_cast<double>(value));
+			}
+			
+			case 0xdc: case 0xdd:
+				item = Item::Array;
+				return sized(type == 0xdc ? 2 : 4, count);
+			case 0xde: case 0xdf:
+				item = Item::Object;
+				return sized(type == 0xde ? 2 : 4, count);
+			
+			default:
+				return fail(ErrorCode::UnsupportedType, start);
+		}
+	}
+	
+	
+	// CBOR
+	bool readItem(Item& item, uint64_t& count, bool& indefinite, bool isKey, CBORTag) {
+		const uint8_t* start;
+		int major, info;
+		uint64_t argument;
+		item = Item::Scalar;
+		
+		// tags only annotate the item that follows, so they are skipped in a
+		// loop, hostile data can chain any number of them
+		for (;;) {
+			start = pos_;
+			auto initial = *pos_++;
+			major = initial >> 5;
+			info = initial & 0x1f;
+			
+			if (initial == 0xff) {
+				item = Item::Break;
+				return true;
+			}
+			
+			// the argument of the initial byte, info 31 means indefinite length
+			argument = static_cast<uint64_t>(info);
+			indefinite = false;
+			if (info >= 24 && info <= 27) {
+				size_t bytes = size_t{1} << (info - 24);
+				if (! has(bytes))
+					return fail(ErrorCode::UnexpectedEnd, last_);
+				argument = readUInt(bytes);
+			}
+			else if (info == 31 && (major == 2 || major == 3 || major == 4 || major == 5))
+				indefinite = true;
+			else if (info > 23)
+				return fail(ErrorCode::UnsupportedType, start);
+			
+			if (major != 6)
+				break;
+			if (! has(1))
+				return fail(ErrorCode::UnexpectedEnd, last_);
+		}
+		
+		if (isKey && major != 3)
+			return fail(ErrorCode::ExpectedStringKey, start);
+		
+		switch (major) {
+			case 0: return number(static_cast<double>(argument));
+			case 1: return number(-1.0 - static_cast<double>(argument));
+			
+			case 3:
+				if (! indefinite)
+					return string(static_cast<size_t>(argument));
+				return chunkedString();
+			
+			case 4:
+			case 5:
+				item = major == 4 ? Item::Array : Item::Object;
+				count = argument;
+				return true;
+			
+			case 7:
+				switch (info) {
+					case 20: return delegate_.falseValue() || aborted();
+					case 21: return delegate_.trueValue() || aborted();
+					case 22: case 23: return delegate_.nullValue() || aborted();
+					case 25: return number(halfFloat(static_cast<uint32_t>(argument)));
+					case 26: {
+						auto bits = static_cast<uint32_t>(argument);
+						float value;
+						std::memcpy(&value, &bits, sizeof(value));
+						return number(value);
+					}
+					case 27: {
+						double value;
+						std::memcpy(&value, &argument, sizeof(value));
+						return number(value);
+					}
+					default:
+						return fail(ErrorCode::UnsupportedType, start);
+				}
+			
+			default: // byte strings
+				return fail(ErrorCode::UnsupportedType, start);
+		}
+	}
+	
+	// an indefinite length text string is a series of definite length chunks
+	bool chunkedString() {
+		std::string chunks;
+		for (;;) {
+			if (! has(1))
+				return fail(ErrorCode::UnexpectedEnd, last_);
+			auto initial = *pos_;
+			if (initial == 0xff)
+				break;
+			if ((initial >> 5) != 3 || (initial & 0x1f) > 27)
+				return fail(ErrorCode::UnsupportedType, pos_);
+			
+			++pos_;
+			uint64_t length = initial & 0x1f;
+			if (length >= 24) {
+				size_t bytes = size_t{1} << (length - 24);
+				if (! has(bytes))
+					return fail(ErrorCode::UnexpectedEnd, last_);
+				length = readUInt(bytes);
+			}
+			if (! has(static_cast<size_t>(length)))
+				return fail(ErrorCode::UnexpectedEnd, last_);
+			chunks.append(reinterpret_cast<const char*>(pos_), static_cast<size_t>(length));
+			pos_ += length;
+		}
+		
+		++pos_;
+		return delegate_.stringValue(chunks, false) || aborted();
+	}
+	
+	
+	// Like the JSON reader, containers are read in a loop with an explicit stack.
+	bool readValue() {
+		for (;;) {
+			bool isKey = false, inIndefinite = false;
+			if (! containers_.empty()) {
+				auto& top = containers_.back();
+				isKey = top.atKey;
+				top.atKey = top.isObject && ! top.atKey;
+				inIndefinite = top.indefinite;
+				if (! inIndefinite)
+					--top.remaining;
+			}
+			
+			if (! has(1))
+				return fail(ErrorCode::UnexpectedEnd, last_);
+			
+			auto start = pos_;
+			Item item;
+			uint64_t count = 0;
+			bool indefinite = false;
+			if (! readItem(item, count, indefinite, isKey, FormatTag{}))
+				return false;
+			
+			if (item == Item::Break) {
+				if (! inIndefinite || (containers_.back().isObject && ! isKey))
+					return fail(ErrorCode::UnsupportedType, start);
+				containers_.back().indefinite = false;
+				containers_.back().remaining = 0;
+			}
+			else if (item != Item::Scalar) {
+				if (containers_.size() == maxDepth_)
+					return fail(ErrorCode::NestingTooDeep, start);
+				
+				// every item takes at least a byte, so a count can be checked
+				// against the data that is left before anything is read
+				bool isObject = item == Item::Object;
+				auto left = static_cast<uint64_t>(last_ - pos_);
+				if (! indefinite && count > (isObject ? left / 2 : left))
+					return fail(ErrorCode::UnexpectedEnd, last_);
+				
+				if (! (isObject ? delegate_.objectBegin() : delegate_.arrayBegin()))
+					return aborted();
+				auto items = static_cast<size_t>(isObject ? count * 2 : count);
+				containers_.push_back({ items, indefinite, isObject, isObject });
+			}
+			
+			// close the containers that end here
+			while (! containers_.empty() && ! containers_.back().indefinite && containers_.back().remaining == 0) {
+				bool isObject = containers_.back().isObject;
+				containers_.pop_back();
+				if (! (isObject ? delegate_.objectEnd() : delegate_.arrayEnd()))
+					return aborted();
+			}
+			
+			if (containers_.empty())
+				return true;
+		}
+	}
+
+	
+	// whether the document starts with an array or object, CBOR tags before it are skipped
+	bool atContainer(MessagePackTag) {
+		auto type = *pos_;
+		return (type >= 0x80 && type <= 0x9f) || (type >= 0xdc && type <= 0xdf);
+	}
+	
+	bool atContainer(CBORTag) {
+		while (has(1) && (*pos_ >> 5) == 6) {
+			auto info = *pos_ & 0x1f;
+			size_t bytes = info < 24 ? 0 : (info <= 27 ? size_t{1} << (info - 24) : 0);
+			if (info > 27 || ! has(1 + bytes))
+				return false;
+			pos_ += 1 + bytes;
+		}
+		return has(1) && ((*pos_ >> 5) == 4 || (*pos_ >> 5) == 5);
+	}
+	
+public:
+	static constexpr size_t DefaultMaxDepth = 512;
+	
+	BasicBinaryReader(Delegate& delegate, size_t maxDepth = DefaultMaxDepth)
+	: delegate_{ delegate }
+	, maxDepth_{ maxDepth }
+	{
+		containers_.reserve(std::min(maxDepth, DefaultMaxDepth));
+	}
+	
+	const ParseError& error() const { return error_; }
+	size_t maxDepth() const { return maxDepth_; }
+	
+	// the document must be an array or object that spans all of the data
+	bool parseDocument(const void* data, size_t size) {
+		first_ = pos_ = static_cast<const uint8_t*>(data);
+		last_ = first_ + size;
+		containers_.clear();
+		
+		if (! has(1) || ! atContainer(FormatTag{}))
+			return fail(ErrorCode::ExpectedContainer, pos_);
+		if (! readValue())
+			return false;
+		
+		if (pos_ != last_)
+			return fail(ErrorCode::TrailingData, pos_);
+		return true;
+	}
+};
+
+
+template <typename Delegate, BinaryFormat Format>
+constexpr size_t BasicBinaryReader<Delegate, Format>::DefaultMaxDepth;
+
+using MessagePackReader = BasicBinaryReader<ReaderDelegate, BinaryFormat::MessagePack>;
+using CBORReader = BasicBinaryReader<ReaderDelegate, BinaryFormat::CBOR>;
+
+
+
+template <BinaryFormat Format>
+class BinaryWriter {
+	std::string out_;
+	
+	void put(uint8_t byte) { out_.push_back(static_cast<char>(byte)); }
+	
+	void putUInt(uint64_t value, size_t bytes) {
+		for (size_t ix = bytes; ix > 0; --ix)
+			put(static_cast<uint8_t>(value >> (8 * (ix - 1))));
+	}
+	
+	void putDouble(double num) {
+		uint64_t bits;
+		std::memcpy(&bits, &num, sizeof(bits));
+		putUInt(bits, 8);
+	}
+	
+	// CBOR initial byte with its argument in the fewest bytes
+	void head(uint8_t major, uint64_t argument) {
+		major <<= 5;
+		if (argument < 24)
+			put(static_cast<uint8_t>(major | argument));
+		else if (argument <= 0xff) {
+			put(major | 24);
+			putUInt(argument, 1);
+		}
+		else if (argument <= 0xffff) {
+			put(major | 25);
+			putUInt(argument, 2);
+		}
+		else if (argument <= 0xffffffff) {
+			put(major | 26);
+			putUInt(argument, 4);
+		}
+		else {
+			put(major | 27);
+			putUInt(argument, 8);
+		}
+	}
+	
+	// MessagePack type byte for a size, fixType is used when the size fits in fixBits
+	void sizedType(size_t size, uint8_t fixType, size_t fixBits, uint8_t type8, uint8_t type16, uint8_t type32) {
+		if (size < (size_t{1} << fixBits))
+			put(static_cast<uint8_t>(fixType | size));
+		else if (type8 && size <= 0xff) {
+			put(type8);
+			putUInt(size, 1);
+		}
+		else if (size <= 0xffff) {
+			put(type16);
+			putUInt(size, 2);
+		}
+		else {
+			put(type32);
+			putUInt(size, 4);
+		}
+	}
+	
+	// MessagePack int of 1 << sizeLog2 bytes, firstType is the 1 byte type
+	void typedInt(uint64_t value, int sizeLog2, uint8_t firstType) {
+		put(static_cast<uint8_t>(firstType + sizeLog2));
+		putUInt(value, size_t{1} << sizeLog2);
+	}
+	
+	void number(double num) {
+		// integral values are written as the smallest integer that holds them,
+		// except -0, which would lose its sign
+		bool integral = num == std::floor(num) && std::abs(num) < 18446744073709551616.0 && ! (num == 0 && std::signbit(num));
+		
+		if (Format == BinaryFormat::CBOR) {
+			if (! integral) {
+				put(0xfb);
+				putDouble(num);
+			}
+			else if (num >= 0)
+				head(0, static_cast<uint64_t>(num));
+			else
+				head(1, static_cast<uint64_t>(-1.0 - num));
+			return;
+		}
+		
+		if (! integral || num < -9223372036854775808.0) {
+			put(0xcb);
+			putDouble(num);
+		}
+		else if (num >= 0) {
+			auto value = static_cast<uint64_t>(num);
+			if (value <= 0x7f)
+				put(static_cast<uint8_t>(value));
+			else
+				typedInt(value, value <= 0xff ? 0 : (value <= 0xffff ? 1 : (value <= 0xffffffff ? 2 : 3)), 0xcc);
+		}
+		else {
+			auto value = static_cast<int64_t>(num);
+			if (value >= -32)
+				put(static_cast<uint8_t>(value));
+			else
+				typedInt(static_cast<uint64_t>(value), value >= -128 ? 0 : (value >= -32768 ? 1 : (value >= -2147483648ll ? 2 : 3)), 0xd0);
+		}
+	}
+	
+	void string(StringRef str) {
+		if (Format == BinaryFormat::CBOR)
+			head(3, str.size());
+		else
+			sizedType(str.size(), 0xa0, 5, 0xd9, 0xda, 0xdb);
+		out_.append(str.data(), str.size());
+	}
+	
+	template <typename ValueClass>
+	void write(const ValueClass& val) {
+		switch (val.type()) {
+			case ValueKind::Null: put(Format == BinaryFormat::CBOR ? 0xf6 : 0xc0); break;
+			case ValueKind::False: put(Format == BinaryFormat::CBOR ? 0xf4 : 0xc2); break;
+			case ValueKind::True: put(Format == BinaryFormat::CBOR ? 0xf5 : 0xc3); break;
+			case ValueKind::Number: number(val.number()); break;
+			case ValueKind::String: string(val.stringRef()); break;
+			
+			case ValueKind::Array:
+				if (Format == BinaryFormat::CBOR)
+					head(4, val.size());
+				else
+					sizedType(val.size(), 0x90, 4, 0, 0xdc, 0xdd);
+				for (auto& element : val.values())
+					write(element);
+				break;
+			
+			case ValueKind::Object:
+				if (Format == BinaryFormat::CBOR)
+					head(5, val.size());
+				else
+					sizedType(val.size(), 0x80, 4, 0, 0xde, 0xdf);
+				for (auto item : val.items()) {
+					string(item.key);
+					write(item.value);
+				}
+				break;
+		}
+	}
+	
+public:
+	template <typename ValueClass>
+	std::string serialize(const ValueClass& root) {
+		out_.clear();
+		write(root);
+		
+		std::string result;
+		result.swap(out_);
+		return result;
+	}
+};
+
+
+// The parse functions return a Null document if the data is invalid,
+// the overloads taking a ParseError report why.
+template <BinaryFormat Format>
+auto parseBinary(const void* data, size_t size, ParseError& error, ObjectOrder order = ObjectOrder::Unordered)
+{
+	auto delegate = DocumentBuilder(order);
+	BasicBinaryReader<DocumentBuilder, Format> r { delegate };
+	
+	r.parseDocument(data, size);
+	error = r.error();
+	
+	return delegate.document();
+}
+
+inline auto parseMessagePack(const std::string& data, ParseError& error, ObjectOrder order = ObjectOrder::Unordered)
+{
+	return parseBinary<BinaryFormat::MessagePack>(data.data(), data.size(), error, order);
+}
+
+inline auto parseMessagePack(const std::string& data, ObjectOrder order = ObjectOrder::Unordered)
+{
+	ParseError error;
+	return parseMessagePack(data, error, order);
+}
+
+inline auto parseCBOR(const std::string& data, ParseError& error, ObjectOrder order = ObjectOrder::Unordered)
+{
+	return parseBinary<BinaryFormat::CBOR>(data.data(), data.size(), error, order);
+}
+
+inline auto parseCBOR(const std::string& data, ObjectOrder order = ObjectOrder::Unordered)
+{
+	ParseError error;
+	return parseCBOR(data, error, order);
+}
+
+
+// the MessagePack or CBOR encoding of a value or document
+template <template<typename T> class Allocator>
+std::string writeMessagePack(const BasicValue<Allocator>& root) {
+	return BinaryWriter<BinaryFormat::MessagePack>{}.serialize(root);
+}
+
+template <typename ValueClass>
+std::string writeMessagePack(const Document<ValueClass>& doc) {
+	return BinaryWriter<BinaryFormat::MessagePack>{}.serialize(doc.root());
+}
+
+template <template<typename T> class Allocator>
+std::string writeCBOR(const BasicValue<Allocator>& root) {
+	return BinaryWriter<BinaryFormat::CBOR>{}.serialize(root);
+}
+
+template <typename ValueClass>
+std::string writeCBOR(const Document<ValueClass>& doc) {
+	return BinaryWriter<BinaryFormat::CBOR>{}.serialize(doc.root());
+}
+
+
+} // ns krystal
+
+#endif
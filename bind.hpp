@@ -0,0 +1,436 @@
+// bind.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_BIND_H
+#define KRYSTAL_BIND_H
+
+#include "reader.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace krystal {
+
+
+/*
+ Structs are bound to JSON objects by specializing Fields<T> with a
+ constexpr list of fields:
+
+ struct Level {
+	std::string name;
+	double spawnDelay;
+	std::vector<int> waves;
+ };
+
+ namespace krystal {
+	template <> struct Fields<Level> {
+		static constexpr auto list() {
+			return std::make_tuple(
+				field("level name", &Level::name),
+				field("zombie spawn delay", &Level::spawnDelay),
+				field("waves", &Level::waves)
+			);
+		}
+	};
+ }
+
+ Level level;
+ bool ok = krystal::parseInto(level, json);
+
+ Supported member types are arithmetic types, bool, std::string,
+ std::vector of any supported type and other bound structs. Numbers are
+ truncated for integer members, a number out of a member's range fails the parse.
+ Keys without a field are skipped, null values leave a member untouched
+ and add no element to a vector.
+*/
+
+
+constexpr uint32_t fnv1a(const char* str, size_t length, uint32_t seed) {
+	uint32_t hash = 2166136261u ^ seed;
+	for (size_t ix = 0; ix < length; ++ix) {
+		hash ^= static_cast<uint8_t>(str[ix]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+constexpr size_t constLength(const char* str) {
+	size_t length = 0;
+	while (str[length])
+		++length;
+	return length;
+}
+
+
+template <typename T, typename M>
+struct Field {
+	const char* name;
+	size_t length;
+	M T::* member;
+	
+	constexpr Field(const char* fieldName, M T::* fieldMember)
+	: name{fieldName}, length{constLength(fieldName)}, member{fieldMember}
+	{}
+};
+
+template <typename T, typename M>
+constexpr Field<T, M> field(const char* name, M T::* member) {
+	return { name, member };
+}
+
+template <typename T>
+struct Fields;
+
+
+// A perfect hash of the field names of a struct, found at compile time by
+// trying seeds until every name hashes to its own slot. Looking up a key
+// at runtime is one hash, one table load and one compare.
+// With N²/2 slots or more about a third of all seeds give a perfect hash,
+// the 16384 slots of the widest structs still leave one in seven.
+constexpr size_t keyTableSize(size_t fieldCount) {
+	size_t size = 2;
+	while (size < fieldCount * fieldCount / 2 && size < 16384)
+		size *= 2;
+	return size;
+}
+
+template <size_t N>
+struct KeyTable {
+	static constexpr size_t Size = keyTableSize(N);
+	static_assert(N < 256, "bound structs are limited to 255 fields");
+	
+	uint32_t seed;
+	uint8_t slots[Size]; // field index + 1, 0 for empty slots
+	
+	constexpr size_t slotFor(const char* key, size_t length) const {
+		return fnv1a(key, length, seed) & (Size - 1);
+	}
+};
+
+template <typename Tuple, size_t... I>
+constexpr KeyTable<sizeof...(I)> makeKeyTable(const Tuple& fields, std::index_sequence<I...>) {
+	constexpr size_t N = sizeof...(I);
+	const char* names[N + 1] = { std::get<I>(fields).name..., nullptr };
+	size_t lengths[N + 1] = { std::get<I>(fields).length..., 0 };
+	KeyTable<N> table {};
+	
+	for (uint32_t seed = 0; seed < 100000; ++seed) {
+		for (auto& slot : table.slots)
+			slot = 0;
+		table.seed = seed;
+		
+		bool unique = true;
+		for (size_t ix = 0; ix < N && unique; ++ix) {
+			auto slot = table.slotFor(names[ix], lengths[ix]);
+			unique = table.slots[slot] == 0;
+			table.slots[slot] = static_cast<uint8_t>(ix + 1);
+		}
+		if (unique)
+			return table;
+	}
+	
+	throw std::logic_error("no perfect hash found, are the field names unique?");
+}
+
+template <typename T>
+struct FieldTable {
+	using List = decltype(Fields<T>::list());
+	static constexpr size_t Count = std::tuple_size<List>::value;
+	
+	static constexpr List list = Fields<T>::list();
+	static constexpr KeyTable<Count> keys = makeKeyTable(list, std::make_index_sequence<Count>{});
+};
+
+template <typename T>
+constexpr typename FieldTable<T>::List FieldTable<T>::list;
+
+template <typename T>
+constexpr KeyTable<FieldTable<T>::Count> FieldTable<T>::keys;
+
+
+// A BindSlot is a typed destination for the next JSON value, the sink holds
+// the functions that write each kind of value into it. Unsupported kinds of
+// values have a null function pointer.
+struct BindSink;
+
+struct BindSlot {
+	void* target;
+	const BindSink* sink;
+};
+
+struct BindSink {
+	bool (*number)(void*, double); // false if the number does not fit
+	void (*string)(void*, StringRef);
+	void (*boolean)(void*, bool);
+	BindSlot (*element)(void*);
+	BindSlot (*member)(void*, StringRef);
+};
+
+
+// values that have no destination are parsed and then ignored
+template <typename Unused = void>
+struct SkipBinder {
+	static bool number(void*, double) { return true; }
+	static void string(void*, StringRef) {}
+	static void boolean(void*, bool) {}
+	static BindSlot element(void*) { return slot(); }
+	static BindSlot member(void*, StringRef) { return slot(); }
+	
+	static const BindSink sink;
+	static BindSlot slot() { return { nullptr, &sink }; }
+};
+
+template <typename Unused>
+const BindSink SkipBinder<Unused>::sink = { number, string, boolean, element, member };
+
+
+// structs with a Fields<T> specialization
+template <typename T, typename Enable = void>
+struct Binder {
+	using Table = FieldTable<T>;
+	
+	template <size_t I>
+	static BindSlot fieldSlot(T& obj, size_t index, StringRef key, std::true_type) {
+		if (index != I)
+			return fieldSlot<I + 1>(obj, index, key, std::integral_constant<bool, (I + 1 < Table::Count)>{});
+		
+		const auto& field = std::get<I>(Table::list);
+		if (key.size() != field.length || std::memcmp(key.data(), field.name, field.length) != 0)
+			return SkipBinder<>::slot();
+		
+		using M = typename std::remove_reference<decltype(obj.*(field.member))>::type;
+		return Binder<M>::slot(&(obj.*(field.member)));
+	}
+	
+	template <size_t I>
+	static BindSlot fieldSlot(T&, size_t, StringRef, std::false_type) {
+		return SkipBinder<>::slot();
+	}
+	
+	static BindSlot member(void* target, StringRef key) {
+		auto index = Table::keys.slots[Table::keys.slotFor(key.data(), key.size())];
+		if (index == 0)
+			return SkipBinder<>::slot();
+		
+		return fieldSlot<0>(*static_cast<T*>(target), index - 1, key, std::integral_constant<bool, (Table::Count > 0)>{});
+	}
+	
+	static const BindSink sink;
+	static BindSlot slot(T* target) { return { target, &sink }; }
+};
+
+template <typename T, typename Enable>
+const BindSink Binder<T, Enable>::sink = { nullptr, nullptr, nullptr, nullptr, member };
+
+
+template <typename T>
+struct Binder<T, typename std::enable_if<std::is_arithmetic<T>::value && ! std::is_same<T, bool>::value>::type> {
+	// integers are truncated, numbers out of the range of T are refused
+	static bool fits(double num, std::true_type) {
+		auto whole = std::trunc(num);
+		return whole >= static_cast<double>(std::numeric_limits<T>::min()) && whole < static_cast<double>(std::numeric_limits<T>::max()) + 1.0;
+	}
+	
+	static bool fits(double num, std::false_type) {
+		return std::isinf(num) || std::abs(num) <= static_cast<double>(std::numeric_limits<T>::max());
+	}
+	
+	static bool number(void* target, double num) {
+		if (! fits(num, std::is_integral<T>{}))
+			return false;
+		*static_cast<T*>(target) = static_cast<T>(num);
+		return true;
+	}
+	
+	static const BindSink sink;
+	static BindSlot slot(T* target) { return { target, &sink }; }
+};
+
+template <typename T>
+const BindSink Binder<T, typename std::enable_if<std::is_arithmetic<T>::value && ! std::is_same<T, bool>::value>::type>::sink = { number, nullptr, nullptr, nullptr, nullptr };
+
+
+template <typename T>
+struct Binder<T, typename std::enable_if<std::is_same<T, bool>::value>::type> {
+	static void boolean(void* target, bool value) { *static_cast<T*>(target) = value; }
+	
+	static const BindSink sink;
+	static BindSlot slot(T* target) { return { target, &sink }; }
+};
+
+template <typename T>
+const BindSink Binder<T, typename std::enable_if<std::is_same<T, bool>::value>::type>::sink = { nullptr, nullptr, boolean, nullptr, nullptr };
+
+
+template <typename T>
+struct Binder<T, typename std::enable_if<std::is_same<T, std::string>::value>::type> {
+	static void string(void* target, StringRef str) { static_cast<T*>(target)->assign(str.data(), str.size()); }
+	
+	static const BindSink sink;
+	static BindSlot slot(T* target) { return { target, &sink }; }
+};
+
+template <typename T>
+const BindSink Binder<T, typename std::enable_if<std::is_same<T, std::string>::value>::type>::sink = { nullptr, string, nullptr, nullptr, nullptr };
+
+
+template <typename E, typename Alloc>
+struct Binder<std::vector<E, Alloc>> {
+	static BindSlot element(void* target) {
+		auto& elements = *static_cast<std::vector<E, Alloc>*>(target);
+		elements.emplace_back();
+		return Binder<E>::slot(&elements.back());
+	}
+	
+	static const BindSink sink;
+	static BindSlot slot(std::vector<E, Alloc>* target) { return { target, &sink }; }
+};
+
+template <typename E, typename Alloc>
+const BindSink Binder<std::vector<E, Alloc>>::sink = { nullptr, nullptr, nullptr, element, nullptr };
+
+
+
+template <typename T>
+class StructReader final : public ReaderDelegate {
+	struct Frame {
+		BindSlot slot;
+		bool isObject;
+	};
+	
+	BindSlot root_, member_ {};
+	std::vector<Frame> frames_;
+	bool expectKey_ = false;
+	
+	template <typename Delegate, typename Instrumentation>
+	friend class BasicReader;
+	template <typename Delegate, BinaryFormat Format>
+	friend class BasicBinaryReader;
+	
+	// the destination of the next value in the current context
+	BindSlot nextSlot() {
+		if (frames_.empty())
+			return root_;
+		auto& top = frames_.back();
+		if (top.isObject)
+			return member_;
+		return top.slot.sink->element(top.slot.target);
+	}
+	
+	void valueDone() {
+		expectKey_ = ! frames_.empty() && frames_.back().isObject;
+	}
+	
+	// a value whose type does not match its member stops the parse, nulls
+	// bind nothing and get no slot, which for a vector would add an element
+	bool nullValue() override {
+		valueDone();
+		return true;
+	}
+	
+	bool falseValue() override { return boolValue(false); }
+	bool trueValue() override { return boolValue(true); }
+	
+	bool boolValue(bool value) {
+		auto slot = nextSlot();
+		if (! slot.sink->boolean)
+			return false;
+		slot.sink->boolean(slot.target, value);
+		valueDone();
+		return true;
+	}
+	
+	bool numberValue(double num) override {
+		auto slot = nextSlot();
+		if (! slot.sink->number || ! slot.sink->number(slot.target, num))
+			return false;
+		valueDone();
+		return true;
+	}
+	
+	bool stringValue(StringRef str, bool) override {
+		if (expectKey_) {
+			auto& object = frames_.back().slot;
+			member_ = object.sink->member(object.target, str);
+			expectKey_ = false;
+			return true;
+		}
+		
+		auto slot = nextSlot();
+		if (! slot.sink->string)
+			return false;
+		slot.sink->string(slot.target, str);
+		valueDone();
+		return true;
+	}
+	
+	bool arrayBegin() override {
+		auto slot = nextSlot();
+		if (! slot.sink->element)
+			return false;
+		frames_.push_back({ slot, false });
+		return true;
+	}
+	
+	bool arrayEnd() override {
+		frames_.pop_back();
+		valueDone();
+		return true;
+	}
+	
+	bool objectBegin() override {
+		auto slot = nextSlot();
+		if (! slot.sink->member)
+			return false;
+		frames_.push_back({ slot, true });
+		expectKey_ = true;
+		return true;
+	}
+	
+	bool objectEnd() override {
+		frames_.pop_back();
+		valueDone();
+		return true;
+	}
+	
+	void error(const ParseError&) override {}
+
+public:
+	StructReader(T& target)
+	: root_( Binder<T>::slot(&target) )
+	{
+		frames_.reserve(16);
+	}
+};
+
+
+// parse JSON text directly into a bound struct or a vector of them
+// returns false if the text is invalid or a value's type does not match its member
+template <typename T, typename ForwardIterator>
+bool parseInto(T& target, ForwardIterator first, ForwardIterator last)
+{
+	auto delegate = StructReader<T>(target);
+	BasicReader<StructReader<T>> r { delegate };
+	ReaderStream<ForwardIterator> ris { std::move(first), std::move(last) };
+	
+	return r.parseDocument(ris);
+}
+
+template <typename T>
+bool parseInto(T& target, const std::string& json_string)
+{
+	return parseInto(target, begin(json_string), end(json_string));
+}
+
+
+} // ns krystal
+
+#endif
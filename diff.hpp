@@ -0,0 +1,619 @@
+// diff.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_DIFF_H
+#define KRYSTAL_DIFF_H
+
+#include "value.hpp"
+#include "document.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace krystal {
+
+
+/*
+ Differences between two values are expressed as a JSON Patch (RFC 6902),
+ an array of add, remove and replace operations, or as a JSON Merge Patch
+ (RFC 7386), an object with the changed members where null removes one.
+ Both are returned as documents and can be applied in place to another
+ document with applyPatch() and applyMergePatch().
+
+ The diff skips equal subtrees without visiting them. Values a clone still
+ shares with its original are the same value. Other containers differ if
+ their sizes or hashes do, and are compared in full only if they match.
+ The hashes come from a ValueHashes, which hashes each container once and
+ can be kept between diffs of a series of documents.
+*/
+
+using PatchDocument = decltype(std::declval<DocumentBuilder&>().document());
+
+
+// the document itself or any value
+template <typename ValueClass>
+const ValueClass& rootOf(const Document<ValueClass>& doc) { return doc.root(); }
+
+template <template<typename T> class Allocator>
+const BasicValue<Allocator>& rootOf(const BasicValue<Allocator>& value) { return value; }
+
+
+// deep equality, member order does not matter, numbers compare as doubles
+template <typename ValueA, typename ValueB>
+bool equalValues(const ValueA& a, const ValueB& b) {
+	if (a.type() != b.type())
+		return false;
+	
+	switch (a.type()) {
+		case ValueKind::Number:
+			return a.number() == b.number();
+		case ValueKind::String:
+			return a.stringRef() == b.stringRef();
+		case ValueKind::Array:
+			if (a.size() != b.size())
+				return false;
+			for (auto item : a.items())
+				if (! equalValues(item.value, b[item.index]))
+					return false;
+			return true;
+		case ValueKind::Object:
+			if (a.size() != b.size())
+				return false;
+			for (auto item : a.items()) {
+				auto key = item.key.str();
+				if (! b.contains(key) || ! equalValues(item.value, b[key]))
+					return false;
+			}
+			return true;
+		default:
+			return true;
+	}
+}
+
+
+
+// Hashes of values where the hash of a container is cached by the address
+// of its origin, the value that holds its data. Documents with clones cannot
+// be modified, so the hashes of an original also serve the values its clones
+// still share with it. All hashes are dropped once a document that was
+// hashed is gone, as its memory may be reused by another. Values passed in
+// without their document are not tracked, clear() the cache before their
+// memory is reused or they are modified. A stale hash can only make equal
+// values be compared in full, never make different ones count as equal.
+class ValueHashes {
+	std::unordered_map<const void*, uint64_t> containers_;
+	std::vector<std::weak_ptr<const void>> trees_;
+	
+	static uint64_t mix(uint64_t h) {
+		h ^= h >> 30;
+		h *= 0xbf58476d1ce4e5b9ull;
+		h ^= h >> 27;
+		h *= 0x94d049bb133111ebull;
+		return h ^ (h >> 31);
+	}
+	
+	// 8 chars at a time, long strings are most of the bytes of a document
+	static uint64_t bytes(StringRef str) {
+		uint64_t h = str.size() * 0x9e3779b97f4a7c15ull;
+		auto data = str.data();
+		auto left = str.size();
+		for (; left >= 8; data += 8, left -= 8) {
+			uint64_t word;
+			std::memcpy(&word, data, 8);
+			h = ((h << 29 | h >> 35) ^ word) * 0x9e3779b97f4a7c15ull;
+		}
+		if (left) {
+			uint64_t word = 0;
+			std::memcpy(&word, data, left);
+			h = ((h << 29 | h >> 35) ^ word) * 0x9e3779b97f4a7c15ull;
+		}
+		return h;
+	}
+	
+public:
+	template <typename ValueClass>
+	uint64_t hash(const ValueClass& value) {
+		switch (value.type()) {
+			case ValueKind::Null: return mix(1);
+			case ValueKind::False: return mix(2);
+			case ValueKind::True: return mix(3);
+			case ValueKind::Number: {
+				// -0 equals 0, adding 0 turns it into 0
+				auto num = value.number() + 0.0;
+				uint64_t bits;
+				std::memcpy(&bits, &num, sizeof(bits));
+				return mix(bits ^ 4);
+			}
+			case ValueKind::String: return mix(bytes(value.stringRef()) ^ 5);
+			default: break;
+		}
+		
+		auto& origin = value.origin();
+		auto cached = containers_.find(&origin);
+		if (cached != containers_.end())
+			return cached->second;
+		
+		uint64_t h;
+		if (value.isArray()) {
+			h = 6;
+			for (auto& element : value.values())
+				h = mix(h + hash(element));
+		}
+		else {
+			// members may be in any order, so their hashes are summed
+			h = 7;
+			for (auto item : value.items())
+				h += mix(bytes(item.key) * 31 + hash(item.value));
+			h = mix(h + value.size());
+		}
+		
+		containers_.emplace(&origin, h);
+		return h;
+	}
+	
+	// keep the hashes of doc's values for as long as doc exists
+	template <typename ValueClass>
+	void track(const Document<ValueClass>& doc) {
+		auto expired = std::any_of(trees_.begin(), trees_.end(), [](auto& tree) { return tree.expired(); });
+		if (expired)
+			clear();
+		
+		for (auto& tree : doc.lifetimes()) {
+			auto known = std::any_of(trees_.begin(), trees_.end(), [&](auto& other) {
+				return ! tree.owner_before(other) && ! other.owner_before(tree);
+			});
+			if (! known)
+				trees_.push_back(tree);
+		}
+	}
+	
+	template <template<typename T> class Allocator>
+	void track(const BasicValue<Allocator>&) {}
+	
+	void clear() {
+		containers_.clear();
+		trees_.clear();
+	}
+	
+	size_t size() const { return containers_.size(); }
+};
+
+
+
+// builds the patch documents of diffPatch() and diffMergePatch()
+class Differ {
+public:
+	using ValueType = PatchDocument::ValueType;
+	
+private:
+	ValueHashes& hashes_;
+	PatchDocument patch_;
+	std::string path_;
+	
+	template <typename ValueA, typename ValueB>
+	static bool sameOrigin(const ValueA&, const ValueB&) { return false; }
+	
+	template <typename ValueClass>
+	static bool sameOrigin(const ValueClass& a, const ValueClass& b) { return &a.origin() == &b.origin(); }
+	
+	// like equalValues(), but containers with different hashes are not compared
+	template <typename ValueA, typename ValueB>
+	bool same(const ValueA& a, const ValueB& b) {
+		if (a.type() != b.type())
+			return false;
+		
+		switch (a.type()) {
+			case ValueKind::Number: return a.number() == b.number();
+			case ValueKind::String: return a.stringRef() == b.stringRef();
+			case ValueKind::Array:
+			case ValueKind::Object:
+				if (sameOrigin(a, b))
+					return true;
+				return a.size() == b.size() && hashes_.hash(a) == hashes_.hash(b) && equalValues(a, b);
+			default: return true;
+		}
+	}
+	
+	// the path grows by a JSON Pointer token, ~ and / are escaped as ~0 and ~1
+	size_t pushKey(StringRef key) {
+		auto mark = path_.size();
+		path_ += '/';
+		for (auto ch : key) {
+			if (ch == '~') path_ += "~0";
+			else if (ch == '/') path_ += "~1";
+			else path_ += ch;
+		}
+		return mark;
+	}
+	
+	size_t pushIndex(size_t index) {
+		auto mark = path_.size();
+		path_ += '/';
+		path_ += std::to_string(index);
+		return mark;
+	}
+	
+	ValueType& operation(const char* op) {
+		auto& entry = patch_.root().emplace_back(patch_.make(ObjectOrder::InsertionOrder));
+		entry.emplace("op", patch_.make(op));
+		entry.emplace("path", patch_.make(path_));
+		return entry;
+	}
+	
+	template <typename ValueClass>
+	void operation(const char* op, const ValueClass& value) {
+		operation(op).emplace("value", patch_.make(value));
+	}
+	
+	template <typename ValueA, typename ValueB>
+	void compareObjects(const ValueA& from, const ValueB& to) {
+		for (auto item : from.items()) {
+			auto key = item.key.str();
+			auto mark = pushKey(item.key);
+			if (! to.contains(key))
+				operation("remove");
+			else
+				compare(item.value, to[key]);
+			path_.resize(mark);
+		}
+		
+		for (auto item : to.items()) {
+			if (! from.contains(item.key.str())) {
+				auto mark = pushKey(item.key);
+				operation("add", item.value);
+				path_.resize(mark);
+			}
+		}
+	}
+	
+	// equal elements at the start and end are skipped, the rest is compared
+	// pairwise and the surplus removed from or added to the end of the range
+	template <typename ValueA, typename ValueB>
+	void compareArrays(const ValueA& from, const ValueB& to) {
+		size_t first = 0, fromEnd = from.size(), toEnd = to.size();
+		while (first < fromEnd && first < toEnd && same(from[first], to[first]))
+			++first;
+		while (fromEnd > first && toEnd > first && same(from[fromEnd - 1], to[toEnd - 1])) {
+			--fromEnd;
+			--toEnd;
+		}
+		
+		auto common = std::min(fromEnd, toEnd);
+		for (auto ix = first; ix < common; ++ix) {
+			auto mark = pushIndex(ix);
+			compare(from[ix], to[ix]);
+			path_.resize(mark);
+		}
+		
+		// removed back to front, so the indexes of the remaining elements stay valid
+		for (auto ix = fromEnd; ix > common; --ix) {
+			auto mark = pushIndex(ix - 1);
+			operation("remove");
+			path_.resize(mark);
+		}
+		for (auto ix = common; ix < toEnd; ++ix) {
+			auto mark = pushIndex(ix);
+			operation("add", to[ix]);
+			path_.resize(mark);
+		}
+	}
+	
+	template <typename ValueA, typename ValueB>
+	ValueType mergeDiff(const ValueA& from, const ValueB& to) {
+		if (! from.isObject() || ! to.isObject())
+			return patch_.make(to);
+		
+		auto result = patch_.make(ObjectOrder::InsertionOrder);
+		for (auto item : from.items()) {
+			auto key = item.key.str();
+			if (! to.contains(key))
+				result.emplace(key, patch_.make(ValueKind::Null));
+			else {
+				auto& value = to[key];
+				if (! same(item.value, value))
+					result.emplace(key, mergeDiff(item.value, value));
+			}
+		}
+		
+		for (auto item : to.items()) {
+			auto key = item.key.str();
+			if (! from.contains(key))
+				result.emplace(key, patch_.make(item.value));
+		}
+		return result;
+	}
+	
+public:
+	explicit Differ(ValueHashes& hashes)
+	: hashes_{ hashes }
+	, patch_{ std::unique_ptr<Lake>{ new Lake() }, ValueType{} }
+	{}
+	
+	// append the JSON Patch operations that turn from into to
+	template <typename ValueA, typename ValueB>
+	void compare(const ValueA& from, const ValueB& to) {
+		if (same(from, to))
+			return;
+		
+		if (from.type() != to.type() || ! from.isContainer())
+			operation("replace", to);
+		else if (from.isObject())
+			compareObjects(from, to);
+		else
+			compareArrays(from, to);
+	}
+	
+	template <typename ValueA, typename ValueB>
+	PatchDocument patch(const ValueA& from, const ValueB& to) {
+		patch_.root() = patch_.make(ValueKind::Array);
+		path_.clear();
+		compare(from, to);
+		return std::move(patch_);
+	}
+	
+	template <typename ValueA, typename ValueB>
+	PatchDocument mergePatch(const ValueA& from, const ValueB& to) {
+		patch_.root() = mergeDiff(from, to);
+		return std::move(patch_);
+	}
+};
+
+
+// a JSON Patch that turns from into to, values or documents
+template <typename From, typename To>
+PatchDocument diffPatch(const From& from, const To& to, ValueHashes& hashes)
+{
+	hashes.track(from);
+	hashes.track(to);
+	return Differ{ hashes }.patch(rootOf(from), rootOf(to));
+}
+
+template <typename From, typename To>
+PatchDocument diffPatch(const From& from, const To& to)
+{
+	ValueHashes hashes;
+	return diffPatch(from, to, hashes);
+}
+
+// a JSON Merge Patch that turns from into to, members of to that are null cannot be expressed
+template <typename From, typename To>
+PatchDocument diffMergePatch(const From& from, const To& to, ValueHashes& hashes)
+{
+	hashes.track(from);
+	hashes.track(to);
+	return Differ{ hashes }.mergePatch(rootOf(from), rootOf(to));
+}
+
+template <typename From, typename To>
+PatchDocument diffMergePatch(const From& from, const To& to)
+{
+	ValueHashes hashes;
+	return diffMergePatch(from, to, hashes);
+}
+
+
+
+// Applies JSON Patch operations to a document in place. Values in the patch
+// are copied into the document. A failing operation throws, the operations
+// before it stay applied, so patch a clone() to keep the original intact.
+template <typename DocumentClass>
+class Patcher {
+	using ValueType = typename DocumentClass::ValueType;
+	
+	DocumentClass& doc_;
+	
+	[[noreturn]] static void fail(const std::string& why) {
+		throw std::runtime_error("Patch failed: " + why);
+	}
+	
+	// the unescaped tokens of a JSON Pointer, none for the root
+	static std::vector<std::string> tokens(const std::string& pointer) {
+		std::vector<std::string> result;
+		if (pointer.empty())
+			return result;
+		if (pointer[0] != '/')
+			fail("path " + pointer + " does not start with /");
+		
+		for (size_t ix = 1; ix <= pointer.size(); ++ix) {
+			if (ix == 1 || pointer[ix - 1] == '/')
+				result.emplace_back();
+			if (ix == pointer.size())
+				break;
+			
+			auto ch = pointer[ix];
+			if (ch == '~') {
+				auto next = ix + 1 < pointer.size() ? pointer[++ix] : 0;
+				if (next != '0' && next != '1')
+					fail("path " + pointer + " has an invalid ~ escape");
+				result.back() += next == '0' ? '~' : '/';
+			}
+			else if (ch != '/')
+				result.back() += ch;
+		}
+		return result;
+	}
+	
+	// array indexes are decimal without leading zeros, - is the end of the array
+	static size_t index(const std::string& token, size_t size, bool allowEnd) {
+		if (allowEnd && token == "-")
+			return size;
+		if (token.empty() || token.size() > 18 || (token.size() > 1 && token[0] == '0') || ! std::all_of(token.begin(), token.end(), [](char ch) { return ch >= '0' && ch <= '9'; }))
+			fail("invalid array index " + token);
+		
+		auto ix = static_cast<size_t>(std::stoull(token));
+		if (ix > size || (ix == size && ! allowEnd))
+			fail("array index " + token + " is out of range");
+		return ix;
+	}
+	
+	template <typename ValueClass>
+	static ValueClass& child(ValueClass& value, const std::string& token) {
+		if (value.isObject()) {
+			if (! value.contains(token))
+				fail("member " + token + " does not exist");
+			return value[token];
+		}
+		if (! value.isArray())
+			fail("path goes through a value that is not a container");
+		return value[index(token, value.size(), false)];
+	}
+	
+	// the container holding the value at path, path must not be the root
+	ValueType& parent(const std::vector<std::string>& path) {
+		auto value = &doc_.root();
+		for (size_t ix = 0; ix + 1 < path.size(); ++ix)
+			value = &child(*value, path[ix]);
+		return *value;
+	}
+	
+	const ValueType& get(const std::string& pointer) const {
+		auto value = &static_cast<const DocumentClass&>(doc_).root();
+		for (auto& token : tokens(pointer))
+			value = &child(*value, token);
+		return *value;
+	}
+	
+	void add(const std::string& pointer, ValueType value) {
+		auto path = tokens(pointer);
+		if (path.empty()) {
+			doc_.root() = std::move(value);
+			return;
+		}
+		
+		auto& container = parent(path);
+		if (container.isObject())
+			container.emplace(path.back(), std::move(value));
+		else if (container.isArray())
+			container.insert(index(path.back(), container.size(), true), std::move(value));
+		else
+			fail("cannot add to a value that is not a container");
+	}
+	
+	ValueType take(const std::string& pointer) {
+		auto path = tokens(pointer);
+		if (path.empty())
+			fail("cannot remove the root");
+		
+		auto& container = parent(path);
+		auto& value = child(container, path.back());
+		auto taken = std::move(value);
+		if (container.isObject())
+			container.erase(path.back());
+		else
+			container.erase(index(path.back(), container.size(), false));
+		return taken;
+	}
+	
+	void replace(const std::string& pointer, ValueType value) {
+		auto path = tokens(pointer);
+		if (path.empty())
+			doc_.root() = std::move(value);
+		else
+			child(parent(path), path.back()) = std::move(value);
+	}
+	
+	template <typename ValueClass>
+	static std::string member(const ValueClass& operation, const char* name) {
+		if (! operation.contains(name) || ! operation[name].isString())
+			fail(std::string("operation has no ") + name);
+		return operation[name].string();
+	}
+	
+public:
+	explicit Patcher(DocumentClass& doc) : doc_{ doc } {}
+	
+	template <typename ValueClass>
+	void apply(const ValueClass& operation) {
+		if (! operation.isObject())
+			fail("operation is not an object");
+		auto op = member(operation, "op");
+		auto path = member(operation, "path");
+		
+		auto value = [&] {
+			if (! operation.contains("value"))
+				fail(op + " operation has no value");
+			return doc_.make(operation["value"]);
+		};
+		
+		if (op == "add")
+			add(path, value());
+		else if (op == "remove")
+			take(path);
+		else if (op == "replace")
+			replace(path, value());
+		else if (op == "move") {
+			auto from = member(operation, "from");
+			if (from == path)
+				return;
+			if (path.compare(0, from.size() + 1, from + '/') == 0)
+				fail("cannot move " + from + " into itself");
+			add(path, take(from));
+		}
+		else if (op == "copy")
+			add(path, doc_.make(get(member(operation, "from"))));
+		else if (op == "test") {
+			if (! operation.contains("value") || ! equalValues(get(path), operation["value"]))
+				fail("test of " + path + " failed");
+		}
+		else
+			fail("unknown operation " + op);
+	}
+};
+
+
+// apply a JSON Patch, an array of operations, to doc in place
+template <typename DocumentClass, typename Patch>
+void applyPatch(DocumentClass& doc, const Patch& patch)
+{
+	auto& operations = rootOf(patch);
+	if (! operations.isArray())
+		throw std::runtime_error("Patch failed: a JSON Patch must be an array");
+	
+	Patcher<DocumentClass> patcher { doc };
+	for (auto& operation : operations.values())
+		patcher.apply(operation);
+}
+
+
+template <typename DocumentClass, typename ValueClass, typename PatchValue>
+void mergeInto(DocumentClass& doc, ValueClass& target, const PatchValue& patch)
+{
+	if (! patch.isObject()) {
+		target = doc.make(patch);
+		return;
+	}
+	
+	if (! target.isObject())
+		target = doc.make(ValueKind::Object);
+	for (auto item : patch.items()) {
+		auto key = item.key.str();
+		if (item.value.isNull())
+			target.erase(key);
+		else if (item.value.isObject()) {
+			if (! target.contains(key))
+				target.emplace(key, doc.make(ValueKind::Object));
+			mergeInto(doc, target[key], item.value);
+		}
+		else
+			target.emplace(key, doc.make(item.value));
+	}
+}
+
+// apply a JSON Merge Patch to doc in place
+template <typename DocumentClass, typename Patch>
+void applyMergePatch(DocumentClass& doc, const Patch& patch)
+{
+	mergeInto(doc, doc.root(), rootOf(patch));
+}
+
+
+} // ns krystal
+
+#endif
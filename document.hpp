@@ -10,6 +10,11 @@
 #include <iosfwd>
 #include <memory>
 #include <iterator>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace krystal {
 
@@ -62,20 +67,148 @@ followed by sets of hashed keys (uint32) and values of object
  */
 
 
+class ShapeTable {
+	std::unordered_map<std::string, std::unique_ptr<Shape>> shapes_;
+	std::string signature_;
+	Shape pending_;
+	
+public:
+	// placeholder shape for objects that are still being built
+	const Shape* pending() const { return &pending_; }
+	
+	size_t size() const { return shapes_.size(); }
+	
+	// returns the unique shape for a list of keys or nullptr if the keys
+	// contain duplicates, in which case the object cannot be shaped
+	template <typename InputIterator>
+	const Shape* intern(InputIterator first, InputIterator last) {
+		signature_.clear();
+		for (auto it = first; it != last; ++it) {
+			auto length = static_cast<uint32_t>(it->size());
+			signature_.append(reinterpret_cast<const char*>(&length), sizeof(length));
+			signature_.append(*it);
+		}
+		
+		auto found = shapes_.find(signature_);
+		if (found != shapes_.end())
+			return found->second.get();
+		
+		std::unique_ptr<Shape> shape { new Shape(first, last) };
+		if (! shape->hasUniqueKeys())
+			return nullptr;
+		
+		auto result = shape.get();
+		shapes_.emplace(signature_, std::move(shape));
+		return result;
+	}
+};
+
+
 template <typename ValueClass>
 class Document {
-	std::unique_ptr<krystal::Lake> memPool_;
-	ValueClass root_;
+	// the values of a document with the pool and shapes they use,
+	// kept alive for as long as the document or any of its clones exist
+	struct Tree {
+		std::unique_ptr<krystal::Lake> pool;
+		std::shared_ptr<krystal::ShapeTable> shapes;
+		// trees merged into this one by adopt(), root has values allocated from them
+		std::vector<std::shared_ptr<const Tree>> parts;
+		ValueClass root; // destroyed before the pool, shapes and parts
+		
+		Tree(std::unique_ptr<krystal::Lake> treePool, std::shared_ptr<krystal::ShapeTable> treeShapes, ValueClass&& treeRoot)
+		: pool { std::move(treePool) }, shapes { std::move(treeShapes) }, root { std::move(treeRoot) }
+		{}
+	};
+	
+	std::shared_ptr<Tree> tree_;
+	// trees of the documents this one was cloned from, it shares their values
+	std::vector<std::shared_ptr<const Tree>> origins_;
+	
+	template <typename ForwardIterator>
+	friend class ArrayStream;
+	
+	// Empties the document and returns its pool reset for reuse, or a new
+	// pool if the document's values are still used by clones.
+	std::unique_ptr<krystal::Lake> recyclePool() {
+		std::unique_ptr<krystal::Lake> pool;
+		if (tree_ && tree_.use_count() == 1 && tree_->parts.empty() && tree_->pool) {
+			tree_->root = ValueClass{};
+			pool = std::move(tree_->pool);
+			pool->reset();
+		}
+		else
+			pool.reset(new krystal::Lake());
+		
+		tree_ = std::make_shared<Tree>(nullptr, nullptr, ValueClass{});
+		origins_.clear();
+		return pool;
+	}
 	
 public:
 	using ValueType = ValueClass;
 	
-	Document(std::unique_ptr<krystal::Lake> memPool, ValueClass&& root)
-	: memPool_ { std::move(memPool) }, root_ { std::move(root) }
+	Document(std::unique_ptr<krystal::Lake> memPool, ValueClass&& root, std::shared_ptr<krystal::ShapeTable> shapes = nullptr)
+	: tree_ { std::make_shared<Tree>(std::move(memPool), std::move(shapes), std::move(root)) }
 	{}
 	
+	// A clone shares all values with this document and only copies the
+	// containers on the path to a value that is modified through root().
+	// A document cannot be modified itself while it has clones.
+	Document clone() const {
+		std::unique_ptr<krystal::Lake> pool { new krystal::Lake() };
+		ValueClass root { typename ValueClass::ShareTag{}, tree_->root };
+		if (root.isShared())
+			root.unshare(pool.get());
+		
+		Document copy { std::move(pool), std::move(root) };
+		copy.origins_ = origins_;
+		copy.origins_.push_back(tree_);
+		return copy;
+	}
+	
+	// Keep all memory of other alive for as long as this document exists,
+	// so values can be moved from other's root into this one. other is
+	// left empty and can only be destroyed or assigned to.
+	void adopt(Document&& other) {
+		origins_.insert(origins_.end(), other.origins_.begin(), other.origins_.end());
+		tree_->parts.push_back(std::move(other.tree_));
+		other.origins_.clear();
+	}
+	
+	// mutable access to the document, modify values through the non-const
+	// subscript operators to unshare them from the document's origin
+	ValueClass& root() {
+		if (tree_.use_count() > 1)
+			throw std::runtime_error("Trying to modify a document that has clones.");
+		return tree_->root;
+	}
+	
+	const ValueClass& root() const { return tree_->root; }
+	
+	// values to be added to this document, allocated from its pool
+	ValueClass make(ValueKind kind) { return { kind, tree_->pool.get() }; }
+	ValueClass make(ObjectOrder order) { return { order, tree_->pool.get() }; }
+	ValueClass make(const std::string& str) { return { str, tree_->pool.get() }; }
+	ValueClass make(const char* str) { return { str, tree_->pool.get() }; }
+	ValueClass make(double num) { return ValueClass{ num }; }
+	ValueClass make(int num) { return ValueClass{ num }; }
+	ValueClass make(bool b) { return ValueClass{ b }; }
+	
+	// a deep copy of a value from another document or a heap value
+	template <template<typename T> class SourceAllocator>
+	ValueClass make(const BasicValue<SourceAllocator>& source) { return ValueClass::copyOf(source, tree_->pool.get()); }
+	
+	// a new document holding only a deep copy of value, unlike clone() it
+	// does not keep the memory of value's own document alive
+	template <template<typename T> class SourceAllocator>
+	static Document copyOf(const BasicValue<SourceAllocator>& value) {
+		std::unique_ptr<krystal::Lake> pool { new krystal::Lake() };
+		auto root = ValueClass::copyOf(value, pool.get());
+		return { std::move(pool), std::move(root) };
+	}
+	
 	// forward const value APIs (container ones only, as a doc can only be array, object or null)
-	inline ValueKind type() const { return root_.type(); }
+	inline ValueKind type() const { return root().type(); }
 	inline bool isA(const ValueKind vtype) const { return type() == vtype; }
 	bool isNull() const { return isA(ValueKind::Null); }
 	bool isFalse() const { return isA(ValueKind::False); }
@@ -87,17 +220,40 @@ public:
 	bool isObject() const { return isA(ValueKind::Object); }
 	bool isContainer() const { return isObject() || isArray(); }
 	
-	size_t size() const { return root_.size(); }
+	size_t size() const { return root().size(); }
+	
+	bool contains(const std::string& key) const { return root().contains(key); }
 	
-	bool contains(const std::string& key) const { return root_.contains(key); }
+	const ValueClass& operator[](const std::string& key) const { return root()[key]; }
+	const ValueClass& operator[](const size_t index) const { return root()[index]; }
 	
-	const ValueClass& operator[](const std::string& key) const { return root_[key]; }
-	const ValueClass& operator[](const size_t index) const { return root_[index]; }
+	template <typename Arith>
+	size_t copyNumbers(Arith* dest, size_t count) const { return root().copyNumbers(dest, count); }
 	
-	decltype(root_.begin()) begin() const { return root_.begin(); }
-	decltype(root_.end()) end() const { return root_.end(); }
+	decltype(std::declval<const ValueClass&>().begin()) begin() const { return root().begin(); }
+	decltype(std::declval<const ValueClass&>().end()) end() const { return root().end(); }
 	
-	void debugPrint(std::ostream& os) const { return root_.debugPrint(os); }
+	decltype(std::declval<const ValueClass&>().items()) items() const { return root().items(); }
+	decltype(std::declval<const ValueClass&>().keys()) keys() const { return root().keys(); }
+	decltype(std::declval<const ValueClass&>().values()) values() const { return root().values(); }
+	
+	void debugPrint(std::ostream& os) const { return root().debugPrint(os); }
+	
+	// expire once the memory of the document's values may be freed or reused,
+	// for caches that are keyed by the addresses of values
+	std::vector<std::weak_ptr<const void>> lifetimes() const {
+		std::vector<std::weak_ptr<const void>> trees { tree_ };
+		trees.insert(trees.end(), origins_.begin(), origins_.end());
+		return trees;
+	}
+	
+	// number of bytes allocated from the document's Lakes, excluding those of its origins
+	size_t memoryUsed() const {
+		size_t bytes = tree_->pool ? tree_->pool->bytesAllocated() : 0;
+		for (auto& part : tree_->parts)
+			bytes += part->pool ? part->pool->bytesAllocated() : 0;
+		return bytes;
+	}
 };
 
 // Document non-members
@@ -114,25 +270,44 @@ std::ostream& operator<<(std::ostream& os, const Document<ValueClass>& t) { t.de
 namespace { const std::string DOC_ROOT_KEY {"___DOCUMENT___"}; }
 
 
-class DocumentBuilder : public ReaderDelegate {
+class DocumentBuilder final : public ReaderDelegate {
 	template <typename U>
 	using Allocator = LakeAllocator<U>;
 	
+	// Objects that are elements of an array are built as shaped objects,
+	// storing only their values while the keys are matched against the
+	// shape of the previous element. The keys are only copied when an
+	// object's members diverge from that prediction.
+	struct ShapeFrame {
+		const Shape* predicted;
+		size_t keyStart;
+		size_t keyCount;
+		bool diverged;
+	};
+	
 	std::unique_ptr<krystal::Lake> memPool_;
+	std::unique_ptr<krystal::ShapeTable> shapes_;
 	BasicValue<Allocator> root_, *curNode_ = nullptr;
 	std::vector<BasicValue<Allocator>*> contextStack_;
+	std::vector<ShapeFrame> shapeFrames_;
+	std::vector<std::string> pendingKeys_;
 	std::string nextKey_;
-	bool hadError_ = false;
-	
-	friend class Reader;
+	bool haveKey_;
+	ObjectOrder order_;
+	ParseError error_;
 	
 	template <typename ...Args>
 	void append(Args&&... args) {
 		BasicValue<Allocator>* mv;
 		
-		if (curNode_->isObject()) {
+		if (curNode_->isShaped()) {
+			auto& values = curNode_->elements();
+			values.emplace_back(std::forward<Args>(args)...);
+			mv = &values.back();
+		}
+		else if (curNode_->isObject()) {
 			mv = &curNode_->emplace(nextKey_, std::forward<Args>(args)...);
-			nextKey_.clear();
+			haveKey_ = false;
 		}
 		else // array
 			mv = &curNode_->emplace_back(std::forward<Args>(args)...);
@@ -143,97 +318,228 @@ class DocumentBuilder : public ReaderDelegate {
 		}
 	}
 	
+	void shapeKey(ShapeFrame& frame, StringRef key) {
+		auto index = frame.keyCount++;
+		if (! frame.diverged) {
+			auto predicted = frame.predicted;
+			if (predicted && index < predicted->size() && predicted->key(index) == key)
+				return;
+			
+			frame.diverged = true;
+			if (predicted)
+				pendingKeys_.insert(pendingKeys_.end(), predicted->keys().begin(), predicted->keys().begin() + index);
+		}
+		pendingKeys_.emplace_back(key.data(), key.size());
+	}
+	
+	void resolveShape() {
+		auto& frame = shapeFrames_.back();
+		auto& values = curNode_->elements();
+		const Shape* shape = frame.predicted;
+		
+		if (frame.diverged || ! shape || values.size() != shape->size()) {
+			if (! frame.diverged && shape)
+				pendingKeys_.insert(pendingKeys_.end(), shape->keys().begin(), shape->keys().begin() + frame.keyCount);
+			
+			auto keys = pendingKeys_.begin() + frame.keyStart;
+			shape = shapes_->intern(keys, pendingKeys_.end());
+			
+			if (! shape) {
+				// duplicate keys, fall back to a normal object where the latest value wins
+				BasicValue<Allocator> obj { order_, memPool_.get() };
+				for (auto& value : values)
+					obj.emplace(*keys++, std::move(value));
+				*curNode_ = std::move(obj);
+			}
+		}
+		
+		if (shape)
+			curNode_->setShape(shape);
+		
+		pendingKeys_.resize(frame.keyStart);
+		shapeFrames_.pop_back();
+	}
+	
+public:
+	// objects in arrays always keep their order, order applies to all others
+	DocumentBuilder(ObjectOrder order = ObjectOrder::Unordered)
+	: memPool_ { new krystal::Lake() }
+	, shapes_ { new krystal::ShapeTable() }
+	, root_{ ValueKind::Object, memPool_.get() }
+	, nextKey_{ DOC_ROOT_KEY }
+	, haveKey_{ true }
+	, order_{ order }
+	{
+		contextStack_.reserve(32);
+		contextStack_.push_back(&root_);
+		curNode_ = &root_;
+	}
+	
+	// start building a new document in pool, after document() was called
+	void reset(std::unique_ptr<krystal::Lake> pool) {
+		root_ = BasicValue<Allocator>{ ValueKind::Object, pool.get() };
+		memPool_ = std::move(pool);
+		shapes_.reset(new krystal::ShapeTable());
+		contextStack_.clear();
+		contextStack_.push_back(&root_);
+		curNode_ = &root_;
+		shapeFrames_.clear();
+		pendingKeys_.clear();
+		nextKey_ = DOC_ROOT_KEY;
+		haveKey_ = true;
+		error_ = ParseError{};
+	}
+	
+	krystal::Document<BasicValue<Allocator>> document() {
+		// the DocumentBuilder instance is useless after the call to document()
+		BasicValue<Allocator> root { ValueKind::Null, memPool_.get() };
+		if (! error_)
+			root = std::move(root_[DOC_ROOT_KEY]);
+		
+		// the wrapper object lives in the pool, so it must go before the pool does
+		root_ = BasicValue<Allocator>{ ValueKind::Null, memPool_.get() };
+		
+		if (error_)
+			return { std::move(memPool_), std::move(root) };
+		return { std::move(memPool_), std::move(root), std::move(shapes_) };
+	}
+	
+	const ParseError& error() const { return error_; }
+	
+	// memory blocks the builder's pool holds, before document() is called
+	size_t poolBlocks() const { return memPool_ ? memPool_->blockCount() : 0; }
+	
 	
-	void nullValue() override {
+	// -- building, as a reader's delegate, these can also be called by
+	// delegates that filter or validate events before passing them on
+	
+	bool nullValue() override {
 		append(ValueKind::Null, memPool_.get());
+		return true;
 	}
 	
-	void falseValue() override {
+	bool falseValue() override {
 		append(ValueKind::False, memPool_.get());
+		return true;
 	}
 	
-	void trueValue() override {
+	bool trueValue() override {
 		append(ValueKind::True, memPool_.get());
+		return true;
 	}
 	
-	void numberValue(double num) override {
+	bool numberValue(double num) override {
 		append(num);
+		return true;
 	}
 	
-	void stringValue(const std::string& str) override {
-		if (curNode_->isArray() || nextKey_.size())
-			append(str, memPool_.get());
+	// string values are copied once, into the Lake or inline in the value
+	bool stringValue(StringRef str, bool) override {
+		if (curNode_->isShaped()) {
+			auto& frame = shapeFrames_.back();
+			if (frame.keyCount > curNode_->elements().size())
+				append(str, memPool_.get());
 			else
-				nextKey_ = str;
+				shapeKey(frame, str);
+		}
+		else if (curNode_->isArray() || haveKey_)
+			append(str, memPool_.get());
+		else {
+			nextKey_.assign(str.data(), str.size());
+			haveKey_ = true;
+		}
+		return true;
 	}
 	
-	void arrayBegin() override {
+	bool arrayBegin() override {
 		append(ValueKind::Array, memPool_.get());
+		return true;
 	}
 	
-	void arrayEnd() override {
+	bool arrayEnd() override {
 		contextStack_.pop_back();
 		curNode_ = contextStack_.back();
+		return true;
 	}
 	
-	void objectBegin() override {
-		append(ValueKind::Object, memPool_.get());
+	bool objectBegin() override {
+		if (curNode_->isArray()) {
+			auto& siblings = curNode_->elements();
+			const Shape* predicted = nullptr;
+			if (siblings.size() && siblings.back().isShaped())
+				predicted = siblings.back().shape();
+			
+			append(BasicValue<Allocator>{ shapes_->pending(), memPool_.get() });
+			if (predicted)
+				curNode_->elements().reserve(predicted->size());
+			shapeFrames_.push_back({ predicted, pendingKeys_.size(), 0, false });
+		}
+		else
+			append(order_, memPool_.get());
+		return true;
 	}
 	
-	void objectEnd() override {
+	bool objectEnd() override {
+		if (curNode_->isShaped())
+			resolveShape();
 		contextStack_.pop_back();
 		curNode_ = contextStack_.back();
+		return true;
 	}
 	
-	void error(const std::string& msg, ptrdiff_t offset) override {
-		hadError_ = true;
-	}
-	
-public:
-	DocumentBuilder()
-	: memPool_ { new krystal::Lake() }
-	, root_{ ValueKind::Object, memPool_.get() }
-	, nextKey_{ DOC_ROOT_KEY }
-	{
-		contextStack_.reserve(32);
-		contextStack_.push_back(&root_);
-		curNode_ = &root_;
-	}
-	
-	krystal::Document<BasicValue<Allocator>> document() {
-		// the DocumentBuilder instance is useless after the call to document()
-		if (hadError_) {
-			return { std::move(memPool_), { ValueKind::Null, memPool_.get() } };
-		}
-		return { std::move(memPool_), std::move(root_[DOC_ROOT_KEY]) };
+	void error(const ParseError& error) override {
+		error_ = error;
 	}
 };
 
 
 
+// The parse functions return a Null document if the JSON text is invalid,
+// the overloads taking a ParseError report why.
 template <typename ForwardIterator>
-auto parse(ForwardIterator first, ForwardIterator last)
+auto parse(ForwardIterator first, ForwardIterator last, ParseError& error, ObjectOrder order = ObjectOrder::Unordered)
 {
-	auto delegate = DocumentBuilder();
-	Reader r { delegate };
+	auto delegate = DocumentBuilder(order);
+	BasicReader<DocumentBuilder> r { delegate };
 	ReaderStream<ForwardIterator> ris { std::move(first), std::move(last) };
 	
 	r.parseDocument(ris);
+	error = r.error();
 	
 	return delegate.document();
 }
 
+template <typename ForwardIterator>
+auto parse(ForwardIterator first, ForwardIterator last, ObjectOrder order = ObjectOrder::Unordered)
+{
+	ParseError error;
+	return parse(std::move(first), std::move(last), error, order);
+}
+
 template <typename IStream>
-auto parseStream(IStream &is)
+auto parseStream(IStream &is, ParseError& error, ObjectOrder order = ObjectOrder::Unordered)
 {
 	is >> std::noskipws;
 	std::istream_iterator<typename IStream::char_type> first{is};
-	return parse(first, {});
+	return parse(first, {}, error, order);
+}
+
+template <typename IStream>
+auto parseStream(IStream &is, ObjectOrder order = ObjectOrder::Unordered)
+{
+	ParseError error;
+	return parseStream(is, error, order);
+}
+
+inline auto parseString(const std::string& json_string, ParseError& error, ObjectOrder order = ObjectOrder::Unordered)
+{
+	return parse(begin(json_string), end(json_string), error, order);
 }
 
-auto parseString(std::string json_string)
+inline auto parseString(const std::string& json_string, ObjectOrder order = ObjectOrder::Unordered)
 {
-	return parse(begin(json_string), end(json_string));
+	ParseError error;
+	return parseString(json_string, error, order);
 }
 
 
@@ -0,0 +1,137 @@
+// file.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_FILE_H
+#define KRYSTAL_FILE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define KRYSTAL_HAS_MMAP 1
+#endif
+
+namespace krystal {
+
+
+// Reads a file through a fixed size buffer, its iterators are single pass
+// input iterators over the chars of the file, usable as a parse source.
+class FileSource {
+	std::FILE* file_;
+	std::unique_ptr<char[]> buffer_;
+	size_t bufferSize_, pos_ = 0, end_ = 0;
+	bool eof_ = false;
+	
+	void refill() {
+		pos_ = 0;
+		end_ = eof_ ? 0 : std::fread(buffer_.get(), 1, bufferSize_, file_);
+		eof_ = end_ < bufferSize_;
+	}
+	
+public:
+	static constexpr size_t DefaultBufferSize = 256 * 1024;
+	
+	explicit FileSource(const std::string& path, size_t bufferSize = DefaultBufferSize)
+	: file_ { std::fopen(path.c_str(), "rb") }
+	, buffer_ { new char[bufferSize] }
+	, bufferSize_ { bufferSize }
+	{
+		if (! file_)
+			throw std::runtime_error("Cannot open file " + path);
+		refill();
+	}
+	
+	~FileSource() {
+		std::fclose(file_);
+	}
+	
+	FileSource(const FileSource&) = delete;
+	FileSource& operator=(const FileSource&) = delete;
+	
+	class iterator {
+		FileSource* source_;
+		
+		bool atEnd() const { return source_ == nullptr || source_->pos_ == source_->end_; }
+	
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = char;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const char*;
+		using reference = const char&;
+		
+		explicit iterator(FileSource* source = nullptr) : source_{source} {}
+		
+		reference operator*() const { return source_->buffer_[source_->pos_]; }
+		
+		iterator& operator++() {
+			if (++source_->pos_ == source_->end_)
+				source_->refill();
+			return *this;
+		}
+		
+		bool operator==(const iterator& rhs) const { return atEnd() == rhs.atEnd(); }
+		bool operator!=(const iterator& rhs) const { return atEnd() != rhs.atEnd(); }
+	};
+	
+	iterator begin() { return iterator{ this }; }
+	iterator end() { return iterator{}; }
+};
+
+
+#ifdef KRYSTAL_HAS_MMAP
+
+// A read-only file mapped into memory, pages are only read from disk as
+// they are accessed. An empty file maps to an empty range.
+class MappedFile {
+	void* data_ = nullptr;
+	size_t size_ = 0;
+	
+public:
+	explicit MappedFile(const std::string& path) {
+		auto fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("Cannot open file " + path);
+		
+		struct stat info;
+		if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+			size_ = static_cast<size_t>(info.st_size);
+			data_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data_ == MAP_FAILED)
+				data_ = nullptr;
+		}
+		::close(fd);
+		
+		if (data_ == nullptr && size_ > 0)
+			throw std::runtime_error("Cannot map file " + path);
+	}
+	
+	~MappedFile() {
+		if (data_)
+			::munmap(data_, size_);
+	}
+	
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	
+	const void* data() const { return data_; }
+	size_t size() const { return size_; }
+	
+	const char* begin() const { return static_cast<const char*>(data_); }
+	const char* end() const { return begin() + size_; }
+};
+
+#endif
+
+
+} // ns krystal
+
+#endif
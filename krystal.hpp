@@ -4,3 +4,13 @@
 #include "value.hpp"
 #include "reader.hpp"
 #include "document.hpp"
+#include "numbers.hpp"
+#include "bind.hpp"
+#include "snapshot.hpp"
+#include "binary.hpp"
+#include "parallel.hpp"
+#include "stream.hpp"
+#include "profile.hpp"
+#include "schema.hpp"
+#include "tape.hpp"
+#include "diff.hpp"
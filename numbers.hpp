@@ -0,0 +1,80 @@
+// numbers.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_NUMBERS_H
+#define KRYSTAL_NUMBERS_H
+
+#include "reader.hpp"
+
+#include <string>
+#include <vector>
+
+namespace krystal {
+
+
+// NumberArrayBuilder is a ReaderDelegate that reads an array of numbers
+// straight into a contiguous vector, without creating a value per element.
+// Nested arrays are flattened, so [[x,y,z],[x,y,z]] yields xyzxyz.
+// Any non-number value or an object stops the parse.
+template <typename Arith>
+class NumberArrayBuilder final : public ReaderDelegate {
+	std::vector<Arith>& numbers_;
+	
+	template <typename Delegate, typename Instrumentation>
+	friend class BasicReader;
+	template <typename Delegate, BinaryFormat Format>
+	friend class BasicBinaryReader;
+	
+	bool nullValue() override { return false; }
+	bool falseValue() override { return false; }
+	bool trueValue() override { return false; }
+	bool stringValue(StringRef, bool) override { return false; }
+	
+	bool numberValue(double num) override {
+		numbers_.push_back(static_cast<Arith>(num));
+		return true;
+	}
+	
+	bool arrayBegin() override { return true; }
+	bool arrayEnd() override { return true; }
+	
+	bool objectBegin() override { return false; }
+	bool objectEnd() override { return false; }
+	
+	void error(const ParseError&) override {}
+
+public:
+	NumberArrayBuilder(std::vector<Arith>& numbers)
+	: numbers_(numbers)
+	{}
+};
+
+
+// parse a JSON array of numbers and append the values to numbers
+// returns false if the text was not a valid array of only numbers, numbers
+// is then restored to the size it had before the call
+template <typename Arith, typename ForwardIterator>
+bool parseNumbers(ForwardIterator first, ForwardIterator last, std::vector<Arith>& numbers)
+{
+	auto originalSize = numbers.size();
+	auto delegate = NumberArrayBuilder<Arith>(numbers);
+	BasicReader<NumberArrayBuilder<Arith>> r { delegate };
+	ReaderStream<ForwardIterator> ris { std::move(first), std::move(last) };
+	
+	if (! r.parseDocument(ris)) {
+		numbers.resize(originalSize);
+		return false;
+	}
+	return true;
+}
+
+template <typename Arith>
+bool parseNumbers(const std::string& json_string, std::vector<Arith>& numbers)
+{
+	return parseNumbers(begin(json_string), end(json_string), numbers);
+}
+
+
+} // ns krystal
+
+#endif
@@ -0,0 +1,253 @@
+// parallel.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_PARALLEL_H
+#define KRYSTAL_PARALLEL_H
+
+#include "reader.hpp"
+#include "document.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace krystal {
+
+
+/*
+ parseParallel builds a document from a large array or object on multiple
+ threads. A structural pre-scan finds the commas that separate the members
+ of the top-level container, the members are split into ranges of about
+ equal size and the threads take the next unparsed range until all are
+ done. Each range is parsed into its own document with its own Lake, the
+ results are then moved into the first one, which adopts the others.
+
+ Small documents and invalid ones are parsed on the calling thread, the
+ latter so errors are reported exactly as parse() does.
+*/
+
+
+class ParallelScan {
+	const char *first_, *last_;
+	const char* open_ = nullptr;   // the top-level [ or {
+	const char* close_ = nullptr;  // and its closing ] or }
+	std::vector<const char*> commas_;
+	
+public:
+	ParallelScan(const char* first, const char* last)
+	: first_{first}, last_{last}
+	{}
+	
+	// find the top-level commas, false if the text has no balanced top-level container
+	bool scan() {
+		auto p = first_;
+		while (p != last_ && std::isspace(static_cast<unsigned char>(*p)))
+			++p;
+		if (p == last_ || (*p != '[' && *p != '{'))
+			return false;
+		open_ = p;
+		
+		int depth = 0;
+		for (; p != last_; ++p) {
+			switch (*p) {
+				case '"':
+					// skip the string, its escapes can hide quotes
+					for (++p; p != last_ && *p != '"'; ++p)
+						if (*p == '\\' && ++p == last_)
+							return false;
+					if (p == last_)
+						return false;
+					break;
+				case '[': case '{':
+					++depth;
+					break;
+				case ']': case '}':
+					if (--depth == 0) {
+						close_ = p;
+						while (++p != last_)
+							if (! std::isspace(static_cast<unsigned char>(*p)))
+								return false;
+						return true;
+					}
+					break;
+				case ',':
+					if (depth == 1)
+						commas_.push_back(p);
+					break;
+				default:
+					break;
+			}
+		}
+		return false;
+	}
+	
+	bool isObject() const { return *open_ == '{'; }
+	size_t members() const { return commas_.size() + 1; }
+	
+	// the text of members [from, to), without the commas around them
+	const char* memberStart(size_t index) const { return index == 0 ? open_ + 1 : commas_[index - 1] + 1; }
+	const char* memberEnd(size_t index) const { return index == commas_.size() ? close_ : commas_[index]; }
+	
+	size_t textSize() const { return static_cast<size_t>(close_ - open_); }
+};
+
+
+template <typename DocumentClass>
+class ParallelParser {
+	const ParallelScan& scan_;
+	std::vector<std::pair<size_t, size_t>> ranges_; // member index ranges
+	std::vector<std::unique_ptr<DocumentClass>> parts_;
+	std::atomic<size_t> nextRange_ { 0 };
+	std::atomic<bool> failed_ { false };
+	ObjectOrder order_;
+	
+	// parse the members of one range as the members of a container of their own
+	bool parseRange(size_t index) {
+		auto first = scan_.memberStart(ranges_[index].first);
+		auto last = scan_.memberEnd(ranges_[index].second - 1);
+		bool isObject = scan_.isObject();
+		
+		DocumentBuilder builder { order_ };
+		ReaderDelegate& delegate = builder;
+		// the range's container is not on the reader's stack, but counts towards the depth
+		BasicReader<DocumentBuilder> reader { builder, BasicReader<DocumentBuilder>::DefaultMaxDepth - 1 };
+		ReaderStream<const char*> is { first, last };
+		
+		isObject ? delegate.objectBegin() : delegate.arrayBegin();
+		reader.skipWhite(is);
+		for (;;) {
+			if (isObject && ! reader.parseKey(is))
+				return false;
+			if (! reader.parseValue(is))
+				return false;
+			reader.skipWhite(is);
+			if (is.atEnd())
+				break;
+			if (is.peek() != ',')
+				return false;
+			is.get();
+			reader.skipWhite(is);
+		}
+		isObject ? delegate.objectEnd() : delegate.arrayEnd();
+		
+		parts_[index].reset(new DocumentClass(builder.document()));
+		return true;
+	}
+	
+	void work() {
+		for (;;) {
+			auto index = nextRange_++;
+			if (index >= ranges_.size() || failed_)
+				return;
+			if (! parseRange(index))
+				failed_ = true;
+		}
+	}
+	
+public:
+	ParallelParser(const ParallelScan& scan, ObjectOrder order)
+	: scan_{scan}, order_{order}
+	{}
+	
+	// split the members into ranges of about equal text size, a few per
+	// thread so that threads that finish early can take on more work
+	void split(size_t rangeCount) {
+		auto members = scan_.members();
+		auto target = scan_.textSize() / std::max<size_t>(1, rangeCount);
+		size_t from = 0;
+		for (size_t ix = 0; ix < members; ++ix) {
+			if (ix + 1 == members || static_cast<size_t>(scan_.memberEnd(ix) - scan_.memberStart(from)) >= target) {
+				ranges_.emplace_back(from, ix + 1);
+				from = ix + 1;
+			}
+		}
+		parts_.resize(ranges_.size());
+	}
+	
+	// returns false if any range was invalid
+	bool run(unsigned threads) {
+		std::vector<std::thread> workers;
+		for (unsigned ix = 1; ix < threads; ++ix)
+			workers.emplace_back([this]{ work(); });
+		work();
+		for (auto& worker : workers)
+			worker.join();
+		return ! failed_;
+	}
+	
+	// move the members of all parts into the first one
+	DocumentClass merge() {
+		size_t total = 0;
+		for (auto& part : parts_)
+			total += part->size();
+		
+		auto result = std::move(*parts_[0]);
+		auto& root = result.root();
+		root.reserve(total);
+		
+		for (size_t ix = 1; ix < parts_.size(); ++ix) {
+			auto& part = *parts_[ix];
+			auto& partRoot = part.root();
+			
+			if (root.isArray()) {
+				for (size_t element = 0; element < partRoot.size(); ++element)
+					root.emplace_back(std::move(partRoot[element]));
+			}
+			else {
+				for (auto key : partRoot.keys()) {
+					auto name = key.str();
+					root.emplace(name, std::move(partRoot[name]));
+				}
+			}
+			result.adopt(std::move(part));
+		}
+		return result;
+	}
+};
+
+
+// Parse a document on up to threads threads, 0 uses all hardware threads.
+// Returns the same document as parse() but its members may be allocated
+// in multiple Lakes, it is a Null document if the JSON text is invalid.
+inline auto parseParallel(const char* first, const char* last, ParseError& error, ObjectOrder order = ObjectOrder::Unordered, unsigned threads = 0)
+{
+	using DocumentClass = decltype(parse(first, last, error, order));
+	static constexpr size_t MinTextSize = 1024 * 1024;
+	static constexpr size_t RangesPerThread = 4;
+	
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	
+	ParallelScan scan { first, last };
+	if (threads > 1 && static_cast<size_t>(last - first) >= MinTextSize && scan.scan() && scan.members() > 1) {
+		ParallelParser<DocumentClass> parser { scan, order };
+		parser.split(threads * RangesPerThread);
+		if (parser.run(threads)) {
+			error = ParseError{};
+			return parser.merge();
+		}
+	}
+	
+	return parse(first, last, error, order);
+}
+
+inline auto parseParallel(const std::string& json_string, ParseError& error, ObjectOrder order = ObjectOrder::Unordered, unsigned threads = 0)
+{
+	return parseParallel(json_string.data(), json_string.data() + json_string.size(), error, order, threads);
+}
+
+inline auto parseParallel(const std::string& json_string, ObjectOrder order = ObjectOrder::Unordered, unsigned threads = 0)
+{
+	ParseError error;
+	return parseParallel(json_string, error, order, threads);
+}
+
+
+} // ns krystal
+
+#endif
@@ -0,0 +1,134 @@
+// profile.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_PROFILE_H
+#define KRYSTAL_PROFILE_H
+
+#include "reader.hpp"
+#include "document.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <ostream>
+#include <string>
+
+namespace krystal {
+
+
+// ParseProfile is an instrumentation policy for BasicReader that counts
+// the tokens of a parse and times its phases. The phases do not add up to
+// the total time, the rest is spent in the reader's structural parsing.
+// Timing every token costs, so profiled parses are noticeably slower.
+struct ParseProfile {
+	using Clock = std::chrono::steady_clock;
+	
+	static constexpr size_t TokenKinds = 10;
+	static constexpr size_t Phases = 4;
+	
+	std::array<uint64_t, TokenKinds> tokens {};
+	uint64_t stringBytes = 0;      // unescaped bytes of all strings and keys
+	uint64_t escapes = 0;
+	uint64_t numberSlowPaths = 0;  // numbers that could not be converted exactly
+	size_t maxDepth = 0;
+	size_t lakeBlocks = 0, lakeBytes = 0; // filled in by parseProfiled
+	std::array<Clock::duration, Phases> phaseTimes {};
+	Clock::duration totalTime {};
+	
+	uint64_t count(TokenKind kind) const { return tokens[static_cast<size_t>(kind)]; }
+	Clock::duration timeOf(ParsePhase phase) const { return phaseTimes[static_cast<size_t>(phase)]; }
+	
+	
+	// instrumentation hooks
+	class Timer {
+		Clock::duration* phaseTime_;
+		Clock::time_point start_;
+		
+	public:
+		explicit Timer(Clock::duration& phaseTime)
+		: phaseTime_ { &phaseTime }, start_ { Clock::now() }
+		{}
+		
+		Timer(Timer&& rhs) : phaseTime_ { rhs.phaseTime_ }, start_ { rhs.start_ } { rhs.phaseTime_ = nullptr; }
+		Timer(const Timer&) = delete;
+		
+		~Timer() {
+			if (phaseTime_)
+				*phaseTime_ += Clock::now() - start_;
+		}
+	};
+	
+	Timer time(ParsePhase phase) { return Timer{ phaseTimes[static_cast<size_t>(phase)] }; }
+	void token(TokenKind kind) { ++tokens[static_cast<size_t>(kind)]; }
+	
+	void string(size_t bytes, size_t stringEscapes) {
+		stringBytes += bytes;
+		escapes += stringEscapes;
+	}
+	
+	void numberSlowPath() { ++numberSlowPaths; }
+	void depth(size_t depth) { maxDepth = std::max(maxDepth, depth); }
+	
+	
+	void print(std::ostream& os) const {
+		static const char* tokenNames[TokenKinds] = {
+			"null", "false", "true", "number", "string", "key",
+			"array begin", "array end", "object begin", "object end"
+		};
+		static const char* phaseNames[Phases] = { "whitespace", "string", "number", "building" };
+		
+		using std::chrono::microseconds;
+		using std::chrono::duration_cast;
+		
+		os << "tokens:";
+		for (size_t kind = 0; kind < TokenKinds; ++kind)
+			os << ' ' << tokenNames[kind] << ' ' << tokens[kind] << (kind + 1 < TokenKinds ? ',' : '\n');
+		os << "strings: " << stringBytes << " bytes, " << escapes << " escapes; number slow paths: " << numberSlowPaths
+		   << "; max depth: " << maxDepth << "; lake: " << lakeBlocks << " blocks, " << lakeBytes << " bytes\n";
+		os << "time: total " << duration_cast<microseconds>(totalTime).count() << "us";
+		for (size_t phase = 0; phase < Phases; ++phase)
+			os << ", " << phaseNames[phase] << ' ' << duration_cast<microseconds>(phaseTimes[phase]).count() << "us";
+		os << '\n';
+	}
+};
+
+inline std::ostream& operator<<(std::ostream& os, const ParseProfile& profile) {
+	profile.print(os);
+	return os;
+}
+
+
+
+// parse a document as parse() does, recording its profile
+template <typename ForwardIterator>
+auto parseProfiled(ForwardIterator first, ForwardIterator last, ParseProfile& profile, ParseError& error, ObjectOrder order = ObjectOrder::Unordered)
+{
+	auto start = ParseProfile::Clock::now();
+	
+	auto delegate = DocumentBuilder(order);
+	BasicReader<DocumentBuilder, ParseProfile> r { delegate };
+	ReaderStream<ForwardIterator> ris { std::move(first), std::move(last) };
+	
+	r.parseDocument(ris);
+	error = r.error();
+	
+	auto blocks = delegate.poolBlocks();
+	auto doc = delegate.document();
+	
+	profile = r.instrumentation();
+	profile.lakeBlocks = blocks;
+	profile.lakeBytes = doc.memoryUsed();
+	profile.totalTime = ParseProfile::Clock::now() - start;
+	return doc;
+}
+
+inline auto parseProfiled(const std::string& json_string, ParseProfile& profile, ObjectOrder order = ObjectOrder::Unordered)
+{
+	ParseError error;
+	return parseProfiled(begin(json_string), end(json_string), profile, error, order);
+}
+
+
+} // ns krystal
+
+#endif
@@ -7,33 +7,148 @@
 #include "value.hpp"
 
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iosfwd>
+#include <string>
 #include <array>
 #include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 namespace krystal {
 
 
+enum class ErrorCode : uint8_t {
+	None,
+	ExpectedContainer,      // document does not start with { or [
+	TrailingData,           // non-whitespace after the end of the document
+	UnexpectedEnd,          // input ended inside a value
+	ExpectedValue,
+	InvalidLiteral,         // not one of true, false or null
+	MissingIntegerDigits,
+	MissingFractionDigits,
+	MissingExponentDigits,
+	ExpectedQuote,
+	InvalidEscape,
+	InvalidHexDigit,
+	ExpectedLowSurrogate,   // \uD800-\uDBFF not followed by a \u escape
+	InvalidLowSurrogate,    // second half of a surrogate pair out of range
+	UnescapedControlChar,
+	ExpectedCommaOrBracket,
+	ExpectedCommaOrBrace,
+	ExpectedColon,
+	NestingTooDeep,         // more nested containers than the reader's max depth
+	Aborted,                // a delegate handler returned false
+	UnsupportedType,        // binary value without a JSON equivalent, e.g. binary data
+	ExpectedStringKey,      // binary object key that is not a string
+	InvalidUTF8             // malformed, overlong or surrogate UTF-8 sequence in a string
+};
+
+
+// ParseError is cheap to produce, the message text is only formatted
+// when someone asks for it.
+struct ParseError {
+	ErrorCode code = ErrorCode::None;
+	ptrdiff_t offset = 0;   // in chars from the start of the input
+	int line = 0, column = 0; // 1-based, column counts chars
+	int found = -1;         // the offending char, -1 for end of input
+	
+	explicit operator bool() const { return code != ErrorCode::None; }
+	
+	std::string message() const {
+		std::string msg;
+		switch (code) {
+			case ErrorCode::None: return "No error.";
+			case ErrorCode::ExpectedContainer: msg = "Document must be an array or object"; break;
+			case ErrorCode::TrailingData: msg = "Unexpected data after end of document"; break;
+			case ErrorCode::UnexpectedEnd: msg = "Unexpected end of input"; break;
+			case ErrorCode::ExpectedValue: msg = "Expected a value"; break;
+			case ErrorCode::InvalidLiteral: msg = "Expected true, false or null"; break;
+			case ErrorCode::MissingIntegerDigits: msg = "The integer part of a number must have at least 1 digit"; break;
+			case ErrorCode::MissingFractionDigits: msg = "The fraction part of a number must have at least 1 digit"; break;
+			case ErrorCode::MissingExponentDigits: msg = "The exponent part of a number must have at least 1 digit"; break;
+			case ErrorCode::ExpectedQuote: msg = "Expected opening quote for string"; break;
+			case ErrorCode::InvalidEscape: msg = "Invalid escape sequence character"; break;
+			case ErrorCode::InvalidHexDigit: msg = "Invalid hexadecimal character in unicode hex literal"; break;
+			case ErrorCode::ExpectedLowSurrogate: msg = "Expected second half of UTF-16 surrogate pair"; break;
+			case ErrorCode::InvalidLowSurrogate: msg = "Second half of UTF-16 surrogate pair is invalid"; break;
+			case ErrorCode::UnescapedControlChar: msg = "Encountered an unescaped control character"; break;
+			case ErrorCode::ExpectedCommaOrBracket: msg = "Expected `,` or `]`"; break;
+			case ErrorCode::ExpectedCommaOrBrace: msg = "Expected `,` or `}`"; break;
+			case ErrorCode::ExpectedColon: msg = "Expected `:`"; break;
+			case ErrorCode::NestingTooDeep: msg = "Containers are nested too deeply"; break;
+			case ErrorCode::Aborted: msg = "Parsing was stopped by the delegate"; break;
+			case ErrorCode::UnsupportedType: msg = "Value type has no JSON equivalent"; break;
+			case ErrorCode::ExpectedStringKey: msg = "Object keys must be strings"; break;
+			case ErrorCode::InvalidUTF8: msg = "Invalid UTF-8 sequence in string"; break;
+		}
+		
+		if (code != ErrorCode::Aborted && code != ErrorCode::UnexpectedEnd) {
+			if (found < 0x20)
+				msg += " but found control character #" + std::to_string(found);
+			else if (found > 0x7E)
+				msg += " but found byte #" + std::to_string(found);
+			else
+				msg += " but found `" + std::string(1, static_cast<char>(found)) + '`';
+		}
+		
+		return msg + " at line " + std::to_string(line) + ", column " + std::to_string(column) + '.';
+	}
+};
+
+
+// The value handlers return false to stop the parse early, the reader then
+// fails with ErrorCode::Aborted. error() is called once for any other error.
+// The chars passed to stringValue() are only valid during the call, they
+// point straight into the input if the input is contiguous and the string
+// had no escapes.
 class ReaderDelegate {
 public:
 	virtual ~ReaderDelegate() = default;
 	
-	virtual void nullValue() = 0;
-	virtual void falseValue() = 0;
-	virtual void trueValue() = 0;
-	virtual void numberValue(double) = 0;
-	virtual void stringValue(const std::string&) = 0;
+	virtual bool nullValue() = 0;
+	virtual bool falseValue() = 0;
+	virtual bool trueValue() = 0;
+	virtual bool numberValue(double) = 0;
+	virtual bool stringValue(StringRef str, bool hasEscapes) = 0;
 	
-	virtual void arrayBegin() = 0;
-	virtual void arrayEnd() = 0;
+	virtual bool arrayBegin() = 0;
+	virtual bool arrayEnd() = 0;
 	
-	virtual void objectBegin() = 0;
-	virtual void objectEnd() = 0;
+	virtual bool objectBegin() = 0;
+	virtual bool objectEnd() = 0;
 	
-	virtual void error(const std::string&, ptrdiff_t offset) = 0;
+	virtual void error(const ParseError&) = 0;
 };
 
 
+// A delegate that accepts every value, for a reader that only checks the
+// syntax or a filter delegate that has nothing to pass the values on to.
+struct NullDelegate final {
+	bool nullValue() { return true; }
+	bool falseValue() { return true; }
+	bool trueValue() { return true; }
+	bool numberValue(double) { return true; }
+	bool stringValue(StringRef, bool) { return true; }
+	bool arrayBegin() { return true; }
+	bool arrayEnd() { return true; }
+	bool objectBegin() { return true; }
+	bool objectEnd() { return true; }
+	void error(const ParseError&) {}
+};
+
+
+
+// Iterators over chars stored in one block of memory, the reader scans
+// strings from these directly instead of char by char.
+template <typename Iterator>
+struct IsContiguousChars : std::integral_constant<bool,
+	std::is_same<Iterator, const char*>::value || std::is_same<Iterator, char*>::value ||
+	std::is_same<Iterator, std::string::const_iterator>::value || std::is_same<Iterator, std::string::iterator>::value ||
+	std::is_same<Iterator, std::vector<char>::const_iterator>::value || std::is_same<Iterator, std::vector<char>::iterator>::value> {};
+
 
 template <typename ForwardIterator>
 class ReaderStream {
@@ -49,7 +164,7 @@ public:
 	: first_{first}, last_{last}, offset_{0}, nextChar_{-1}, eof_{ first_ == last_ }
 	{
 		if (first_ != last_)
-			nextChar_ = *first_;
+			nextChar_ = static_cast<unsigned char>(*first_);
 	}
 
 	int_type peek() const {
@@ -73,7 +188,18 @@ public:
 	
 	difference_type tellg() const { return offset_; }
 	bool good() const { return !eof_; }
+	bool atEnd() const { return first_ == last_; }
 	bool eof() const { return eof_; }
+	
+	// contiguous input only, the unread chars and skipping past some of them
+	const char* data() const { return first_ == last_ ? nullptr : std::addressof(*first_); }
+	size_t available() const { return static_cast<size_t>(last_ - first_); }
+	
+	void skip(size_t count) {
+		first_ += static_cast<difference_type>(count);
+		offset_ += static_cast<difference_type>(count);
+		nextChar_ = first_ != last_ ? static_cast<unsigned char>(*first_) : std::char_traits<char_type>::eof();
+	}
 
 private:
 	ForwardIterator first_, last_;
@@ -84,42 +210,263 @@ private:
 
 
 
-class Reader {
-	ReaderDelegate& delegate_;
-	bool errorOccurred = false;
-	std::string nullToken {"null"}, trueToken{"true"}, falseToken{"false"};
+// the kind of value that a char can start
+enum class ValueStart : uint8_t {
+	Invalid, Object, Array, String, Number, True, False, Null
+};
+
+// Per-char lookup tables for the reader. The UTF-8 ranges follow the table
+// of well-formed byte sequences in the Unicode standard, the allowed range
+// of the second byte excludes overlong forms and surrogates.
+struct CharTables {
+	ValueStart valueStart[256];
+	int8_t hexValue[256];      // -1 for chars that are not hex digits
+	uint8_t utf8Length[256];   // length of the sequence a lead byte starts, 0 if invalid
+	uint8_t utf8Low[256], utf8High[256]; // range of the second byte
+	
+	constexpr CharTables() : valueStart{}, hexValue{}, utf8Length{}, utf8Low{}, utf8High{} {
+		for (int ch = 0; ch < 256; ++ch) {
+			valueStart[ch] = ch == '{' ? ValueStart::Object : ch == '[' ? ValueStart::Array : ch == '"' ? ValueStart::String :
+				(ch >= '0' && ch <= '9') || ch == '-' ? ValueStart::Number :
+				ch == 't' ? ValueStart::True : ch == 'f' ? ValueStart::False : ch == 'n' ? ValueStart::Null : ValueStart::Invalid;
+			hexValue[ch] = ch >= '0' && ch <= '9' ? ch - '0' : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10 : ch >= 'A' && ch <= 'F' ? ch - 'A' + 10 : -1;
+			utf8Length[ch] = ch < 0x80 ? 1 : ch < 0xC2 ? 0 : ch < 0xE0 ? 2 : ch < 0xF0 ? 3 : ch < 0xF5 ? 4 : 0;
+			utf8Low[ch] = ch == 0xE0 ? 0xA0 : ch == 0xF0 ? 0x90 : 0x80;
+			utf8High[ch] = ch == 0xED ? 0x9F : ch == 0xF4 ? 0x8F : 0xBF;
+		}
+	}
+};
+
+inline const CharTables& charTables() {
+	static constexpr CharTables tables {};
+	return tables;
+}
+
+
 
+// Instrumentation policies receive the hooks below from BasicReader.
+// NoInstrumentation does nothing and compiles away entirely, see
+// ParseProfile in profile.hpp for one that counts and times.
+enum class TokenKind : uint8_t {
+	Null, False, True, Number, String, Key,
+	ArrayBegin, ArrayEnd, ObjectBegin, ObjectEnd
+};
+
+enum class ParsePhase : uint8_t {
+	Whitespace,
+	String,   // scanning and unescaping strings and keys
+	Number,   // converting number text to doubles
+	Building  // time spent in the delegate
+};
+
+struct NoInstrumentation {
+	// time() returns a scope object that times a phase until destroyed
+	struct Timer {
+		~Timer() {}
+	};
+	
+	Timer time(ParsePhase) { return {}; }
+	void token(TokenKind) {}
+	void string(size_t /* bytes */, size_t /* escapes */) {}
+	void numberSlowPath() {}
+	void depth(size_t) {}
+};
+
+
+
+// Scratch space for the text of strings that cannot be used in place. The
+// first InlineSize chars are stored in the buffer itself, so short strings
+// with escapes need no allocation even in a reader used for a single parse.
+// Every reader has its own, readers on different threads share nothing.
+class ScratchBuffer {
+	static constexpr size_t InlineSize = 256;
+	
+	char inline_[InlineSize];
+	std::unique_ptr<char[]> heap_;
+	char* data_ = inline_;
+	size_t size_ = 0, capacity_ = InlineSize;
+	
+	void grow(size_t needed) {
+		auto capacity = std::max(needed, capacity_ * 2);
+		std::unique_ptr<char[]> heap { new char[capacity] };
+		std::memcpy(heap.get(), data_, size_);
+		heap_ = std::move(heap);
+		data_ = heap_.get();
+		capacity_ = capacity;
+	}
+	
 public:
-	Reader(ReaderDelegate& delegate) : delegate_{ delegate } {}
+	ScratchBuffer() = default;
+	ScratchBuffer(const ScratchBuffer&) = delete;
+	ScratchBuffer& operator=(const ScratchBuffer&) = delete;
+	
+	ScratchBuffer(ScratchBuffer&& rhs)
+	: heap_ { std::move(rhs.heap_) }
+	, data_ { heap_ ? heap_.get() : inline_ }
+	, size_ { rhs.size_ }
+	, capacity_ { rhs.capacity_ }
+	{
+		if (! heap_)
+			std::memcpy(inline_, rhs.inline_, size_);
+		rhs.data_ = rhs.inline_;
+		rhs.size_ = 0;
+		rhs.capacity_ = InlineSize;
+	}
+	
+	const char* data() const { return data_; }
+	size_t size() const { return size_; }
+	size_t capacity() const { return capacity_; }
+	bool isInline() const { return data_ == inline_; }
+	
+	// keeps the capacity for the next string
+	void clear() { size_ = 0; }
+	
+	void push_back(char ch) {
+		if (size_ == capacity_)
+			grow(size_ + 1);
+		data_[size_++] = ch;
+	}
+	
+	void append(const char* first, const char* last) {
+		auto count = static_cast<size_t>(last - first);
+		if (size_ + count > capacity_)
+			grow(size_ + count);
+		if (count)
+			std::memcpy(data_ + size_, first, count);
+		size_ += count;
+	}
+};
+
+
+
+// BasicReader calls its delegate directly, so a Delegate class that is
+// final or not derived from ReaderDelegate at all has its handlers inlined
+// into the parse loop. Reader is the classic version using virtual calls.
+template <typename Delegate, typename Instrumentation = NoInstrumentation>
+class BasicReader {
+	Delegate& delegate_;
+	Instrumentation instrument_;
+	ParseError error_;
+	int line_ = 1;
+	ptrdiff_t lineStart_ = 0;
+	
+	// containers being parsed, true for objects
+	std::vector<uint8_t> containers_;
+	size_t maxDepth_;
+	// unescaped text of the string being parsed
+	ScratchBuffer ss_;
+	bool validateUTF8_ = true;
+	
+	static constexpr int MaxMantissaDigits = 19;
+
+public:
+	static constexpr size_t DefaultMaxDepth = 512;
+	
+	BasicReader(Delegate& delegate, size_t maxDepth = DefaultMaxDepth)
+	: delegate_{ delegate }
+	, maxDepth_{ maxDepth }
+	{
+		containers_.reserve(std::min(maxDepth, DefaultMaxDepth));
+	}
+	
+	const ParseError& error() const { return error_; }
+	size_t maxDepth() const { return maxDepth_; }
+	Instrumentation& instrumentation() { return instrument_; }
+	
+	// strings are checked for well-formed UTF-8 unless this is turned off
+	bool validatesUTF8() const { return validateUTF8_; }
+	void setValidateUTF8(bool validate) { validateUTF8_ = validate; }
 
 	template <typename ForwardIterator>
 	void skipWhite(ReaderStream<ForwardIterator>& is) {
-		while (is.good() && std::isspace(is.peek()))
-			is.get();
+		auto timer = instrument_.time(ParsePhase::Whitespace);
+		while (is.good() && std::isspace(is.peek())) {
+			if (is.get() == '\n') {
+				++line_;
+				lineStart_ = is.tellg();
+			}
+		}
+	}
+	
+	
+	// All parse functions return false as soon as an error occurred,
+	// the callers pass that straight up without further checks.
+	// Running out of input is reported as such whatever was expected.
+	template <typename ForwardIterator>
+	bool fail(ErrorCode code, ReaderStream<ForwardIterator>& is, int found) {
+		error_.code = (found < 0 && code != ErrorCode::Aborted) ? ErrorCode::UnexpectedEnd : code;
+		error_.offset = is.tellg();
+		error_.line = line_;
+		error_.column = static_cast<int>(is.tellg() - lineStart_) + 1;
+		error_.found = found;
+		delegate_.error(error_);
+		return false;
+	}
+	
+	template <typename ForwardIterator>
+	bool aborted(ReaderStream<ForwardIterator>& is) {
+		return fail(ErrorCode::Aborted, is, is.peek());
+	}
+	
+	// delegate calls are timed as the building phase
+	template <typename Call>
+	bool build(Call call) {
+		auto timer = instrument_.time(ParsePhase::Building);
+		return call();
 	}
 	
 	
+	// Literals are read as a run of up to 6 lowercase letters, so the error
+	// for an invalid one points past all of its letters. Contiguous input
+	// is first compared directly, a 4 or 5 char compare of constant length.
 	template <typename ForwardIterator>
-	void parseLiteral(ReaderStream<ForwardIterator>& is) {
-		auto token_data = std::vector<char>(size_t(6), '\0');
-		auto token = token_data.begin(), token_end = token_data.end();
+	bool matchLiteral(ReaderStream<ForwardIterator>& is, const char* literal, size_t length, std::false_type) {
+		char word[6];
+		size_t count = 0;
 		auto ch = is.peek();
-		
-		while (ch >= 'a' && ch <= 'z' && token != token_end) {
-			*token++ = (char)is.get();
+		while (ch >= 'a' && ch <= 'z' && count < sizeof(word)) {
+			word[count++] = static_cast<char>(is.get());
 			ch = is.peek();
 		}
+		return count == length && std::memcmp(word, literal, length) == 0;
+	}
+	
+	template <typename ForwardIterator>
+	bool matchLiteral(ReaderStream<ForwardIterator>& is, const char* literal, size_t length, std::true_type) {
+		auto data = is.data();
+		auto available = is.available();
+		if (available < length || std::memcmp(data, literal, length) != 0 || (available > length && data[length] >= 'a' && data[length] <= 'z'))
+			return matchLiteral(is, literal, length, std::false_type{});
+		is.skip(length);
+		return true;
+	}
+	
+	template <typename ForwardIterator>
+	bool parseLiteral(ReaderStream<ForwardIterator>& is, ValueStart start) {
+		auto first = is.peek();
+		using Contiguous = IsContiguousChars<ForwardIterator>;
 		
-		auto token_str = std::string{ token_data.begin(), token };
+		bool more;
+		if (start == ValueStart::True) {
+			if (! matchLiteral(is, "true", 4, Contiguous{}))
+				return fail(ErrorCode::InvalidLiteral, is, first);
+			instrument_.token(TokenKind::True);
+			more = build([this]{ return delegate_.trueValue(); });
+		}
+		else if (start == ValueStart::False) {
+			if (! matchLiteral(is, "false", 5, Contiguous{}))
+				return fail(ErrorCode::InvalidLiteral, is, first);
+			instrument_.token(TokenKind::False);
+			more = build([this]{ return delegate_.falseValue(); });
+		}
+		else {
+			if (! matchLiteral(is, "null", 4, Contiguous{}))
+				return fail(ErrorCode::InvalidLiteral, is, first);
+			instrument_.token(TokenKind::Null);
+			more = build([this]{ return delegate_.nullValue(); });
+		}
 		
-		if (token_str == trueToken)
-			delegate_.trueValue();
-		else if (token_str == falseToken)
-			delegate_.falseValue();
-		else if (token_str == nullToken)
-			delegate_.nullValue();
-		else
-			error("Expected value but found `" + token_str + "`.", is);
+		return more || aborted(is);
 	}
 
 
@@ -135,13 +482,27 @@ public:
 	}
 
 	template<typename ForwardIterator>
-	void parseNumber(ReaderStream<ForwardIterator>& is) {
+	bool readNumber(ReaderStream<ForwardIterator>& is, double& val) {
+		auto timer = instrument_.time(ParsePhase::Number);
 		decltype(is.peek()) ch;
 		
+		// Digits are accumulated in an integer mantissa, which is faster than double
+		// arithmetic and holds up to 19 significant digits. Any further digits only
+		// shift the decimal exponent. Only integers up to 2^53 are exact doubles,
+		// larger ones are rounded to the nearest double.
 		auto munch = [&]{ is.get(); ch = is.peek(); };
 		bool minus = false, exp_minus = false;
-		double int_part = 0.0, frac_part = 0.0;
-		int exp_part = 0, frac_digits = 0;
+		uint64_t mantissa = 0;
+		int sig_digits = 0, exp_part = 0, exp_adjust = 0;
+		
+		auto add_digit = [&]{
+			if (sig_digits == MaxMantissaDigits)
+				return false;
+			mantissa = (10 * mantissa) + static_cast<uint64_t>(ch - '0');
+			if (mantissa)
+				++sig_digits;
+			return true;
+		};
 		
 		ch = is.peek();
 		if (ch == '-') {
@@ -153,12 +514,11 @@ public:
 		if (ch == '0')
 			munch();
 		else {
-			if (ch < '0' || ch > '9') {
-				error("The integer part of a number must have at least 1 digit", is);
-				return;
-			}
+			if (ch < '0' || ch > '9')
+				return fail(ErrorCode::MissingIntegerDigits, is, ch);
 			do {
-				int_part = (10.0 * int_part) + static_cast<double>(ch - '0');
+				if (! add_digit())
+					++exp_adjust;
 				munch();
 			} while (ch >= '0' && ch <= '9');
 		}
@@ -166,17 +526,13 @@ public:
 		if (ch == '.') {
 			munch();
 			
-			if (ch < '0' || ch > '9') {
-				error("The fraction part of a number must have at least 1 digit", is);
-				return;
-			}
+			if (ch < '0' || ch > '9')
+				return fail(ErrorCode::MissingFractionDigits, is, ch);
 			do {
-				frac_part = (10.0 * frac_part) + static_cast<double>(ch - '0');
-				++frac_digits;
+				if (add_digit())
+					--exp_adjust;
 				munch();
 			} while (ch >= '0' && ch <= '9');
-
-			frac_part *= pow10(-frac_digits);
 		}
 		
 		if (ch == 'e' || ch == 'E') {
@@ -187,293 +543,425 @@ public:
 			}
 			else if (ch == '+')
 				munch();
-			if (ch < '0' || ch > '9') {
-				error("The exponent part of a number must have at least 1 digit", is);
-				return;
-			}
+			if (ch < '0' || ch > '9')
+				return fail(ErrorCode::MissingExponentDigits, is, ch);
 			do {
-				exp_part = (10 * exp_part) + static_cast<int>(ch - '0');
+				if (exp_part < 100000)
+					exp_part = (10 * exp_part) + static_cast<int>(ch - '0');
 				munch();
 			} while (ch >= '0' && ch <= '9');
 		}
-
-		double val = int_part + frac_part;
-		if (exp_part != 0) {
-			if (exp_minus) exp_part = -exp_part;
-			val *= pow10(exp_part);
-		}
+		
+		auto exponent = (exp_minus ? -exp_part : exp_part) + exp_adjust;
+		// only mantissas and powers of 10 that are exact doubles convert exactly
+		if (mantissa > (uint64_t{1} << 53) || exponent > 22 || exponent < -22)
+			instrument_.numberSlowPath();
+		
+		val = static_cast<double>(mantissa);
+		if (exponent > 0)
+			val *= pow10(exponent);
+		else if (exponent >= -22)
+			val /= pow10(-exponent); // exact power of 10, so the division rounds correctly
+		else if (exponent >= -308)
+			val *= pow10(exponent);
+		else
+			val = (val * pow10(exponent + 300)) * 1e-300;
+		
 		if (minus)
 			val = -val;
+		return true;
+	}
+	
+	template<typename ForwardIterator>
+	bool parseNumber(ReaderStream<ForwardIterator>& is) {
+		double val;
+		if (! readNumber(is, val))
+			return false;
 		
-		delegate_.numberValue(val);
+		instrument_.token(TokenKind::Number);
+		return build([&]{ return delegate_.numberValue(val); }) || aborted(is);
 	}
 
 
-	template <typename ForwardIterator>
-	void parseString(ReaderStream<ForwardIterator>& is) {
-		static std::vector<char> ss;
-		ss.clear();
+	// The first char from pos that ends a run of plain string chars: a quote,
+	// a backslash, a control char, the start of an invalid UTF-8 sequence or
+	// last. ASCII is checked 8 chars at a time, a word without any of these
+	// or non-ASCII chars is skipped whole.
+	const char* scanPlain(const char* pos, const char* last) const {
+		constexpr uint64_t ones = 0x0101010101010101ull, highs = ones * 0x80;
+		auto& tables = charTables();
 		
-		auto parseUTF16CodeUnit = [&]{
-			int digits = 4;
-			uint32_t codeUnit = 0;
-			
-			while (digits-- > 0 && is.good()) {
-				auto ch = is.get();
-				codeUnit <<= 4;
-				
-				if (ch >= '0' && ch <= '9')
-					codeUnit += static_cast<int>(ch - '0');
-				else if (ch >= 'a' && ch <= 'f')
-					codeUnit += 10 + static_cast<int>(ch - 'a');
-				else if (ch >= 'A' && ch <= 'F')
-					codeUnit += 10 + static_cast<int>(ch - 'A');
-				else {
-					error("Invalid hexadecimal character in unicode hex literal: `" + std::string{static_cast<char>(ch)} + '`', is);
-					return 0u;
-				}
+		for (;;) {
+			while (last - pos >= 8) {
+				uint64_t word;
+				std::memcpy(&word, pos, 8);
+				auto quotes = word ^ (ones * '"'), backslashes = word ^ (ones * '\\');
+				auto stops = ((word - ones * 0x20) & ~word) | ((quotes - ones) & ~quotes) | ((backslashes - ones) & ~backslashes) | word;
+				if (stops & highs)
+					break;
+				pos += 8;
 			}
 			
-			return codeUnit;
-		};
-		
-		auto parseUTF16CodePoint = [&]{
-			auto codePoint = parseUTF16CodeUnit();
-			if (errorOccurred)
-				return 0u;
+			unsigned char ch = 0;
+			while (pos != last && (ch = static_cast<unsigned char>(*pos)) >= 0x20 && ch < 0x80 && ch != '"' && ch != '\\')
+				++pos;
+			if (pos == last || ch < 0x80)
+				return pos;
 			
-			if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
-				if (is.get() != '\\' || is.get() != 'u') {
-					error("Expected second half of UTF-16 surrogate pair.", is);
-					return 0u;
-				}
-				
-				auto pairUnit = parseUTF16CodeUnit();
-				if (errorOccurred)
-					return 0u;
-				
-				if (pairUnit < 0xDC00 || pairUnit > 0xDFFF) {
-					error("Second half of UTF-16 surrogate pair is invalid.", is);
-					return 0u;
-				}
-
-				// convert UTF16 surrogate pair to UTF32 codepoint
-				codePoint = (((codePoint - 0xD800) << 10) | (pairUnit - 0xDC00)) + 0x10000;
+			if (! validateUTF8_) {
+				++pos;
+				continue;
 			}
 			
-			return codePoint;
-		};
+			auto length = tables.utf8Length[ch];
+			if (length == 0 || last - pos < length)
+				return pos;
+			auto second = static_cast<unsigned char>(pos[1]);
+			if (second < tables.utf8Low[ch] || second > tables.utf8High[ch])
+				return pos;
+			for (int ix = 2; ix < length; ++ix)
+				if ((static_cast<unsigned char>(pos[ix]) & 0xC0) != 0x80)
+					return pos;
+			pos += length;
+		}
+	}
+	
+	// Contiguous input is scanned in runs of plain chars. A string that ends
+	// after the first run is used in place, for any other the runs are
+	// appended to ss_ and the other chars are read one by one.
+	template <typename ForwardIterator>
+	bool scanPlainString(ReaderStream<ForwardIterator>& is, StringRef& str, std::true_type) {
+		auto first = is.data();
+		if (! first)
+			return false;
 		
-		auto writeCodePointAsUTF8 = [](std::vector<char>& sb, uint32_t codePoint) {
-			if (codePoint <= 0x7F)
-				sb.push_back(codePoint & 0x7F);
-			else if (codePoint <= 0x7FF) {
-				sb.push_back(0xC0 | ((codePoint >> 6) & 0xFF));
-				sb.push_back(0x80 | (codePoint & 0x3F));
-			}
-			else if (codePoint <= 0xFFFF) {
-				sb.push_back(0xE0 | ((codePoint >> 12) & 0xFF));
-				sb.push_back(0x80 | ((codePoint >> 6) & 0x3F));
-				sb.push_back(0x80 | (codePoint & 0x3F));
-			}
-			else {
-				sb.push_back(0xF0 | ((codePoint >> 18) & 0xFF));
-				sb.push_back(0x80 | ((codePoint >> 12) & 0x3F));
-				sb.push_back(0x80 | ((codePoint >> 6) & 0x3F));
-				sb.push_back(0x80 | (codePoint & 0x3F));
-			}
-		};
+		auto pos = scanPlain(first, first + is.available());
+		auto length = static_cast<size_t>(pos - first);
+		if (length < is.available() && *pos == '"') {
+			str = { first, length };
+			is.skip(length + 1);
+			return true;
+		}
 		
-		// opening "
-		if (is.get() != '"') {
-			error("Expected opening quote for string.", is);
+		ss_.append(first, pos);
+		is.skip(length);
+		return false;
+	}
+	
+	template <typename ForwardIterator>
+	void appendPlainRun(ReaderStream<ForwardIterator>& is, std::true_type) {
+		auto first = is.data();
+		if (! first)
 			return;
+		
+		auto pos = scanPlain(first, first + is.available());
+		ss_.append(first, pos);
+		is.skip(static_cast<size_t>(pos - first));
+	}
+	
+	template <typename ForwardIterator>
+	bool scanPlainString(ReaderStream<ForwardIterator>&, StringRef&, std::false_type) {
+		return false;
+	}
+	
+	template <typename ForwardIterator>
+	void appendPlainRun(ReaderStream<ForwardIterator>&, std::false_type) {}
+	
+	template <typename ForwardIterator>
+	bool readHexUnit(ReaderStream<ForwardIterator>& is, uint32_t& unit) {
+		auto& hexValue = charTables().hexValue;
+		unit = 0;
+		for (int digits = 0; digits < 4; ++digits) {
+			auto ch = is.get();
+			int value = ch >= 0 ? hexValue[ch] : -1;
+			if (value < 0)
+				return fail(ErrorCode::InvalidHexDigit, is, ch);
+			unit = (unit << 4) | static_cast<uint32_t>(value);
+		}
+		return true;
+	}
+	
+	// a \u escape, after the u, including the second half of a surrogate pair
+	template <typename ForwardIterator>
+	bool readEscapedCodePoint(ReaderStream<ForwardIterator>& is) {
+		uint32_t codePoint;
+		if (! readHexUnit(is, codePoint))
+			return false;
+		
+		if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+			auto ch = is.get();
+			if (ch != '\\' || (ch = is.get()) != 'u')
+				return fail(ErrorCode::ExpectedLowSurrogate, is, ch);
+			
+			uint32_t pairUnit;
+			if (! readHexUnit(is, pairUnit))
+				return false;
+			if (pairUnit < 0xDC00 || pairUnit > 0xDFFF)
+				return fail(ErrorCode::InvalidLowSurrogate, is, is.peek());
+			
+			codePoint = (((codePoint - 0xD800) << 10) | (pairUnit - 0xDC00)) + 0x10000;
+		}
+		
+		char bytes[4];
+		size_t length;
+		if (codePoint < 0x80) {
+			bytes[0] = static_cast<char>(codePoint);
+			length = 1;
+		}
+		else if (codePoint < 0x800) {
+			bytes[0] = static_cast<char>(0xC0 | (codePoint >> 6));
+			bytes[1] = static_cast<char>(0x80 | (codePoint & 0x3F));
+			length = 2;
+		}
+		else if (codePoint < 0x10000) {
+			bytes[0] = static_cast<char>(0xE0 | (codePoint >> 12));
+			bytes[1] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+			bytes[2] = static_cast<char>(0x80 | (codePoint & 0x3F));
+			length = 3;
+		}
+		else {
+			bytes[0] = static_cast<char>(0xF0 | (codePoint >> 18));
+			bytes[1] = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+			bytes[2] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+			bytes[3] = static_cast<char>(0x80 | (codePoint & 0x3F));
+			length = 4;
 		}
+		ss_.append(bytes, bytes + length);
+		return true;
+	}
+	
+	// a multi-byte UTF-8 sequence, after its lead byte
+	template <typename ForwardIterator>
+	bool readUTF8Sequence(ReaderStream<ForwardIterator>& is, int lead) {
+		auto& tables = charTables();
+		auto length = tables.utf8Length[lead];
+		if (length == 0)
+			return fail(ErrorCode::InvalidUTF8, is, lead);
 		
-		while (is.good()) {
+		char bytes[4] = { static_cast<char>(lead) };
+		for (int ix = 1; ix < length; ++ix) {
 			auto ch = is.get();
+			auto low = ix == 1 ? tables.utf8Low[lead] : 0x80, high = ix == 1 ? tables.utf8High[lead] : 0xBF;
+			if (ch < low || ch > high)
+				return fail(ErrorCode::InvalidUTF8, is, ch);
+			bytes[ix] = static_cast<char>(ch);
+		}
+		ss_.append(bytes, bytes + length);
+		return true;
+	}
+	
+	// reads a string, str then points either into the input or to ss_
+	template <typename ForwardIterator>
+	bool readString(ReaderStream<ForwardIterator>& is, StringRef& str, bool& hasEscapes) {
+		auto timer = instrument_.time(ParsePhase::String);
+		auto& ss = ss_;
+		ss.clear();
+		size_t escapes = 0;
+		
+		// opening "
+		auto ch = is.peek();
+		if (ch != '"')
+			return fail(ErrorCode::ExpectedQuote, is, ch);
+		is.get();
+		
+		using Contiguous = IsContiguousChars<ForwardIterator>;
+		if (scanPlainString(is, str, Contiguous{})) {
+			hasEscapes = false;
+			instrument_.string(str.size(), 0);
+			return true;
+		}
+		
+		for (;;) {
+			ch = is.get();
 			if (ch == '"')
 				break;
 			else if (ch == '\\') {
+				++escapes;
 				ch = is.get();
 				switch (ch) {
-					case '"': case '\\': case '/': ss.push_back(ch); break;
+					case '"': case '\\': case '/': ss.push_back(static_cast<char>(ch)); break;
 					case 'n': ss.push_back('\n'); break;
 					case 'r': ss.push_back('\r'); break;
 					case 't': ss.push_back('\t'); break;
 					case 'b': ss.push_back('\b'); break;
 					case 'f': ss.push_back('\f'); break;
 					case 'u':
-						writeCodePointAsUTF8(ss, parseUTF16CodePoint());
-						if (errorOccurred) return;
+						if (! readEscapedCodePoint(is))
+							return false;
 						break;
-						
+					
 					default:
-						error("Invalid escape sequence character: `" + std::string{static_cast<char>(ch)} + '`', is);
-						return;
-				}
-			}
-			else {
-				if (ch >= 0x20)
-					ss.push_back(ch);
-				else {
-					error("Encountered an unescaped control character #" + std::to_string(ch), is);
-					return;
+						return fail(ErrorCode::InvalidEscape, is, ch);
 				}
 			}
+			else if (ch < 0x20)
+				return fail(ErrorCode::UnescapedControlChar, is, ch);
+			else if (ch < 0x80 || ! validateUTF8_)
+				ss.push_back(static_cast<char>(ch));
+			else if (! readUTF8Sequence(is, ch))
+				return false;
+			
+			appendPlainRun(is, Contiguous{});
 		}
 		
-		if (is.eof()) {
-			error("Unexpected EOF while parsing string.", is);
-			return;
-		}
-		
-		delegate_.stringValue({ begin(ss), end(ss) });
+		str = { ss.data(), ss.size() };
+		hasEscapes = escapes > 0;
+		instrument_.string(ss.size(), escapes);
+		return true;
+	}
+	
+	template <typename ForwardIterator>
+	bool parseString(ReaderStream<ForwardIterator>& is) {
+		StringRef str;
+		bool hasEscapes;
+		if (! readString(is, str, hasEscapes))
+			return false;
+		return build([&]{ return delegate_.stringValue(str, hasEscapes); }) || aborted(is);
 	}
 
 
+	// the kind of value at the current char, by table lookup
 	template <typename ForwardIterator>
-	void parseArray(ReaderStream<ForwardIterator>& is) {
-		is.get(); // opening [
-		skipWhite(is);
-		delegate_.arrayBegin();
-		
+	static ValueStart valueStart(ReaderStream<ForwardIterator>& is) {
 		auto ch = is.peek();
-		while (ch != ']') {
-			parseValue(is);
-			skipWhite(is);
-			if (errorOccurred)
-				return;
-			
-			ch = is.peek();
-			if (ch == ',') {
-				is.get();
-				skipWhite(is);
-			}
-			else if (ch != ']') {
-				error("Expected `,` or `]` but found `" + std::string{static_cast<char>(ch)} + "`.", is);
-				return;
-			}
-		}
-		
-		if (is.eof()) {
-			error("Unexpected EOF while parsing array.", is);
-			return;
+		return ch >= 0 ? charTables().valueStart[ch] : ValueStart::Invalid;
+	}
+	
+	template <typename ForwardIterator>
+	bool parseScalar(ReaderStream<ForwardIterator>& is, ValueStart start) {
+		switch (start) {
+			case ValueStart::String:
+				instrument_.token(TokenKind::String);
+				return parseString(is);
+			case ValueStart::Number:
+				return parseNumber(is);
+			case ValueStart::True: case ValueStart::False: case ValueStart::Null:
+				return parseLiteral(is, start);
+			default:
+				return fail(ErrorCode::ExpectedValue, is, is.peek());
 		}
-		
-		is.get(); // closing ]
-		skipWhite(is);
-		delegate_.arrayEnd();
 	}
-
-
+	
+	
 	template <typename ForwardIterator>
-	void parseObject(ReaderStream<ForwardIterator>& is) {
-		is.get(); // opening {
+	bool parseKey(ReaderStream<ForwardIterator>& is) {
+		instrument_.token(TokenKind::Key);
+		if (! parseString(is))
+			return false;
 		skipWhite(is);
-		delegate_.objectBegin();
 		
 		auto ch = is.peek();
-		while (!errorOccurred && is.good() && ch != '}') {
-			parseString(is); // key
-			skipWhite(is);
-			if (errorOccurred)
-				return;
-			
-			if (is.get() != ':') {
-				error("Expected `:` but found `" + std::string{static_cast<char>(ch)} + "`.", is);
-				return;
-			}
-			skipWhite(is);
-			parseValue(is);  // value
-			skipWhite(is);
-			if (errorOccurred)
-				return;
-			
-			ch = is.peek();
-			if (ch == ',') {
-				is.get();
-				skipWhite(is);
-			}
-			else if (is.eof()) {
-				error("Unexpected EOF while parsing object.", is);
-				return;
-			}
-			else if (ch != '}') {
-				error("Expected `,` or `}` but found `" + std::string{static_cast<char>(ch)} + "`.", is);
-				return;
-			}
-		}
-		
-		
-		is.get(); // closing }
+		if (ch != ':')
+			return fail(ErrorCode::ExpectedColon, is, ch);
+		is.get();
 		skipWhite(is);
-		delegate_.objectEnd();
+		return true;
 	}
 
 
+	// Nested containers are parsed in a loop with an explicit stack instead
+	// of by recursion, so hostile input cannot exhaust the call stack and
+	// nesting deeper than maxDepth is rejected.
 	template <typename ForwardIterator>
-	void parseValue(ReaderStream<ForwardIterator>& is) {
-		if (errorOccurred) return;
-		
-		// The order of tests in this function is based on a quick
-		// check of frequency of types of values in typical JSON documents.
-		// Strings and numbers are by far the most prevalent, followed
-		// closely by objects, then arrays. Bools and Nulls are relatively uncommon.
+	bool parseValue(ReaderStream<ForwardIterator>& is) {
+		auto baseDepth = containers_.size();
 		
-		auto ch = is.peek();
-		if ((ch >= '0' && ch <= '9') || ch == '-')
-			parseNumber(is);
-		else {
-			switch (ch) {
-				case '"':
-					parseString(is); break;
-				case '{':
-					parseObject(is); break;
-				case '[':
-					parseArray(is); break;
-				case 'n': case 't': case 'f':
-					parseLiteral(is); break;
-				default:
-					error("Expected a value but found `" + std::string{static_cast<char>(ch)} + "`.", is);
+		for (;;) {
+			// at the start of a value
+			auto start = valueStart(is);
+			if (start == ValueStart::Object || start == ValueStart::Array) {
+				if (containers_.size() == maxDepth_)
+					return fail(ErrorCode::NestingTooDeep, is, is.peek());
+				
+				bool isObject = start == ValueStart::Object;
+				is.get();
+				skipWhite(is);
+				instrument_.token(isObject ? TokenKind::ObjectBegin : TokenKind::ArrayBegin);
+				if (! build([&]{ return isObject ? delegate_.objectBegin() : delegate_.arrayBegin(); }))
+					return aborted(is);
+				containers_.push_back(isObject);
+				instrument_.depth(containers_.size());
+				
+				if (is.peek() != (isObject ? '}' : ']')) {
+					if (isObject && ! parseKey(is))
+						return false;
+					continue;
+				}
+			}
+			else if (! parseScalar(is, start))
+				return false;
+			
+			// after a value, close the containers that end here
+			// until a comma leads to the next value
+			for (;;) {
+				skipWhite(is);
+				if (containers_.size() == baseDepth)
+					return true;
+				
+				bool isObject = containers_.back();
+				auto ch = is.peek();
+				if (ch == ',') {
+					is.get();
+					skipWhite(is);
+					if (isObject && ! parseKey(is))
+						return false;
 					break;
+				}
+				
+				if (ch != (isObject ? '}' : ']'))
+					return fail(isObject ? ErrorCode::ExpectedCommaOrBrace : ErrorCode::ExpectedCommaOrBracket, is, ch);
+				
+				is.get();
+				containers_.pop_back();
+				instrument_.token(isObject ? TokenKind::ObjectEnd : TokenKind::ArrayEnd);
+				if (! build([&]{ return isObject ? delegate_.objectEnd() : delegate_.arrayEnd(); }))
+					return aborted(is);
 			}
 		}
 	}
 
 
-	template <typename ForwardIterator>
-	void error(const std::string& msg, ReaderStream<ForwardIterator>& is) {
-		errorOccurred = true;
-		delegate_.error(msg, is.tellg());
-	}
-
-
+	// a reader can parse any number of documents, one after the other
 	template <typename ForwardIterator>
 	bool parseDocument(ReaderStream<ForwardIterator>& is) {
+		error_ = ParseError{};
+		line_ = 1;
+		lineStart_ = 0;
 		skipWhite(is);
 		
-		switch (is.peek()) {
-			case '{': parseObject(is); break;
-			case '[': parseArray(is); break;
-				
-			default:
-				error("Document must be an array or object.", is);
-				break;
-		}
+		auto ch = is.peek();
+		if (ch != '{' && ch != '[')
+			return fail(ErrorCode::ExpectedContainer, is, ch);
 		
-		if (! errorOccurred) {
-			skipWhite(is);
-			auto ch = is.get();
-			if (! is.eof())
-				error("Unexpected data found after end of document: `" + std::string{static_cast<char>(ch)} + "`.", is);
-		}
+		containers_.clear();
+		if (! parseValue(is))
+			return false;
 		
-		return ! errorOccurred;
+		if (! is.atEnd())
+			return fail(ErrorCode::TrailingData, is, is.peek());
+		
+		return true;
 	}
 };
 
 
+template <typename Delegate, typename Instrumentation>
+constexpr size_t BasicReader<Delegate, Instrumentation>::DefaultMaxDepth;
+
+
+using Reader = BasicReader<ReaderDelegate>;
+
+
+// readers of binary formats driving the same delegates, see binary.hpp
+enum class BinaryFormat : uint8_t {
+	MessagePack,
+	CBOR
+};
+
+template <typename Delegate, BinaryFormat Format>
+class BasicBinaryReader;
+
+
 } // ns krystal
 
 #endif
@@ -0,0 +1,534 @@
+// schema.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_SCHEMA_H
+#define KRYSTAL_SCHEMA_H
+
+#include "reader.hpp"
+#include "document.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace krystal {
+
+
+/*
+ A Schema is compiled from this subset of JSON Schema:
+
+ - type, a type name or a list of them
+ - enum, with scalar values only
+ - minimum, maximum, exclusiveMinimum and exclusiveMaximum, all numbers
+ - minLength and maxLength, counting code points
+ - minItems, maxItems and items, one schema for all elements
+ - properties, required and additionalProperties
+ - the boolean schemas true and false
+
+ Annotations like title and description are ignored. Any other keyword
+ throws, so a schema is never checked less strictly than it reads.
+
+ A SchemaValidator checks values as the reader produces them and passes
+ them on to another delegate, e.g. a DocumentBuilder, so a document is
+ validated and built in a single pass. The parse stops at the first
+ violation, which violation() then describes.
+*/
+
+class Schema {
+public:
+	enum TypeBits : uint8_t {
+		NullType = 1, BooleanType = 2, IntegerType = 4, NumberType = 8,
+		StringType = 16, ArrayType = 32, ObjectType = 64, AnyType = 127
+	};
+	
+	enum EnumLiteralBits : uint8_t {
+		EnumNull = 1, EnumFalse = 2, EnumTrue = 4
+	};
+	
+	struct Property {
+		std::string name;
+		size_t node;
+		bool required;
+	};
+	
+	// nodes refer to each other by index, node 0 is the schema that allows anything
+	struct Node {
+		uint8_t types = AnyType;
+		double minimum = -std::numeric_limits<double>::infinity();
+		double exclusiveMinimum = -std::numeric_limits<double>::infinity();
+		double maximum = std::numeric_limits<double>::infinity();
+		double exclusiveMaximum = std::numeric_limits<double>::infinity();
+		size_t minLength = 0, maxLength = std::numeric_limits<size_t>::max();
+		size_t minItems = 0, maxItems = std::numeric_limits<size_t>::max();
+		size_t items = 0, additional = 0;
+		std::vector<Property> properties;
+		
+		bool hasEnum = false;
+		uint8_t enumLiterals = 0;
+		std::vector<double> enumNumbers;
+		std::vector<std::string> enumStrings;
+	};
+	
+private:
+	std::vector<Node> nodes_;
+	size_t root_;
+	
+	[[noreturn]] static void invalid(const std::string& why) {
+		throw std::runtime_error("Invalid schema: " + why);
+	}
+	
+	template <typename ValueClass>
+	static double number(const ValueClass& value, const char* keyword) {
+		if (! value.isNumber())
+			invalid(std::string(keyword) + " must be a number");
+		return value.number();
+	}
+	
+	// counts too large for a size_t are clamped, no string or array can reach them
+	template <typename ValueClass>
+	static size_t count(const ValueClass& value, const char* keyword) {
+		if (! value.isNumber() || value.number() < 0 || value.number() != std::floor(value.number()))
+			invalid(std::string(keyword) + " must be a non-negative integer");
+		if (value.number() >= static_cast<double>(std::numeric_limits<size_t>::max()))
+			return std::numeric_limits<size_t>::max();
+		return static_cast<size_t>(value.number());
+	}
+	
+	static uint8_t typeBits(const std::string& name) {
+		if (name == "null") return NullType;
+		if (name == "boolean") return BooleanType;
+		if (name == "integer") return IntegerType;
+		if (name == "number") return NumberType;
+		if (name == "string") return StringType;
+		if (name == "array") return ArrayType;
+		if (name == "object") return ObjectType;
+		invalid("unknown type " + name);
+	}
+	
+	Property& property(size_t index, const std::string& name) {
+		auto& properties = nodes_[index].properties;
+		auto it = std::find_if(properties.begin(), properties.end(), [&](const Property& prop) { return prop.name == name; });
+		if (it != properties.end())
+			return *it;
+		properties.push_back({ name, 0, false });
+		return properties.back();
+	}
+	
+	// nodes_ grows while subschemas are compiled, so nodes are only accessed by index here
+	template <typename ValueClass>
+	size_t compile(const ValueClass& schema) {
+		if (schema.isTrue())
+			return 0;
+		
+		auto index = nodes_.size();
+		nodes_.emplace_back();
+		if (schema.isFalse()) {
+			nodes_[index].types = 0;
+			return index;
+		}
+		if (! schema.isObject())
+			invalid("a schema must be an object or a boolean");
+		
+		for (auto item : schema.items()) {
+			auto key = item.key.str();
+			auto& value = item.value;
+			
+			if (key == "type") {
+				uint8_t types = 0;
+				if (value.isString())
+					types = typeBits(value.string());
+				else if (value.isArray()) {
+					for (auto type : value.items()) {
+						if (! type.value.isString())
+							invalid("type names must be strings");
+						types |= typeBits(type.value.string());
+					}
+				}
+				else
+					invalid("type must be a name or a list of names");
+				nodes_[index].types = types;
+			}
+			else if (key == "enum") {
+				if (! value.isArray())
+					invalid("enum must be an array");
+				auto& node = nodes_[index];
+				node.hasEnum = true;
+				for (auto option : value.items()) {
+					auto& v = option.value;
+					if (v.isNull()) node.enumLiterals |= EnumNull;
+					else if (v.isFalse()) node.enumLiterals |= EnumFalse;
+					else if (v.isTrue()) node.enumLiterals |= EnumTrue;
+					else if (v.isNumber()) node.enumNumbers.push_back(v.number());
+					else if (v.isString()) node.enumStrings.push_back(v.string());
+					else invalid("enum values must be scalars");
+				}
+			}
+			else if (key == "minimum") nodes_[index].minimum = number(value, "minimum");
+			else if (key == "maximum") nodes_[index].maximum = number(value, "maximum");
+			else if (key == "exclusiveMinimum") nodes_[index].exclusiveMinimum = number(value, "exclusiveMinimum");
+			else if (key == "exclusiveMaximum") nodes_[index].exclusiveMaximum = number(value, "exclusiveMaximum");
+			else if (key == "minLength") nodes_[index].minLength = count(value, "minLength");
+			else if (key == "maxLength") nodes_[index].maxLength = count(value, "maxLength");
+			else if (key == "minItems") nodes_[index].minItems = count(value, "minItems");
+			else if (key == "maxItems") nodes_[index].maxItems = count(value, "maxItems");
+			else if (key == "items") {
+				if (value.isArray())
+					invalid("items must be a single schema, tuples are not supported");
+				auto items = compile(value);
+				nodes_[index].items = items;
+			}
+			else if (key == "properties") {
+				if (! value.isObject())
+					invalid("properties must be an object");
+				for (auto member : value.items()) {
+					auto node = compile(member.value);
+					property(index, member.key.str()).node = node;
+				}
+			}
+			else if (key == "required") {
+				if (! value.isArray())
+					invalid("required must be an array");
+				for (auto name : value.items()) {
+					if (! name.value.isString())
+						invalid("required names must be strings");
+					property(index, name.value.string()).required = true;
+				}
+			}
+			else if (key == "additionalProperties") {
+				auto additional = compile(value);
+				nodes_[index].additional = additional;
+			}
+			else if (key != "$schema" && key != "$id" && key != "$comment" && key != "title" && key != "description" && key != "default" && key != "examples")
+				invalid("unsupported keyword " + key);
+		}
+		
+		return index;
+	}
+	
+public:
+	// throws std::runtime_error for malformed schemas and unsupported keywords
+	template <typename ValueClass, typename = std::enable_if_t<! std::is_same<ValueClass, Schema>::value>>
+	explicit Schema(const ValueClass& schema) {
+		nodes_.emplace_back();
+		root_ = compile(schema);
+	}
+	
+	const Node& root() const { return nodes_[root_]; }
+	const Node& node(size_t index) const { return nodes_[index]; }
+	size_t size() const { return nodes_.size(); }
+};
+
+
+// compile a schema from its JSON text, throws std::runtime_error if the text is invalid
+inline Schema parseSchema(const std::string& json_string)
+{
+	ParseError error;
+	auto doc = parseString(json_string, error);
+	if (error)
+		throw std::runtime_error("Invalid schema: " + error.message());
+	return Schema{ doc.root() };
+}
+
+
+
+struct SchemaViolation {
+	std::string path;     // JSON Pointer to the offending value, empty for the root
+	std::string message;
+	
+	explicit operator bool() const { return ! message.empty(); }
+};
+
+
+template <typename Delegate = NullDelegate>
+class SchemaValidator final : public ReaderDelegate {
+	using Node = Schema::Node;
+	
+	struct Frame {
+		const Node* node;
+		bool isObject;
+		size_t count;       // members or elements so far
+		size_t seenStart;   // index of the object's property flags in seen_
+		const Node* member; // schema of the current member
+		std::string key;    // of the current member
+	};
+	
+	const Schema& schema_;
+	Delegate& next_;
+	std::vector<Frame> frames_;
+	std::vector<uint8_t> seen_;
+	SchemaViolation violation_;
+	bool expectKey_ = false;
+	
+	static NullDelegate& nullDelegate() {
+		static NullDelegate none;
+		return none;
+	}
+	
+	static std::string format(double num) {
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.17g", num);
+		return buffer;
+	}
+	
+	// the schema of the value that starts now
+	const Node& valueNode() const {
+		if (frames_.empty())
+			return schema_.root();
+		auto& frame = frames_.back();
+		return frame.isObject ? *frame.member : schema_.node(frame.node->items);
+	}
+	
+	void valueDone() {
+		if (! frames_.empty()) {
+			auto& frame = frames_.back();
+			++frame.count;
+			expectKey_ = frame.isObject;
+		}
+	}
+	
+	// a JSON Pointer to the value at depth, ~ and / in keys are escaped as ~0 and ~1
+	std::string pathTo(size_t depth) const {
+		std::string path;
+		for (size_t ix = 0; ix < depth; ++ix) {
+			auto& frame = frames_[ix];
+			path += '/';
+			if (frame.isObject) {
+				for (auto ch : frame.key) {
+					if (ch == '~') path += "~0";
+					else if (ch == '/') path += "~1";
+					else path += ch;
+				}
+			}
+			else
+				path += std::to_string(frame.count);
+		}
+		return path;
+	}
+	
+	bool violate(std::string message, size_t depth) {
+		violation_ = { pathTo(depth), std::move(message) };
+		return false;
+	}
+	
+	bool violate(std::string message) {
+		return violate(std::move(message), frames_.size());
+	}
+	
+	bool checkType(const Node& node, uint8_t type, const char* name) {
+		if (node.types & type)
+			return true;
+		if (node.types == 0)
+			return violate("value is not allowed");
+		return violate(std::string(name) + " is not an allowed type");
+	}
+	
+	bool checkLiteral(uint8_t type, uint8_t enumBit, const char* name) {
+		auto& node = valueNode();
+		if (! checkType(node, type, name))
+			return false;
+		if (node.hasEnum && ! (node.enumLiterals & enumBit))
+			return violate(std::string(name) + " is not one of the enum values");
+		valueDone();
+		return true;
+	}
+	
+	bool checkNumber(double num) {
+		auto& node = valueNode();
+		bool integral = std::isfinite(num) && num == std::floor(num);
+		if (node.types == 0)
+			return violate("value is not allowed");
+		if (! (node.types & Schema::NumberType) && ! (integral && (node.types & Schema::IntegerType)))
+			return violate((node.types & Schema::IntegerType) ? "a number with a fraction is not an allowed type" : "number is not an allowed type");
+		
+		if (num < node.minimum)
+			return violate(format(num) + " is less than the minimum " + format(node.minimum));
+		if (num <= node.exclusiveMinimum)
+			return violate(format(num) + " is not greater than " + format(node.exclusiveMinimum));
+		if (num > node.maximum)
+			return violate(format(num) + " is greater than the maximum " + format(node.maximum));
+		if (num >= node.exclusiveMaximum)
+			return violate(format(num) + " is not less than " + format(node.exclusiveMaximum));
+		if (node.hasEnum && std::find(node.enumNumbers.begin(), node.enumNumbers.end(), num) == node.enumNumbers.end())
+			return violate(format(num) + " is not one of the enum values");
+		
+		valueDone();
+		return true;
+	}
+	
+	bool checkString(StringRef str) {
+		auto& node = valueNode();
+		if (! checkType(node, Schema::StringType, "string"))
+			return false;
+		
+		if (node.minLength > 0 || node.maxLength < str.size()) {
+			// the lengths are in code points, so continuation bytes do not count
+			auto length = static_cast<size_t>(std::count_if(str.begin(), str.end(), [](char ch) {
+				return (static_cast<unsigned char>(ch) & 0xC0) != 0x80;
+			}));
+			if (length < node.minLength)
+				return violate("string is shorter than " + std::to_string(node.minLength) + " characters");
+			if (length > node.maxLength)
+				return violate("string is longer than " + std::to_string(node.maxLength) + " characters");
+		}
+		
+		if (node.hasEnum && std::find_if(node.enumStrings.begin(), node.enumStrings.end(), [&](const std::string& option) { return StringRef{option} == str; }) == node.enumStrings.end())
+			return violate("string is not one of the enum values");
+		
+		valueDone();
+		return true;
+	}
+	
+	bool checkKey(StringRef key) {
+		auto& frame = frames_.back();
+		frame.key.assign(key.data(), key.size());
+		expectKey_ = false;
+		
+		auto& properties = frame.node->properties;
+		frame.member = &schema_.node(frame.node->additional);
+		for (size_t ix = 0; ix < properties.size(); ++ix) {
+			if (StringRef{properties[ix].name} == key) {
+				seen_[frame.seenStart + ix] = 1;
+				frame.member = &schema_.node(properties[ix].node);
+				break;
+			}
+		}
+		
+		if (frame.member->types == 0)
+			return violate("member is not allowed");
+		return true;
+	}
+	
+	bool beginContainer(bool isObject) {
+		auto& node = valueNode();
+		if (! checkType(node, isObject ? Schema::ObjectType : Schema::ArrayType, isObject ? "object" : "array"))
+			return false;
+		if (node.hasEnum)
+			return violate(std::string(isObject ? "object" : "array") + " is not one of the enum values");
+		
+		frames_.push_back({ &node, isObject, 0, seen_.size(), nullptr, {} });
+		if (isObject)
+			seen_.resize(seen_.size() + node.properties.size(), 0);
+		expectKey_ = isObject;
+		return true;
+	}
+	
+	bool endContainer() {
+		auto& frame = frames_.back();
+		auto& node = *frame.node;
+		auto depth = frames_.size() - 1;
+		
+		if (frame.isObject) {
+			for (size_t ix = 0; ix < node.properties.size(); ++ix)
+				if (node.properties[ix].required && ! seen_[frame.seenStart + ix])
+					return violate("required member " + node.properties[ix].name + " is missing", depth);
+			seen_.resize(frame.seenStart);
+		}
+		else {
+			if (frame.count < node.minItems)
+				return violate("array has fewer than " + std::to_string(node.minItems) + " elements", depth);
+			if (frame.count > node.maxItems)
+				return violate("array has more than " + std::to_string(node.maxItems) + " elements", depth);
+		}
+		
+		frames_.pop_back();
+		valueDone();
+		return true;
+	}
+	
+public:
+	SchemaValidator(const Schema& schema, Delegate& next)
+	: schema_{ schema }
+	, next_{ next }
+	{}
+	
+	// a validator that only validates, for Delegate = NullDelegate
+	explicit SchemaValidator(const Schema& schema)
+	: SchemaValidator(schema, nullDelegate())
+	{}
+	
+	const SchemaViolation& violation() const { return violation_; }
+	
+	// validate the next document, with a new next delegate if it cannot be reused
+	void reset() {
+		frames_.clear();
+		seen_.clear();
+		violation_ = SchemaViolation{};
+		expectKey_ = false;
+	}
+	
+	bool nullValue() override { return checkLiteral(Schema::NullType, Schema::EnumNull, "null") && next_.nullValue(); }
+	bool falseValue() override { return checkLiteral(Schema::BooleanType, Schema::EnumFalse, "false") && next_.falseValue(); }
+	bool trueValue() override { return checkLiteral(Schema::BooleanType, Schema::EnumTrue, "true") && next_.trueValue(); }
+	bool numberValue(double num) override { return checkNumber(num) && next_.numberValue(num); }
+	
+	bool stringValue(StringRef str, bool hasEscapes) override {
+		if (expectKey_)
+			return checkKey(str) && next_.stringValue(str, hasEscapes);
+		return checkString(str) && next_.stringValue(str, hasEscapes);
+	}
+	
+	bool arrayBegin() override { return beginContainer(false) && next_.arrayBegin(); }
+	bool arrayEnd() override { return endContainer() && next_.arrayEnd(); }
+	bool objectBegin() override { return beginContainer(true) && next_.objectBegin(); }
+	bool objectEnd() override { return endContainer() && next_.objectEnd(); }
+	
+	void error(const ParseError& error) override { next_.error(error); }
+};
+
+
+
+// check a JSON text against a schema without building a document
+template <typename ForwardIterator>
+bool validate(ForwardIterator first, ForwardIterator last, const Schema& schema, SchemaViolation& violation, ParseError& error)
+{
+	SchemaValidator<> validator { schema };
+	BasicReader<SchemaValidator<>> r { validator };
+	ReaderStream<ForwardIterator> ris { std::move(first), std::move(last) };
+	
+	r.parseDocument(ris);
+	error = r.error();
+	violation = validator.violation();
+	return ! error;
+}
+
+inline bool validate(const std::string& json_string, const Schema& schema, SchemaViolation& violation)
+{
+	ParseError error;
+	return validate(begin(json_string), end(json_string), schema, violation, error);
+}
+
+
+// parse a document as parse() does if it conforms to the schema, otherwise
+// return a Null document, error is then Aborted and violation says why
+template <typename ForwardIterator>
+auto parseValidated(ForwardIterator first, ForwardIterator last, const Schema& schema, SchemaViolation& violation, ParseError& error, ObjectOrder order = ObjectOrder::Unordered)
+{
+	auto builder = DocumentBuilder(order);
+	SchemaValidator<DocumentBuilder> validator { schema, builder };
+	BasicReader<SchemaValidator<DocumentBuilder>> r { validator };
+	ReaderStream<ForwardIterator> ris { std::move(first), std::move(last) };
+	
+	r.parseDocument(ris);
+	error = r.error();
+	violation = validator.violation();
+	
+	return builder.document();
+}
+
+inline auto parseValidated(const std::string& json_string, const Schema& schema, SchemaViolation& violation, ObjectOrder order = ObjectOrder::Unordered)
+{
+	ParseError error;
+	return parseValidated(begin(json_string), end(json_string), schema, violation, error, order);
+}
+
+
+} // ns krystal
+
+#endif
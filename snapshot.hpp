@@ -0,0 +1,522 @@
+// snapshot.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_SNAPSHOT_H
+#define KRYSTAL_SNAPSHOT_H
+
+#include "value.hpp"
+#include "document.hpp"
+#include "file.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace krystal {
+
+
+/*
+ A snapshot is a document stored in a single block of memory that can be
+ written to disk and later queried in place, without parsing or allocating.
+
+ layout, all offsets are relative to the value they are stored in so a
+ snapshot can be loaded at any address:
+
+ header: "KRYS", uint16 version, uint16 byte order mark, uint64 total size
+ root:   value
+
+ value:  16 bytes, like a Value: kind, pad, uint32 size, 8 byte payload
+ Null, False, True: no payload
+ Number: double
+ String: up to 8 chars inline, otherwise offset to the chars
+ Array:  offset to size values
+ Object: offset to size entries of a key (string value) followed by its value,
+         in iteration order, then size uint32 entry positions sorted by key
+
+ Long keys are stored once per snapshot. Snapshots use the byte order of the
+ machine that wrote them and are only checked for this, not validated.
+*/
+
+
+class SnapshotValue;
+
+struct SnapshotItem {
+	StringRef key; // empty for array elements
+	size_t index;
+	const SnapshotValue& value;
+};
+
+
+class SnapshotValue {
+	ValueKind kind_;
+	uint8_t pad_[3];
+	uint32_t size_; // length of strings, member count of containers
+	union {
+		double num_;
+		char inline_[8];
+		int64_t offset_;
+	};
+	
+	static constexpr size_t MaxInlineString = 8;
+	
+	friend class SnapshotWriter;
+	
+	SnapshotValue() : kind_{ValueKind::Null}, pad_{}, size_{0}, offset_{0} {}
+	
+	template <typename T>
+	const T* at() const { return reinterpret_cast<const T*>(reinterpret_cast<const char*>(this) + offset_); }
+	
+	const char* chars() const { return size_ <= MaxInlineString ? inline_ : at<char>(); }
+	
+	// arrays are a run of values, objects a run of key-value pairs
+	const SnapshotValue* slots() const { return at<SnapshotValue>(); }
+	size_t stride() const { return isObject() ? 2 : 1; }
+	const uint32_t* sortedIndex() const { return reinterpret_cast<const uint32_t*>(slots() + 2 * size_); }
+	
+	static int compareKey(const SnapshotValue& key, const char* str, size_t length) {
+		auto common = std::min<size_t>(key.size_, length);
+		auto order = std::memcmp(key.chars(), str, common);
+		if (order != 0)
+			return order;
+		return key.size_ < length ? -1 : (key.size_ > length ? 1 : 0);
+	}
+	
+	// binary search of the sorted entry positions, returns size() if not found
+	size_t find(const char* key, size_t length) const {
+		auto index = sortedIndex();
+		auto entries = slots();
+		size_t first = 0, last = size_;
+		while (first < last) {
+			auto mid = first + (last - first) / 2;
+			auto order = compareKey(entries[2 * index[mid]], key, length);
+			if (order == 0)
+				return index[mid];
+			if (order < 0)
+				first = mid + 1;
+			else
+				last = mid;
+		}
+		return size_;
+	}
+	
+public:
+	SnapshotValue(const SnapshotValue&) = delete;
+	SnapshotValue& operator=(const SnapshotValue&) = delete;
+	
+	// type tests
+	ValueKind type() const { return kind_; }
+	bool isA(const ValueKind type) const { return kind_ == type; }
+	bool isNull() const { return isA(ValueKind::Null); }
+	bool isFalse() const { return isA(ValueKind::False); }
+	bool isTrue() const { return isA(ValueKind::True); }
+	bool isBool() const { return isFalse() || isTrue(); }
+	bool isNumber() const { return isA(ValueKind::Number); }
+	bool isString() const { return isA(ValueKind::String); }
+	bool isArray() const { return isA(ValueKind::Array); }
+	bool isObject() const { return isA(ValueKind::Object); }
+	bool isContainer() const { return isObject() || isArray(); }
+	
+	bool boolean() const {
+		if (! isBool())
+			throw std::runtime_error("Trying to call boolean() on a non-bool value.");
+		
+		return isTrue();
+	}
+	
+	double number() const {
+		if (! isNumber())
+			throw std::runtime_error("Trying to call number() on a non-number value.");
+		
+		return num_;
+	}
+	
+	template <typename Arith>
+	Arith numberAs() const {
+		auto num = number();
+		return static_cast<Arith>(num);
+	}
+	
+	std::string string() const {
+		if (! isString())
+			throw std::runtime_error("Trying to call string() on a non-string value.");
+		
+		return { chars(), size_ };
+	}
+	
+	StringRef stringRef() const {
+		if (! isString())
+			throw std::runtime_error("Trying to call stringRef() on a non-string value.");
+		
+		return { chars(), size_ };
+	}
+	
+	size_t size() const {
+		return isContainer() ? size_ : 1;
+	}
+	
+	bool contains(const std::string& key) const {
+		if (! isObject())
+			throw std::runtime_error("Trying to check for a key in a non-object value.");
+		
+		return find(key.data(), key.size()) != size_;
+	}
+	
+	const SnapshotValue& operator[](const std::string& key) const {
+		if (! isObject())
+			throw std::runtime_error("Trying to retrieve a sub-value by key from a non-object value.");
+		
+		auto index = find(key.data(), key.size());
+		if (index == size_)
+			throw std::out_of_range("Key not found in object value.");
+		return slots()[2 * index + 1];
+	}
+	
+	const SnapshotValue& operator[](const size_t index) const {
+		if (! isArray())
+			throw std::runtime_error("Trying to retrieve a sub-value by index from a non-array value.");
+		if (index >= size_)
+			throw std::out_of_range("Array index out of range.");
+		
+		return slots()[index];
+	}
+	
+	
+	// iteration, there are no key-value pairs as with Values, only the views
+	template <typename Get>
+	class View {
+		const SnapshotValue* container_;
+	
+	public:
+		class iterator {
+			const SnapshotValue* container_;
+			size_t index_;
+		
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using reference = decltype(Get::get(std::declval<const SnapshotValue&>(), size_t{}));
+			using value_type = typename std::decay<reference>::type;
+			using difference_type = ptrdiff_t;
+			using pointer = void;
+			
+			iterator(const SnapshotValue* container, size_t index) : container_(container), index_(index) {}
+			
+			reference operator *() const { return Get::get(*container_, index_); }
+			iterator& operator ++() {
+				++index_;
+				return *this;
+			}
+			iterator operator ++(int) {
+				iterator ret(*this);
+				++index_;
+				return ret;
+			}
+			
+			bool operator ==(const iterator& rhs) const { return index_ == rhs.index_; }
+			bool operator !=(const iterator& rhs) const { return index_ != rhs.index_; }
+		};
+		
+		View(const SnapshotValue* container) : container_(container) {}
+		
+		iterator begin() const { return { container_, 0 }; }
+		iterator end() const { return { container_, container_->size_ }; }
+	};
+	
+	struct GetItem {
+		static SnapshotItem get(const SnapshotValue& c, size_t ix) { return { GetKey::get(c, ix), ix, GetValue::get(c, ix) }; }
+	};
+	struct GetKey {
+		static StringRef get(const SnapshotValue& c, size_t ix) {
+			if (! c.isObject())
+				return {};
+			auto& key = c.slots()[2 * ix];
+			return { key.chars(), key.size_ };
+		}
+	};
+	struct GetValue {
+		static const SnapshotValue& get(const SnapshotValue& c, size_t ix) { return c.slots()[c.stride() * ix + c.stride() - 1]; }
+	};
+	
+	View<GetItem> items() const {
+		if (! isContainer())
+			throw std::runtime_error("Trying to call items() on a non-container value.");
+		return { this };
+	}
+	
+	View<GetKey> keys() const {
+		if (! isObject())
+			throw std::runtime_error("Trying to call keys() on a non-object value.");
+		return { this };
+	}
+	
+	View<GetValue> values() const {
+		if (! isContainer())
+			throw std::runtime_error("Trying to call values() on a non-container value.");
+		return { this };
+	}
+	
+	
+	void debugPrint(std::ostream& os) const {
+		switch(kind_) {
+			case ValueKind::String:
+				os << '"';
+				os.write(chars(), size_);
+				os << '"';
+				break;
+			case ValueKind::Number:
+				os << num_;
+				break;
+			case ValueKind::Object:
+				os << "Object[" << size() << "]";
+				break;
+			case ValueKind::Array:
+				os << "Array[" << size() << "]";
+				break;
+			case ValueKind::True:
+				os << "true";
+				break;
+			case ValueKind::False:
+				os << "false";
+				break;
+			case ValueKind::Null:
+				os << "null";
+				break;
+		}
+	}
+};
+
+static_assert(sizeof(SnapshotValue) == 16, "snapshot values should be 16 bytes");
+
+inline std::ostream& operator<<(std::ostream& os, const SnapshotValue& t) {
+	t.debugPrint(os);
+	return os;
+}
+
+
+struct SnapshotHeader {
+	char magic[4];
+	uint16_t version;
+	uint16_t byteOrder;
+	uint64_t size;
+	
+	static constexpr uint16_t CurrentVersion = 1;
+	static constexpr uint16_t ByteOrderMark = 0x0102;
+};
+
+
+class SnapshotWriter {
+	std::string data_;
+	std::unordered_map<std::string, size_t> keyChars_; // long key -> offset of its chars
+	
+	// reserve zeroed space for count values (or bytes), 8 byte aligned
+	size_t reserve(size_t bytes) {
+		auto offset = (data_.size() + 7) & ~size_t{7};
+		data_.resize(offset + ((bytes + 7) & ~size_t{7}));
+		return offset;
+	}
+	
+	size_t appendChars(const char* chars, size_t length) {
+		auto offset = reserve(length);
+		std::memcpy(&data_[offset], chars, length);
+		return offset;
+	}
+	
+	void store(size_t offset, const SnapshotValue& value) {
+		std::memcpy(&data_[offset], &value, sizeof(SnapshotValue));
+	}
+	
+	void writeString(size_t offset, StringRef str, bool isKey) {
+		SnapshotValue value;
+		value.kind_ = ValueKind::String;
+		value.size_ = static_cast<uint32_t>(str.size());
+		
+		if (str.size() <= SnapshotValue::MaxInlineString)
+			std::memcpy(value.inline_, str.data(), str.size());
+		else {
+			size_t chars;
+			if (isKey) {
+				auto found = keyChars_.find(str.str());
+				if (found == keyChars_.end())
+					found = keyChars_.emplace(str.str(), appendChars(str.data(), str.size())).first;
+				chars = found->second;
+			}
+			else
+				chars = appendChars(str.data(), str.size());
+			value.offset_ = static_cast<int64_t>(chars) - static_cast<int64_t>(offset);
+		}
+		store(offset, value);
+	}
+	
+	template <typename ValueClass>
+	void write(size_t offset, const ValueClass& source) {
+		if (source.isString())
+			return writeString(offset, source.stringRef(), false);
+		
+		SnapshotValue value;
+		value.kind_ = source.type();
+		if (source.isNumber())
+			value.num_ = source.number();
+		else if (source.isContainer()) {
+			auto count = source.size();
+			value.size_ = static_cast<uint32_t>(count);
+			
+			if (source.isArray()) {
+				auto elements = reserve(count * sizeof(SnapshotValue));
+				for (auto& element : source.values()) {
+					write(elements, element);
+					elements += sizeof(SnapshotValue);
+				}
+				value.offset_ = static_cast<int64_t>(elements - count * sizeof(SnapshotValue)) - static_cast<int64_t>(offset);
+			}
+			else {
+				auto entries = reserve(count * 2 * sizeof(SnapshotValue) + count * sizeof(uint32_t));
+				std::vector<std::pair<StringRef, uint32_t>> sorted;
+				sorted.reserve(count);
+				
+				auto entry = entries;
+				for (auto item : source.items()) {
+					sorted.emplace_back(item.key, static_cast<uint32_t>(item.index));
+					writeString(entry, item.key, true);
+					write(entry + sizeof(SnapshotValue), item.value);
+					entry += 2 * sizeof(SnapshotValue);
+				}
+				
+				std::sort(sorted.begin(), sorted.end(), [](const std::pair<StringRef, uint32_t>& a, const std::pair<StringRef, uint32_t>& b) {
+					auto order = std::memcmp(a.first.data(), b.first.data(), std::min(a.first.size(), b.first.size()));
+					return order != 0 ? order < 0 : a.first.size() < b.first.size();
+				});
+				for (size_t ix = 0; ix < count; ++ix)
+					std::memcpy(&data_[entry + ix * sizeof(uint32_t)], &sorted[ix].second, sizeof(uint32_t));
+				
+				value.offset_ = static_cast<int64_t>(entries) - static_cast<int64_t>(offset);
+			}
+		}
+		store(offset, value);
+	}
+	
+public:
+	template <typename ValueClass>
+	std::string snapshot(const ValueClass& root) {
+		data_.clear();
+		keyChars_.clear();
+		
+		reserve(sizeof(SnapshotHeader));
+		write(reserve(sizeof(SnapshotValue)), root);
+		
+		SnapshotHeader header { { 'K', 'R', 'Y', 'S' }, SnapshotHeader::CurrentVersion, SnapshotHeader::ByteOrderMark, static_cast<uint64_t>(data_.size()) };
+		std::memcpy(&data_[0], &header, sizeof(header));
+		
+		std::string result;
+		result.swap(data_);
+		return result;
+	}
+};
+
+
+// the snapshot of a value or document, write it out as binary data
+template <template<typename T> class Allocator>
+std::string makeSnapshot(const BasicValue<Allocator>& root) {
+	return SnapshotWriter{}.snapshot(root);
+}
+
+template <typename ValueClass>
+std::string makeSnapshot(const Document<ValueClass>& doc) {
+	return SnapshotWriter{}.snapshot(doc.root());
+}
+
+
+// A Snapshot provides the document API over snapshot data owned by someone
+// else, the data must be 8 byte aligned and outlive the Snapshot.
+class Snapshot {
+	const SnapshotValue* root_;
+	
+	static const SnapshotValue* checkedRoot(const void* data, size_t size) {
+		if (reinterpret_cast<uintptr_t>(data) & 7)
+			throw std::runtime_error("Snapshot data is not 8 byte aligned.");
+		
+		SnapshotHeader header;
+		if (size < sizeof(header) + sizeof(SnapshotValue))
+			throw std::runtime_error("Snapshot data is too small.");
+		std::memcpy(&header, data, sizeof(header));
+		
+		if (std::memcmp(header.magic, "KRYS", 4) != 0)
+			throw std::runtime_error("Snapshot data does not start with a snapshot header.");
+		if (header.version != SnapshotHeader::CurrentVersion)
+			throw std::runtime_error("Snapshot data has an unsupported version.");
+		if (header.byteOrder != SnapshotHeader::ByteOrderMark)
+			throw std::runtime_error("Snapshot data was written with a different byte order.");
+		if (header.size > size)
+			throw std::runtime_error("Snapshot data is truncated.");
+		
+		return reinterpret_cast<const SnapshotValue*>(static_cast<const char*>(data) + sizeof(header));
+	}
+	
+public:
+	Snapshot(const void* data, size_t size)
+	: root_ { checkedRoot(data, size) }
+	{}
+	
+	explicit Snapshot(const std::string& data)
+	: Snapshot(data.data(), data.size())
+	{}
+	
+	const SnapshotValue& root() const { return *root_; }
+	
+	// forward const value APIs, like Document
+	ValueKind type() const { return root_->type(); }
+	bool isA(const ValueKind vtype) const { return type() == vtype; }
+	bool isNull() const { return isA(ValueKind::Null); }
+	bool isArray() const { return isA(ValueKind::Array); }
+	bool isObject() const { return isA(ValueKind::Object); }
+	bool isContainer() const { return isObject() || isArray(); }
+	
+	size_t size() const { return root_->size(); }
+	bool contains(const std::string& key) const { return root_->contains(key); }
+	
+	const SnapshotValue& operator[](const std::string& key) const { return (*root_)[key]; }
+	const SnapshotValue& operator[](const size_t index) const { return (*root_)[index]; }
+	
+	SnapshotValue::View<SnapshotValue::GetItem> items() const { return root_->items(); }
+	SnapshotValue::View<SnapshotValue::GetKey> keys() const { return root_->keys(); }
+	SnapshotValue::View<SnapshotValue::GetValue> values() const { return root_->values(); }
+	
+	void debugPrint(std::ostream& os) const { root_->debugPrint(os); }
+};
+
+
+#ifdef KRYSTAL_HAS_MMAP
+
+// A snapshot file mapped into memory, pages are only read from disk
+// as the values on them are accessed.
+class MappedSnapshot {
+	MappedFile file_;
+	Snapshot snapshot_;
+	
+public:
+	explicit MappedSnapshot(const std::string& path)
+	: file_ { path }, snapshot_ { file_.data(), file_.size() }
+	{}
+	
+	MappedSnapshot(const MappedSnapshot&) = delete;
+	MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+	
+	const Snapshot& snapshot() const { return snapshot_; }
+	const SnapshotValue& root() const { return snapshot_.root(); }
+	
+	const SnapshotValue& operator[](const std::string& key) const { return snapshot_[key]; }
+	const SnapshotValue& operator[](const size_t index) const { return snapshot_[index]; }
+	size_t size() const { return snapshot_.size(); }
+};
+
+#endif
+
+
+} // ns krystal
+
+#endif
@@ -0,0 +1,176 @@
+// stream.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_STREAM_H
+#define KRYSTAL_STREAM_H
+
+#include "reader.hpp"
+#include "document.hpp"
+#include "file.hpp"
+
+#include <iterator>
+#include <memory>
+#include <utility>
+
+namespace krystal {
+
+
+/*
+ An ArrayStream reads a top-level JSON array one element at a time, each
+ element becomes a small document of its own. The Lake of an element is
+ reset and reused for the next one, so memory use depends on the size of
+ the largest element and not on that of the array.
+
+ An element document is replaced when the stream advances, clone() or
+ copyOf() it to keep it around. Iteration stops at the end of the array
+ or at the first error, which error() then reports.
+*/
+
+template <typename ForwardIterator>
+class ArrayStream {
+public:
+	using DocumentClass = decltype(std::declval<DocumentBuilder&>().document());
+	
+private:
+	struct State {
+		ReaderStream<ForwardIterator> is;
+		DocumentBuilder builder;
+		BasicReader<DocumentBuilder> reader;
+		DocumentClass element;
+		size_t index = 0;
+		bool started = false, done = false;
+		
+		// the elements are one level deep in the array, which is not on the reader's stack
+		State(ForwardIterator first, ForwardIterator last, ObjectOrder order)
+		: is { std::move(first), std::move(last) }
+		, builder { order }
+		, reader { builder, BasicReader<DocumentBuilder>::DefaultMaxDepth - 1 }
+		, element { nullptr, typename DocumentClass::ValueType{} }
+		{}
+	};
+	
+	std::unique_ptr<State> state_;
+	
+	// at the end of the array or at an error, only whitespace may follow the array
+	bool finish(bool atArrayEnd) {
+		auto& s = *state_;
+		if (atArrayEnd) {
+			s.reader.skipWhite(s.is);
+			if (! s.is.atEnd())
+				s.reader.fail(ErrorCode::TrailingData, s.is, s.is.peek());
+		}
+		s.done = true;
+		return false;
+	}
+	
+public:
+	ArrayStream(ForwardIterator first, ForwardIterator last, ObjectOrder order = ObjectOrder::Unordered)
+	: state_ { new State(std::move(first), std::move(last), order) }
+	{}
+	
+	// advance to the next element, false at the end of the array or on an error
+	bool next() {
+		auto& s = *state_;
+		if (s.done)
+			return false;
+		
+		s.builder.reset(s.element.recyclePool());
+		
+		if (! s.started) {
+			s.started = true;
+			s.reader.skipWhite(s.is);
+			auto ch = s.is.peek();
+			if (ch != '[')
+				return finish(s.reader.fail(ErrorCode::ExpectedContainer, s.is, ch));
+			s.is.get();
+			s.reader.skipWhite(s.is);
+			if (s.is.peek() == ']') {
+				s.is.get();
+				return finish(true);
+			}
+		}
+		else {
+			// whitespace after the previous element was already skipped
+			auto ch = s.is.peek();
+			if (ch == ']') {
+				s.is.get();
+				return finish(true);
+			}
+			if (ch != ',')
+				return finish(s.reader.fail(ErrorCode::ExpectedCommaOrBracket, s.is, ch));
+			s.is.get();
+			s.reader.skipWhite(s.is);
+		}
+		
+		if (! s.reader.parseValue(s.is))
+			return finish(false);
+		s.reader.skipWhite(s.is);
+		
+		s.element = s.builder.document();
+		++s.index;
+		return true;
+	}
+	
+	// the current element, a Null document before the first and after the last
+	DocumentClass& current() { return state_->element; }
+	
+	// the number of elements read so far
+	size_t count() const { return state_->index; }
+	
+	const ParseError& error() const { return state_->reader.error(); }
+	
+	
+	// single pass iteration, begin() reads the first element if none was read yet
+	class iterator {
+		ArrayStream* stream_;
+	
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = DocumentClass;
+		using difference_type = std::ptrdiff_t;
+		using pointer = DocumentClass*;
+		using reference = DocumentClass&;
+		
+		explicit iterator(ArrayStream* stream = nullptr) : stream_{stream} {}
+		
+		reference operator*() const { return stream_->current(); }
+		pointer operator->() const { return &stream_->current(); }
+		
+		iterator& operator++() {
+			if (! stream_->next())
+				stream_ = nullptr;
+			return *this;
+		}
+		
+		bool operator==(const iterator& rhs) const { return stream_ == rhs.stream_; }
+		bool operator!=(const iterator& rhs) const { return stream_ != rhs.stream_; }
+	};
+	
+	iterator begin() {
+		if (! state_->started)
+			next();
+		return iterator{ state_->done ? nullptr : this };
+	}
+	
+	iterator end() { return iterator{}; }
+};
+
+
+template <typename ForwardIterator>
+ArrayStream<ForwardIterator> streamArray(ForwardIterator first, ForwardIterator last, ObjectOrder order = ObjectOrder::Unordered)
+{
+	return { std::move(first), std::move(last), order };
+}
+
+// stream from anything with begin() and end(), like a FileSource, a MappedFile or a string,
+// the source must outlive the stream
+template <typename Source>
+auto streamArray(Source& source, ObjectOrder order = ObjectOrder::Unordered)
+{
+	return streamArray(source.begin(), source.end(), order);
+}
+
+
+} // ns krystal
+
+#endif
@@ -0,0 +1,309 @@
+// tape.hpp - part of krystal
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+#ifndef KRYSTAL_TAPE_H
+#define KRYSTAL_TAPE_H
+
+#include "reader.hpp"
+#include "document.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace krystal {
+
+
+enum class TapeEvent : uint8_t {
+	Null, False, True, Number, String,
+	ArrayBegin, ArrayEnd, ObjectBegin, ObjectEnd
+};
+
+
+/*
+ An EventTape is a delegate that records the values a reader produces, so
+ they can be replayed into any number of other delegates without parsing
+ the text again. Each event takes 16 bytes. Strings point into the input
+ if it was given to referenceInput() and the reader passed them in place,
+ other strings are copied into a side buffer owned by the tape. The input
+ must then outlive the tape.
+
+ Events are addressed by index. A container's begin event stores the index
+ of its end event, so next() steps over a whole value in constant time and
+ member() and element() look up a child without visiting its siblings'
+ contents. Keys are recorded as String events, just as the reader passes
+ them on.
+*/
+
+class EventTape final : public ReaderDelegate {
+public:
+	static constexpr size_t NotFound = std::numeric_limits<size_t>::max();
+	
+private:
+	struct Entry {
+		union {
+			double number;
+			const char* chars;  // a string in the input
+			size_t offset;      // a string in side_
+			size_t end;         // the index of a container's end event
+		};
+		uint32_t size;
+		TapeEvent event;
+		bool hasEscapes, inInput;
+	};
+	
+	std::vector<Entry> entries_;
+	std::vector<char> side_;
+	std::vector<size_t> open_;
+	const char* inputFirst_ = nullptr;
+	const char* inputLast_ = nullptr;
+	ParseError error_;
+	
+	size_t push(TapeEvent event) {
+		entries_.emplace_back();
+		entries_.back().event = event;
+		return entries_.size() - 1;
+	}
+	
+	template <typename ForwardIterator>
+	void referenceInput(ForwardIterator first, ForwardIterator last, std::true_type) {
+		inputFirst_ = first == last ? nullptr : std::addressof(*first);
+		inputLast_ = inputFirst_ + (last - first);
+	}
+	
+	template <typename ForwardIterator>
+	void referenceInput(ForwardIterator, ForwardIterator, std::false_type) {
+		inputFirst_ = inputLast_ = nullptr;
+	}
+	
+	bool close(TapeEvent event) {
+		entries_[open_.back()].end = entries_.size();
+		open_.pop_back();
+		push(event);
+		return true;
+	}
+	
+	// the reader passes keys to the delegate as strings as well
+	template <typename Delegate>
+	static bool replayEntry(Delegate& delegate, const Entry& entry, const char* side) {
+		switch (entry.event) {
+			case TapeEvent::Null: return delegate.nullValue();
+			case TapeEvent::False: return delegate.falseValue();
+			case TapeEvent::True: return delegate.trueValue();
+			case TapeEvent::Number: return delegate.numberValue(entry.number);
+			case TapeEvent::String: return delegate.stringValue({ entry.inInput ? entry.chars : side + entry.offset, entry.size }, entry.hasEscapes);
+			case TapeEvent::ArrayBegin: return delegate.arrayBegin();
+			case TapeEvent::ArrayEnd: return delegate.arrayEnd();
+			case TapeEvent::ObjectBegin: return delegate.objectBegin();
+			case TapeEvent::ObjectEnd: return delegate.objectEnd();
+		}
+		return false;
+	}
+	
+public:
+	EventTape() = default;
+	
+	// strings the reader passes from within [first, last) are referenced instead of copied,
+	// only contiguous chars can be referenced, for other iterators this does nothing
+	template <typename ForwardIterator>
+	void referenceInput(ForwardIterator first, ForwardIterator last) {
+		referenceInput(first, last, IsContiguousChars<ForwardIterator>{});
+	}
+	
+	// forget all events and the input, keeping the memory for the next recording
+	void clear() {
+		entries_.clear();
+		side_.clear();
+		open_.clear();
+		inputFirst_ = inputLast_ = nullptr;
+		error_ = ParseError{};
+	}
+	
+	size_t size() const { return entries_.size(); }
+	bool empty() const { return entries_.empty(); }
+	
+	// a whole document was recorded without errors
+	bool complete() const { return ! entries_.empty() && open_.empty() && ! error_; }
+	const ParseError& error() const { return error_; }
+	
+	size_t memoryUsed() const {
+		return entries_.capacity() * sizeof(Entry) + side_.capacity() + open_.capacity() * sizeof(size_t);
+	}
+	
+	
+	// -- reading events
+	
+	TapeEvent event(size_t index) const { return entries_[index].event; }
+	double number(size_t index) const { return entries_[index].number; }
+	bool hasEscapes(size_t index) const { return entries_[index].hasEscapes; }
+	
+	StringRef string(size_t index) const {
+		auto& entry = entries_[index];
+		return { entry.inInput ? entry.chars : side_.data() + entry.offset, entry.size };
+	}
+	
+	// the index after the value that starts at index
+	size_t next(size_t index) const {
+		auto& entry = entries_[index];
+		if (entry.event == TapeEvent::ArrayBegin || entry.event == TapeEvent::ObjectBegin)
+			return entry.end + 1;
+		return index + 1;
+	}
+	
+	// the index of the value of member key of the object that starts at index, NotFound if absent
+	size_t member(size_t index, StringRef key) const {
+		if (entries_[index].event != TapeEvent::ObjectBegin)
+			return NotFound;
+		auto end = entries_[index].end;
+		for (auto ix = index + 1; ix < end; ix = next(ix + 1)) {
+			if (string(ix) == key)
+				return ix + 1;
+		}
+		return NotFound;
+	}
+	
+	// the index of element n of the array that starts at index, NotFound if absent
+	size_t element(size_t index, size_t n) const {
+		if (entries_[index].event != TapeEvent::ArrayBegin)
+			return NotFound;
+		auto end = entries_[index].end;
+		auto ix = index + 1;
+		for (; ix < end && n > 0; --n)
+			ix = next(ix);
+		return ix < end ? ix : NotFound;
+	}
+	
+	
+	// -- replaying
+	
+	// replay the events in [first, last) into delegate, if a handler returns
+	// false the delegate gets an Aborted error, like a reader would give it
+	template <typename Delegate>
+	bool replay(Delegate& delegate, size_t first, size_t last) const {
+		auto side = side_.data();
+		for (auto ix = first; ix < last; ++ix) {
+			if (! replayEntry(delegate, entries_[ix], side)) {
+				ParseError aborted;
+				aborted.code = ErrorCode::Aborted;
+				delegate.error(aborted);
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	// replay the whole tape, an incomplete tape passes its error on at the end, or
+	// UnexpectedEnd if the recording just stopped
+	template <typename Delegate>
+	bool replay(Delegate& delegate) const {
+		if (! replay(delegate, 0, entries_.size()))
+			return false;
+		if (! complete()) {
+			auto error = error_;
+			if (! error)
+				error.code = ErrorCode::UnexpectedEnd;
+			delegate.error(error);
+			return false;
+		}
+		return true;
+	}
+	
+	// replay the value that starts at index, an index past the tape, like
+	// NotFound, gives the delegate an ExpectedValue error
+	template <typename Delegate>
+	bool replayValue(Delegate& delegate, size_t index) const {
+		if (index >= entries_.size()) {
+			ParseError missing;
+			missing.code = ErrorCode::ExpectedValue;
+			delegate.error(missing);
+			return false;
+		}
+		return replay(delegate, index, next(index));
+	}
+	
+	
+	// -- recording, as a reader's delegate
+	
+	bool nullValue() override { push(TapeEvent::Null); return true; }
+	bool falseValue() override { push(TapeEvent::False); return true; }
+	bool trueValue() override { push(TapeEvent::True); return true; }
+	
+	bool numberValue(double num) override {
+		entries_[push(TapeEvent::Number)].number = num;
+		return true;
+	}
+	
+	bool stringValue(StringRef str, bool hasEscapes) override {
+		if (str.size() > std::numeric_limits<uint32_t>::max())
+			return false;
+		
+		auto& entry = entries_[push(TapeEvent::String)];
+		entry.size = static_cast<uint32_t>(str.size());
+		entry.hasEscapes = hasEscapes;
+		entry.inInput = inputFirst_ && str.data() >= inputFirst_ && str.data() + str.size() <= inputLast_;
+		if (entry.inInput)
+			entry.chars = str.data();
+		else {
+			entry.offset = side_.size();
+			side_.insert(side_.end(), str.begin(), str.end());
+		}
+		return true;
+	}
+	
+	bool arrayBegin() override { open_.push_back(push(TapeEvent::ArrayBegin)); return true; }
+	bool arrayEnd() override { return close(TapeEvent::ArrayEnd); }
+	bool objectBegin() override { open_.push_back(push(TapeEvent::ObjectBegin)); return true; }
+	bool objectEnd() override { return close(TapeEvent::ObjectEnd); }
+	
+	void error(const ParseError& error) override { error_ = error; }
+};
+
+
+
+// record a JSON text onto tape, strings in contiguous input are referenced, not copied
+template <typename ForwardIterator>
+bool record(ForwardIterator first, ForwardIterator last, EventTape& tape, ParseError& error)
+{
+	tape.clear();
+	tape.referenceInput(first, last);
+	
+	BasicReader<EventTape> r { tape };
+	ReaderStream<ForwardIterator> ris { std::move(first), std::move(last) };
+	
+	r.parseDocument(ris);
+	error = r.error();
+	return ! error;
+}
+
+// json_string must outlive the tape
+inline bool record(const std::string& json_string, EventTape& tape)
+{
+	ParseError error;
+	return record(begin(json_string), end(json_string), tape, error);
+}
+
+
+// build a document from a tape, as parse() would from the recorded text
+inline auto parseTape(const EventTape& tape, ObjectOrder order = ObjectOrder::Unordered)
+{
+	auto builder = DocumentBuilder(order);
+	tape.replay(builder);
+	return builder.document();
+}
+
+// build a document of the value that starts at index, a Null document if there is none
+inline auto parseTape(const EventTape& tape, size_t index, ObjectOrder order = ObjectOrder::Unordered)
+{
+	auto builder = DocumentBuilder(order);
+	tape.replayValue(builder, index);
+	return builder.document();
+}
+
+
+} // ns krystal
+
+#endif
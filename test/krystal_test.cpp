@@ -7,6 +7,10 @@
 #include <iostream>
 #include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <sstream>
 #include <unordered_map>
 
 #include "krystal.hpp"
@@ -66,13 +70,33 @@ static std::string readTextFile(const std::string & filePath) {
 
 #include "test_value.hpp"
 #include "test_reader.hpp"
+#include "test_document.hpp"
+#include "test_bind.hpp"
 #include "test_jsonchecker.hpp"
+#include "test_snapshot.hpp"
+#include "test_binary.hpp"
+#include "test_parallel.hpp"
+#include "test_stream.hpp"
+#include "test_profile.hpp"
+#include "test_schema.hpp"
+#include "test_tape.hpp"
+#include "test_diff.hpp"
 #include "test_performance.hpp"
 
 int main() {
 	test_value();
 	test_reader();
+	test_document();
+	test_bind();
 	test_jsonchecker();
+	test_snapshot();
+	test_binary();
+	test_parallel();
+	test_stream();
+	test_profile();
+	test_schema();
+	test_tape();
+	test_diff();
 	test_performance();
 	
 	auto r = makeReport<SimpleTestReport>(std::ref(std::cout));
@@ -0,0 +1,187 @@
+// test_binary.hpp - part of krystal_test
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+// true if two values of any kind of document hold the same data
+template <typename A, typename B>
+bool sameValues(const A& a, const B& b) {
+	if (a.type() != b.type())
+		return false;
+	
+	switch (a.type()) {
+		case ValueKind::Number: return a.number() == b.number();
+		case ValueKind::String: return a.stringRef() == b.stringRef();
+		case ValueKind::Array:
+			if (a.size() != b.size())
+				return false;
+			for (size_t ix = 0; ix < a.size(); ++ix)
+				if (! sameValues(a[ix], b[ix]))
+					return false;
+			return true;
+		case ValueKind::Object:
+			if (a.size() != b.size())
+				return false;
+			for (auto item : a.items())
+				if (! b.contains(item.key.str()) || ! sameValues(item.value, b[item.key.str()]))
+					return false;
+			return true;
+		default:
+			return true;
+	}
+}
+
+static std::string bytes(std::initializer_list<int> list) {
+	std::string data;
+	for (auto b : list)
+		data.push_back(static_cast<char>(b));
+	return data;
+}
+
+
+void test_binary() {
+	group("binary formats", []{
+		group("MessagePack", []{
+			test("values should be written in their smallest encoding", []{
+				auto doc = krystal::parseString(R"([1,-1,-33,200,70000,-300,1.5,true,false,null,"abc",{"k":[]}])");
+				auto data = krystal::writeMessagePack(doc);
+				
+				checkEqual(data, bytes({ 0x9c, 0x01, 0xff, 0xd0, 0xdf, 0xcc, 0xc8, 0xce, 0x00, 0x01, 0x11, 0x70, 0xd1, 0xfe, 0xd4,
+					0xcb, 0x3f, 0xf8, 0, 0, 0, 0, 0, 0, 0xc3, 0xc2, 0xc0, 0xa3, 'a', 'b', 'c', 0x81, 0xa1, 'k', 0x90 }));
+			});
+			
+			test("all numeric types should be read as numbers", []{
+				auto doc = krystal::parseMessagePack(bytes({ 0x98, 0xcd, 0x01, 0x00, 0xcf, 0, 0, 0, 1, 0, 0, 0, 0, 0xd2, 0xff, 0xff, 0xff, 0xfe,
+					0xd3, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xca, 0x3f, 0xc0, 0, 0, 0xe0, 0xd9, 0x01, 'x', 0xdc, 0x00, 0x01, 0x7f }));
+				
+				if (checkTrue(doc.isArray()) && checkEqual(doc.size(), 8)) {
+					checkEqual(doc[0].number(), 256);
+					checkEqual(doc[1].number(), 4294967296.0);
+					checkEqual(doc[2].number(), -2);
+					checkEqual(doc[3].number(), -1);
+					checkEqual(doc[4].number(), 1.5);
+					checkEqual(doc[5].number(), -32);
+					checkEqual(doc[6].string(), "x");
+					checkEqual(doc[7][0].number(), 127);
+				}
+			});
+			
+			test("invalid data should be reported with its offset", []{
+				auto fails = [](const std::string& data, krystal::ErrorCode code, ptrdiff_t offset) {
+					krystal::ParseError error;
+					auto doc = krystal::parseMessagePack(data, error);
+					checkTrue(doc.isNull());
+					checkTrue(error.code == code);
+					checkEqual(error.offset, offset);
+				};
+				
+				fails(bytes({ 0x01 }), krystal::ErrorCode::ExpectedContainer, 0);
+				fails(bytes({ 0x92, 0x01 }), krystal::ErrorCode::UnexpectedEnd, 2);
+				fails(bytes({ 0x91, 0xa3, 'a' }), krystal::ErrorCode::UnexpectedEnd, 3);
+				fails(bytes({ 0x81, 0x01, 0x01 }), krystal::ErrorCode::ExpectedStringKey, 1);
+				fails(bytes({ 0x91, 0xc4, 0x01, 0x00 }), krystal::ErrorCode::UnsupportedType, 1);
+				fails(bytes({ 0x90, 0x90 }), krystal::ErrorCode::TrailingData, 1);
+				
+				// counts beyond the data that is left fail before anything is read
+				fails(bytes({ 0xdd, 0xff, 0xff, 0xff, 0xff, 0x01 }), krystal::ErrorCode::UnexpectedEnd, 6);
+				fails(bytes({ 0xdf, 0x80, 0x00, 0x00, 0x00, 0xa1, 'a', 0x01 }), krystal::ErrorCode::UnexpectedEnd, 8);
+				fails(bytes({ 0x92, 0x01, 0x82, 0xa1, 'a', 0x01 }), krystal::ErrorCode::UnexpectedEnd, 6);
+			});
+		});
+		
+		group("CBOR", []{
+			test("values should be written in their smallest encoding", []{
+				auto doc = krystal::parseString(R"([1,[2,3],{"a":-1,"b":-500},1.5,true,null,"abc",1000000])");
+				auto data = krystal::writeCBOR(doc);
+				
+				checkEqual(data, bytes({ 0x88, 0x01, 0x82, 0x02, 0x03, 0xa2, 0x61, 'a', 0x20, 0x61, 'b', 0x39, 0x01, 0xf3,
+					0xfb, 0x3f, 0xf8, 0, 0, 0, 0, 0, 0, 0xf5, 0xf6, 0x63, 'a', 'b', 'c', 0x1a, 0x00, 0x0f, 0x42, 0x40 }));
+			});
+			
+			test("indefinite lengths, half floats and tags should be read", []{
+				auto doc = krystal::parseCBOR(bytes({ 0xd9, 0xd9, 0xf7, 0x9f, 0x01, 0xbf, 0x61, 'a', 0x9f, 0x02, 0xff, 0xff,
+					0x7f, 0x62, 'a', 'b', 0x61, 'c', 0xff, 0xf9, 0x3c, 0x00, 0xf9, 0x7b, 0xff, 0xc1, 0x1a, 0x51, 0x4b, 0x67, 0xb0, 0xfa, 0x3f, 0xc0, 0, 0, 0xff }));
+				
+				if (checkTrue(doc.isArray()) && checkEqual(doc.size(), 7)) {
+					checkEqual(doc[0].number(), 1);
+					checkEqual(doc[1]["a"][0].number(), 2);
+					checkEqual(doc[2].string(), "abc");
+					checkEqual(doc[3].number(), 1);
+					checkEqual(doc[4].number(), 65504);
+					checkEqual(doc[5].number(), 1363896240);
+					checkEqual(doc[6].number(), 1.5);
+				}
+			});
+			
+			test("invalid data should be reported with its offset", []{
+				auto fails = [](const std::string& data, krystal::ErrorCode code, ptrdiff_t offset) {
+					krystal::ParseError error;
+					auto doc = krystal::parseCBOR(data, error);
+					checkTrue(doc.isNull());
+					checkTrue(error.code == code);
+					checkEqual(error.offset, offset);
+				};
+				
+				fails(bytes({ 0x61, 'a' }), krystal::ErrorCode::ExpectedContainer, 0);
+				fails(bytes({ 0x82, 0x01 }), krystal::ErrorCode::UnexpectedEnd, 2);
+				fails(bytes({ 0xa1, 0x01, 0x01 }), krystal::ErrorCode::ExpectedStringKey, 1);
+				fails(bytes({ 0x81, 0x41, 0x00 }), krystal::ErrorCode::UnsupportedType, 1);
+				fails(bytes({ 0x81, 0xff }), krystal::ErrorCode::UnsupportedType, 1);
+				fails(bytes({ 0xbf, 0x61, 'a', 0xff }), krystal::ErrorCode::UnsupportedType, 3);
+				
+				// a count of 2^64 - 1 is not an indefinite length, nor does a map of 2^63 pairs wrap around to 0
+				fails(bytes({ 0x9b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01, 0xff }), krystal::ErrorCode::UnexpectedEnd, 11);
+				fails(bytes({ 0xbb, 0x80, 0, 0, 0, 0, 0, 0, 0, 0x61, 'a', 0x01 }), krystal::ErrorCode::UnexpectedEnd, 12);
+				fails(bytes({ 0x81, 0xa2, 0x61, 'a', 0x01 }), krystal::ErrorCode::UnexpectedEnd, 5);
+			});
+			
+			test("long chains of tags should be read without recursion", []{
+				std::string tags(5000000, '\xc1');
+				auto doc = krystal::parseCBOR(bytes({ 0x82 }) + tags + bytes({ 0x01 }) + tags + bytes({ 0xa1 }) + tags + bytes({ 0x61, 'a', 0x02 }));
+				if (checkTrue(doc.isArray()) && checkEqual(doc.size(), 2)) {
+					checkEqual(doc[0].number(), 1);
+					checkEqual(doc[1]["a"].number(), 2);
+				}
+				
+				krystal::ParseError error;
+				krystal::parseCBOR(bytes({ 0x81 }) + tags, error);
+				checkTrue(error.code == krystal::ErrorCode::UnexpectedEnd);
+			});
+		});
+		
+		test("negative zero should keep its sign through both formats", []{
+			auto doc = krystal::parseString("[-0.0, 0, -1]");
+			checkTrue(std::signbit(doc[0].number()));
+			
+			auto fromMessagePack = krystal::parseMessagePack(krystal::writeMessagePack(doc));
+			auto fromCBOR = krystal::parseCBOR(krystal::writeCBOR(doc));
+			for (auto copy : { &fromMessagePack, &fromCBOR }) {
+				checkEqual((*copy)[0].number(), 0);
+				checkTrue(std::signbit((*copy)[0].number()));
+				checkFalse(std::signbit((*copy)[1].number()));
+				checkEqual((*copy)[2].number(), -1);
+			}
+			
+			checkEqual(krystal::writeCBOR(doc), bytes({ 0x83, 0xfb, 0x80, 0, 0, 0, 0, 0, 0, 0, 0x00, 0x20 }));
+		});
+		
+		test("documents should survive a round trip through both formats", []{
+			for (auto name : { "teensy", "medium-large", "rapidjson-insane", "large-but-boring" }) {
+				auto doc = krystal::parseString(readTextFile(std::string{"perftests/"} + name + ".json"));
+				
+				auto fromMessagePack = krystal::parseMessagePack(krystal::writeMessagePack(doc));
+				auto fromCBOR = krystal::parseCBOR(krystal::writeCBOR(doc));
+				checkTrue(sameValues(doc.root(), fromMessagePack.root()));
+				checkTrue(sameValues(doc.root(), fromCBOR.root()));
+			}
+		});
+		
+		test("binary readers should drive any delegate", []{
+			std::vector<float> numbers;
+			krystal::NumberArrayBuilder<float> builder { numbers };
+			krystal::BasicBinaryReader<krystal::NumberArrayBuilder<float>, krystal::BinaryFormat::CBOR> reader { builder };
+			
+			auto data = krystal::writeCBOR(krystal::parseString("[1, [2.5, 3], 4]"));
+			checkTrue(reader.parseDocument(data.data(), data.size()));
+			checkTrue(numbers == std::vector<float>({ 1, 2.5f, 3, 4 }));
+		});
+	});
+}
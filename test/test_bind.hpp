@@ -0,0 +1,228 @@
+// test_bind.hpp - part of krystal_test
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+struct BindWave {
+	int count = 0;
+	std::string monster;
+};
+
+struct BindLevel {
+	std::string name;
+	double spawnDelay = 0;
+	bool boss = false;
+	std::vector<int> scores;
+	std::vector<BindWave> waves;
+	BindWave finale;
+};
+
+// wide enough that a small key table would have no perfect hash
+struct BindWide {
+	int f0 = 0, f1 = 0, f2 = 0, f3 = 0, f4 = 0, f5 = 0, f6 = 0, f7 = 0;
+	int f8 = 0, f9 = 0, f10 = 0, f11 = 0, f12 = 0, f13 = 0, f14 = 0, f15 = 0;
+	int f16 = 0, f17 = 0, f18 = 0, f19 = 0, f20 = 0, f21 = 0, f22 = 0, f23 = 0;
+	int f24 = 0, f25 = 0, f26 = 0, f27 = 0, f28 = 0, f29 = 0, f30 = 0, f31 = 0;
+	int f32 = 0, f33 = 0, f34 = 0, f35 = 0, f36 = 0, f37 = 0, f38 = 0, f39 = 0;
+	int f40 = 0, f41 = 0, f42 = 0, f43 = 0, f44 = 0, f45 = 0, f46 = 0, f47 = 0;
+	int f48 = 0, f49 = 0, f50 = 0, f51 = 0, f52 = 0, f53 = 0, f54 = 0, f55 = 0;
+	int f56 = 0, f57 = 0, f58 = 0, f59 = 0, f60 = 0, f61 = 0, f62 = 0;
+};
+
+namespace krystal {
+	template <> struct Fields<BindWave> {
+		static constexpr auto list() {
+			return std::make_tuple(
+				field("count", &BindWave::count),
+				field("monster", &BindWave::monster)
+			);
+		}
+	};
+
+	template <> struct Fields<BindLevel> {
+		static constexpr auto list() {
+			return std::make_tuple(
+				field("level name", &BindLevel::name),
+				field("zombie spawn delay", &BindLevel::spawnDelay),
+				field("boss", &BindLevel::boss),
+				field("scores", &BindLevel::scores),
+				field("waves", &BindLevel::waves),
+				field("finale", &BindLevel::finale)
+			);
+		}
+	};
+
+	template <> struct Fields<BindWide> {
+		static constexpr auto list() {
+			return std::make_tuple(
+				field("f0", &BindWide::f0),
+				field("f1", &BindWide::f1),
+				field("f2", &BindWide::f2),
+				field("f3", &BindWide::f3),
+				field("f4", &BindWide::f4),
+				field("f5", &BindWide::f5),
+				field("f6", &BindWide::f6),
+				field("f7", &BindWide::f7),
+				field("f8", &BindWide::f8),
+				field("f9", &BindWide::f9),
+				field("f10", &BindWide::f10),
+				field("f11", &BindWide::f11),
+				field("f12", &BindWide::f12),
+				field("f13", &BindWide::f13),
+				field("f14", &BindWide::f14),
+				field("f15", &BindWide::f15),
+				field("f16", &BindWide::f16),
+				field("f17", &BindWide::f17),
+				field("f18", &BindWide::f18),
+				field("f19", &BindWide::f19),
+				field("f20", &BindWide::f20),
+				field("f21", &BindWide::f21),
+				field("f22", &BindWide::f22),
+				field("f23", &BindWide::f23),
+				field("f24", &BindWide::f24),
+				field("f25", &BindWide::f25),
+				field("f26", &BindWide::f26),
+				field("f27", &BindWide::f27),
+				field("f28", &BindWide::f28),
+				field("f29", &BindWide::f29),
+				field("f30", &BindWide::f30),
+				field("f31", &BindWide::f31),
+				field("f32", &BindWide::f32),
+				field("f33", &BindWide::f33),
+				field("f34", &BindWide::f34),
+				field("f35", &BindWide::f35),
+				field("f36", &BindWide::f36),
+				field("f37", &BindWide::f37),
+				field("f38", &BindWide::f38),
+				field("f39", &BindWide::f39),
+				field("f40", &BindWide::f40),
+				field("f41", &BindWide::f41),
+				field("f42", &BindWide::f42),
+				field("f43", &BindWide::f43),
+				field("f44", &BindWide::f44),
+				field("f45", &BindWide::f45),
+				field("f46", &BindWide::f46),
+				field("f47", &BindWide::f47),
+				field("f48", &BindWide::f48),
+				field("f49", &BindWide::f49),
+				field("f50", &BindWide::f50),
+				field("f51", &BindWide::f51),
+				field("f52", &BindWide::f52),
+				field("f53", &BindWide::f53),
+				field("f54", &BindWide::f54),
+				field("f55", &BindWide::f55),
+				field("f56", &BindWide::f56),
+				field("f57", &BindWide::f57),
+				field("f58", &BindWide::f58),
+				field("f59", &BindWide::f59),
+				field("f60", &BindWide::f60),
+				field("f61", &BindWide::f61),
+				field("f62", &BindWide::f62)
+			);
+		}
+	};
+}
+
+
+void test_bind() {
+	group("struct binding", []{
+		test("all fields of a bound struct should be read", []{
+			BindLevel level;
+			auto ok = krystal::parseInto(level, R"({
+				"level name": "Graveyard", "zombie spawn delay": 2.5, "boss": true,
+				"scores": [10, 20, 30],
+				"waves": [{"count": 5, "monster": "zombie"}, {"monster": "ghoul", "count": 2}],
+				"finale": {"count": 1, "monster": "lich"}
+			})");
+
+			if (checkTrue(ok)) {
+				checkEqual(level.name, "Graveyard");
+				checkEqual(level.spawnDelay, 2.5);
+				checkTrue(level.boss);
+				checkTrue(level.scores == std::vector<int>({ 10, 20, 30 }));
+				if (checkEqual(level.waves.size(), 2)) {
+					checkEqual(level.waves[0].count, 5);
+					checkEqual(level.waves[1].monster, "ghoul");
+				}
+				checkEqual(level.finale.monster, "lich");
+			}
+		});
+
+		test("unknown keys should be skipped and missing keys left untouched", []{
+			BindLevel level;
+			level.spawnDelay = 7;
+			auto ok = krystal::parseInto(level, R"({"level name": "x", "extra": {"a": [1, {"b": null}]}, "boss": null, "more": "y"})");
+
+			checkTrue(ok);
+			checkEqual(level.name, "x");
+			checkEqual(level.spawnDelay, 7);
+			checkFalse(level.boss);
+		});
+
+		test("a vector of structs can be the document root", []{
+			std::vector<BindWave> waves;
+			checkTrue(krystal::parseInto(waves, R"([{"count": 1}, {"count": 2}, {}])"));
+			checkEqual(waves.size(), 3);
+			checkEqual(waves[1].count, 2);
+		});
+
+		test("all fields of a wide struct should be found", []{
+			BindWide wide;
+			checkTrue(krystal::parseInto(wide, R"({"f0": 1, "f31": 2, "f62": 3, "f63": 4, "f": 5})"));
+			checkEqual(wide.f0, 1);
+			checkEqual(wide.f31, 2);
+			checkEqual(wide.f62, 3);
+			checkEqual(wide.f1, 0);
+		});
+
+		test("nulls in arrays should add no elements", []{
+			BindLevel level;
+			checkTrue(krystal::parseInto(level, R"({"scores": [1, null, 2], "waves": [null, {"count": 3}, null]})"));
+			checkEqual(level.scores.size(), 2);
+			checkEqual(level.scores[1], 2);
+			if (checkEqual(level.waves.size(), 1))
+				checkEqual(level.waves[0].count, 3);
+		});
+
+		test("values of the wrong type should fail the parse", []{
+			BindLevel level;
+			checkFalse(krystal::parseInto(level, R"({"level name": 5})"));
+			checkFalse(krystal::parseInto(level, R"({"scores": {"a": 1}})"));
+			checkFalse(krystal::parseInto(level, R"({"boss": "yes"})"));
+			checkFalse(krystal::parseInto(level, R"([1, 2])"));
+			checkFalse(krystal::parseInto(level, R"({"finale": {"count": 1})"));
+		});
+
+		test("numbers out of the range of a member should fail the parse", []{
+			BindWave wave;
+			checkFalse(krystal::parseInto(wave, R"({"count": 1e20})"));
+			checkFalse(krystal::parseInto(wave, R"({"count": -1e20})"));
+			checkFalse(krystal::parseInto(wave, R"({"count": 2147483648})"));
+			checkFalse(krystal::parseInto(wave, R"({"count": -2147483649})"));
+			checkEqual(wave.count, 0);
+			
+			checkTrue(krystal::parseInto(wave, R"({"count": -2147483648.5})"));
+			checkEqual(wave.count, std::numeric_limits<int>::min());
+			checkTrue(krystal::parseInto(wave, R"({"count": 2147483647.5})"));
+			checkEqual(wave.count, std::numeric_limits<int>::max());
+			
+			std::vector<uint8_t> bytes;
+			checkTrue(krystal::parseInto(bytes, "[0, 255, -0.5]"));
+			checkFalse(krystal::parseInto(bytes, "[256]"));
+			checkFalse(krystal::parseInto(bytes, "[-1]"));
+			
+			std::vector<int64_t> wide;
+			checkFalse(krystal::parseInto(wide, "[9223372036854775808]"));
+			checkTrue(krystal::parseInto(wide, "[-9223372036854775808]"));
+			
+			std::vector<float> floats;
+			checkFalse(krystal::parseInto(floats, "[1e39]"));
+			checkTrue(krystal::parseInto(floats, "[3e38, -1e-50]"));
+		});
+
+		test("keys that only collide in the hash table should not match", []{
+			BindWave wave;
+			checkTrue(krystal::parseInto(wave, R"({"countx": 9, "monste": "no", "": 1})"));
+			checkEqual(wave.count, 0);
+			checkEqual(wave.monster, "");
+		});
+	});
+}
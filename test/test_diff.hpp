@@ -0,0 +1,164 @@
+// test_diff.hpp - part of krystal_test
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+void test_diff() {
+	group("diff and patch", []{
+		// the operations of a JSON Patch as "op path" strings
+		auto describe = [](const krystal::PatchDocument& patch) {
+			std::vector<std::string> ops;
+			for (auto& op : patch.values())
+				ops.push_back(op["op"].string() + ' ' + op["path"].string());
+			return ops;
+		};
+		
+		test("equal documents should give empty patches", [=]{
+			auto json = R"({"a": [1, {"b": null}], "c": "text", "d": -0})";
+			auto from = krystal::parseString(json);
+			auto to = krystal::parseString(json, krystal::ObjectOrder::InsertionOrder);
+			
+			checkEqual(krystal::diffPatch(from, to).size(), 0);
+			checkEqual(krystal::diffMergePatch(from, to).size(), 0);
+			checkTrue(krystal::diffMergePatch(from, to).isObject());
+			checkTrue(krystal::equalValues(from.root(), to.root()));
+		});
+		
+		test("changed, removed and added members should each give an operation", [=]{
+			auto from = krystal::parseString(R"({"keep": {"x": 1}, "change": {"deep": [1, 2, 3]}, "gone": true, "type": "a"})");
+			auto to = krystal::parseString(R"({"keep": {"x": 1}, "change": {"deep": [1, 5, 3]}, "new/~": false, "type": ["a"]})");
+			
+			auto ops = describe(krystal::diffPatch(from, to));
+			std::sort(ops.begin(), ops.end());
+			checkEqual(ops.size(), 4);
+			checkEqual(ops[0], "add /new~1~0");
+			checkEqual(ops[1], "remove /gone");
+			checkEqual(ops[2], "replace /change/deep/1");
+			checkEqual(ops[3], "replace /type");
+			
+			auto merge = krystal::diffMergePatch(from, to);
+			checkEqual(merge.size(), 4);
+			checkTrue(merge["gone"].isNull());
+			checkEqual(merge["change"]["deep"].size(), 3);
+			checkTrue(merge["new/~"].isFalse());
+			checkFalse(merge.contains("keep"));
+		});
+		
+		test("array insertions and removals should not touch the elements around them", [=]{
+			auto from = krystal::parseString(R"([{"id": 0}, {"id": 1}, {"id": 2}, {"id": 3}, {"id": 4}])");
+			auto inserted = krystal::parseString(R"([{"id": 0}, {"id": 1}, "new", {"id": 2}, {"id": 3}, {"id": 4}])");
+			auto removed = krystal::parseString(R"([{"id": 0}, {"id": 3}, {"id": 4}])");
+			
+			auto ops = describe(krystal::diffPatch(from, inserted));
+			checkEqual(ops.size(), 1);
+			checkEqual(ops[0], "add /2");
+			
+			ops = describe(krystal::diffPatch(from, removed));
+			checkEqual(ops.size(), 2);
+			checkEqual(ops[0], "remove /2");
+			checkEqual(ops[1], "remove /1");
+		});
+		
+		test("applying a diff should give the target document", [=]{
+			auto from = krystal::parseString(R"({"list": [1, 2, 3, 4], "obj": {"a": 1, "b": {"c": [true]}}, "s": "x"})");
+			auto to = krystal::parseString(R"({"list": [0, 1, 3, 4, 5], "obj": {"b": {"c": [false, null]}, "d": {}}, "s": 2})");
+			
+			auto patched = from.clone();
+			krystal::applyPatch(patched, krystal::diffPatch(from, to));
+			checkTrue(krystal::equalValues(patched.root(), to.root()));
+			checkEqual(from["list"].size(), 4);
+			
+			auto merged = from.clone();
+			krystal::applyMergePatch(merged, krystal::diffMergePatch(from, to));
+			checkTrue(krystal::equalValues(merged.root(), to.root()));
+		});
+		
+		test("all JSON Patch operations should apply as in RFC 6902", []{
+			auto doc = krystal::parseString(R"({"a": {"b": [1, 2]}, "c/d": 3, "e~f": 4})");
+			krystal::applyPatch(doc, krystal::parseString(R"([
+				{"op": "add", "path": "/a/b/-", "value": 3},
+				{"op": "add", "path": "/a/b/0", "value": 0},
+				{"op": "replace", "path": "/c~1d", "value": "slash"},
+				{"op": "remove", "path": "/e~0f"},
+				{"op": "copy", "from": "/a/b", "path": "/copy"},
+				{"op": "move", "from": "/a/b/1", "path": "/moved"},
+				{"op": "test", "path": "/a/b", "value": [0, 2, 3]},
+				{"op": "test", "path": "/copy", "value": [0, 1, 2, 3]}
+			])"));
+			
+			auto expected = krystal::parseString(R"({"a": {"b": [0, 2, 3]}, "c/d": "slash", "copy": [0, 1, 2, 3], "moved": 1})");
+			checkTrue(krystal::equalValues(doc.root(), expected.root()));
+			
+			auto fails = [&](const std::string& operation) {
+				bool threw = false;
+				try { krystal::applyPatch(doc, krystal::parseString("[" + operation + "]")); } catch (std::runtime_error&) { threw = true; }
+				return threw;
+			};
+			checkTrue(fails(R"({"op": "test", "path": "/moved", "value": 2})"));
+			checkTrue(fails(R"({"op": "remove", "path": "/missing"})"));
+			checkTrue(fails(R"({"op": "replace", "path": "/a/b/3", "value": 1})"));
+			checkTrue(fails(R"({"op": "add", "path": "/a/b/01", "value": 1})"));
+			checkTrue(fails(R"({"op": "move", "from": "/a", "path": "/a/x"})"));
+			checkTrue(fails(R"({"op": "frobnicate", "path": ""})"));
+			checkTrue(fails(R"({"op": "add", "path": "a", "value": 1})"));
+			checkTrue(krystal::equalValues(doc.root(), expected.root()));
+		});
+		
+		test("merge patches should follow RFC 7386", []{
+			auto doc = krystal::parseString(R"({"title": "Goodbye!", "author": {"givenName": "John", "familyName": "Doe"}, "tags": ["example", "sample"], "content": "text"})");
+			krystal::applyMergePatch(doc, krystal::parseString(R"({"title": "Hello!", "phoneNumber": "+01-123-456-7890", "author": {"familyName": null}, "tags": ["example"], "new": {"a": null, "b": 1}})"));
+			
+			auto expected = krystal::parseString(R"({"title": "Hello!", "author": {"givenName": "John"}, "tags": ["example"], "content": "text", "phoneNumber": "+01-123-456-7890", "new": {"b": 1}})");
+			checkTrue(krystal::equalValues(doc.root(), expected.root()));
+			
+			krystal::applyMergePatch(doc, krystal::parseString(R"(["replaced"])"));
+			checkTrue(doc.isArray());
+			checkEqual(doc[0].string(), "replaced");
+		});
+		
+		test("hashes should be kept for a series of clones, so only changed paths are hashed again", [=]{
+			auto from = krystal::parseString(R"({"big": [[1, 2], [3, 4], {"x": [5]}], "small": {"n": 1}})");
+			auto to = from.clone();
+			to.root()["small"]["n"] = to.make(2);
+			
+			krystal::ValueHashes hashes;
+			auto ops = describe(krystal::diffPatch(from, to, hashes));
+			checkEqual(ops.size(), 1);
+			checkEqual(ops[0], "replace /small/n");
+			auto hashed = hashes.size();
+			checkEqual(hashed, 9);
+			
+			auto next = to.clone();
+			next.root()["big"][0] = next.make(7);
+			ops = describe(krystal::diffPatch(to, next, hashes));
+			checkEqual(ops.size(), 1);
+			checkEqual(ops[0], "replace /big/0");
+			checkEqual(hashes.size(), hashed + 2);
+			
+			auto unrelated = krystal::parseString(R"({"small": {"n": 2}, "big": [7, [3, 4], {"x": [5]}]})");
+			checkEqual(krystal::diffPatch(next, unrelated, hashes).size(), 0);
+		});
+		
+		test("hashes of a destroyed document should not be used for one parsed into its memory", [=]{
+			auto json = [](int n) { return R"({"a": {"n": )" + std::to_string(n) + R"(, "list": [1, 2, 3]}, "b": [{"m": 1}]})"; };
+			auto base = krystal::parseString(json(1));
+			krystal::ValueHashes hashes;
+			
+			// each element of a stream is parsed into the memory of the one before it
+			auto series = "[" + json(1) + ", " + json(9) + ", " + json(9) + "]";
+			auto stream = krystal::streamArray(series);
+			std::vector<std::vector<std::string>> patches;
+			for (auto& element : stream)
+				patches.push_back(describe(krystal::diffPatch(base, element, hashes)));
+			
+			checkEqual(patches.size(), 3);
+			checkEqual(patches[0].size(), 0);
+			checkEqual(patches[1].size(), 1);
+			checkEqual(patches[1][0], "replace /a/n");
+			checkEqual(patches[2].size(), 1);
+			
+			auto first = krystal::parseString(json(1));
+			checkEqual(krystal::diffMergePatch(base, first, hashes).size(), 0);
+			first = krystal::parseString(json(9));
+			checkEqual(krystal::diffMergePatch(base, first, hashes).size(), 1);
+		});
+	});
+}
@@ -0,0 +1,325 @@
+// test_document.hpp - part of krystal_test
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+void test_document() {
+	group("document builder", []{
+		group("shaped objects", []{
+			test("array elements with the same keys should all be accessible by key", []{
+				auto doc = krystal::parseString(R"([{"a":1,"b":"x"},{"a":2,"b":"y"},{"a":3,"b":"z"}])");
+				
+				if (checkTrue(doc.isArray()) && checkEqual(doc.size(), 3)) {
+					checkEqual(doc[0]["a"].number(), 1);
+					checkEqual(doc[1]["a"].number(), 2);
+					checkEqual(doc[2]["b"].string(), "z");
+					checkEqual(doc[1].size(), 2);
+					checkTrue(doc[1].contains("b"));
+					checkFalse(doc[1].contains("c"));
+				}
+			});
+			
+			test("iterating a shaped object should yield its keys in document order", []{
+				auto doc = krystal::parseString(R"([{"z":0,"y":1,"x":2},{"z":3,"y":4,"x":5}])");
+				
+				std::vector<std::string> keys;
+				int count = 0;
+				for (auto kv : doc[1]) {
+					keys.push_back(kv.first.string());
+					checkEqual(kv.second.numberAs<int>(), 3 + count++);
+				}
+				checkTrue(keys == std::vector<std::string>({ "z", "y", "x" }));
+			});
+			
+			test("items() of a shaped object should yield its keys in document order", []{
+				auto doc = krystal::parseString(R"([{"z":0,"y":1,"x":2},{"z":3,"y":4,"x":5}])");
+				
+				std::string keys;
+				for (auto item : doc[1].items()) {
+					keys += item.key.str();
+					checkEqual(item.value.numberAs<size_t>(), 3 + item.index);
+				}
+				checkEqual(keys, "zyx");
+			});
+			
+			test("elements with diverging keys should keep their own members", []{
+				auto doc = krystal::parseString(R"([{"a":1,"b":2},{"a":1,"c":3},{"a":1},{"a":1,"b":2,"c":3},{}])");
+				
+				if (checkEqual(doc.size(), 5)) {
+					checkEqual(doc[1]["c"].number(), 3);
+					checkFalse(doc[1].contains("b"));
+					checkEqual(doc[2].size(), 1);
+					checkEqual(doc[3]["c"].number(), 3);
+					checkEqual(doc[3].size(), 3);
+					checkEqual(doc[4].size(), 0);
+				}
+			});
+			
+			test("missing keys in shaped objects should throw", []{
+				auto doc = krystal::parseString(R"([{"a":1}])");
+				bool threw = false;
+				try { doc[0]["b"]; } catch (std::out_of_range&) { threw = true; }
+				checkTrue(threw);
+			});
+			
+			test("duplicate keys in an array element should resolve to the latest value", []{
+				auto doc = krystal::parseString(R"([{"a":1,"a":2,"b":3}])");
+				
+				checkEqual(doc[0].size(), 2);
+				checkEqual(doc[0]["a"].number(), 2);
+				checkEqual(doc[0]["b"].number(), 3);
+			});
+			
+			test("nested containers in shaped objects should be built normally", []{
+				auto doc = krystal::parseString(R"([{"k":[1,2],"o":{"p":true}},{"k":[3],"o":{"p":false}}])");
+				
+				checkEqual(doc[0]["k"].size(), 2);
+				checkEqual(doc[1]["k"][0].number(), 3);
+				checkTrue(doc[0]["o"]["p"].boolean());
+				checkFalse(doc[1]["o"]["p"].boolean());
+			});
+			
+			test("emplacing into a shaped object should keep all members", []{
+				auto doc = krystal::parseString(R"([{"a":1,"b":2}])");
+				auto& obj = const_cast<decltype(doc)::ValueType&>(doc[0]);
+				
+				obj.emplace("b", 20);
+				checkEqual(obj.size(), 2);
+				checkEqual(obj["b"].number(), 20);
+				
+				obj.emplace("c", 30);
+				checkEqual(obj.size(), 3);
+				checkEqual(obj["a"].number(), 1);
+				checkEqual(obj["c"].number(), 30);
+				
+				std::string keys;
+				for (auto key : obj.keys())
+					keys += key.str();
+				checkEqual(keys, "abc");
+			});
+		});
+		
+		group("strings", []{
+			test("empty keys should be keys also when a string value follows", []{
+				auto doc = krystal::parseString(R"({"": "empty", "a": ""})");
+				
+				checkTrue(doc.isObject());
+				checkEqual(doc.size(), 2);
+				checkEqual(doc[""].string(), "empty");
+				checkEqual(doc["a"].string(), "");
+				
+				auto records = krystal::parseString(R"([{"": "x", "b": 1}, {"": "y", "b": 2}])");
+				checkEqual(records[1][""].string(), "y");
+				checkEqual(records[1]["b"].number(), 2);
+			});
+			
+			test("short strings should be stored inline and long ones at their exact size", []{
+				auto number = krystal::parseString("[1]");
+				auto shortString = krystal::parseString(R"(["12345678"])");
+				auto longString = krystal::parseString("[\"" + std::string(64, 'x') + "\"]");
+				auto escaped = krystal::parseString("[\"" + std::string(60, 'x') + "\\n\\t\\\"x\"]");
+				
+				checkEqual(shortString.memoryUsed(), number.memoryUsed());
+				checkEqual(longString.memoryUsed(), number.memoryUsed() + 64);
+				checkEqual(escaped.memoryUsed(), number.memoryUsed() + 64);
+				checkEqual(escaped[0].string(), std::string(60, 'x') + "\n\t\"x");
+			});
+		});
+		
+		test("delegates should be able to forward events to a builder directly", []{
+			struct Doubler final {
+				krystal::DocumentBuilder& builder;
+				
+				bool nullValue() { return builder.nullValue(); }
+				bool falseValue() { return builder.falseValue(); }
+				bool trueValue() { return builder.trueValue(); }
+				bool numberValue(double num) { return builder.numberValue(num * 2); }
+				bool stringValue(krystal::StringRef str, bool hasEscapes) { return builder.stringValue(str, hasEscapes); }
+				bool arrayBegin() { return builder.arrayBegin(); }
+				bool arrayEnd() { return builder.arrayEnd(); }
+				bool objectBegin() { return builder.objectBegin(); }
+				bool objectEnd() { return builder.objectEnd(); }
+				void error(const krystal::ParseError& error) { builder.error(error); }
+			};
+			
+			krystal::DocumentBuilder builder;
+			Doubler doubler { builder };
+			krystal::BasicReader<Doubler> reader { doubler };
+			std::string json = R"({"a": [1, {"b": 2}], "c": "d"})";
+			krystal::ReaderStream<std::string::const_iterator> stream { json.cbegin(), json.cend() };
+			checkTrue(reader.parseDocument(stream));
+			
+			auto doc = builder.document();
+			checkEqual(doc["a"][0].number(), 2);
+			checkEqual(doc["a"][1]["b"].number(), 4);
+			checkEqual(doc["c"].string(), "d");
+		});
+		
+		group("ordered objects", []{
+			test("objects should iterate in document order when requested", []{
+				auto doc = krystal::parseString(R"({"z":1,"y":{"c":0,"b":0,"a":0},"x":[{"q":0,"p":0}],"w":null})", krystal::ObjectOrder::InsertionOrder);
+				
+				std::string keys;
+				for (auto item : doc.items())
+					keys += item.key.str();
+				checkEqual(keys, "zyxw");
+				
+				keys.clear();
+				for (auto key : doc["y"].keys())
+					keys += key.str();
+				checkEqual(keys, "cba");
+				
+				checkEqual(doc["z"].number(), 1);
+				checkTrue(doc.contains("w"));
+				checkFalse(doc.contains("v"));
+			});
+			
+			test("large ordered objects should keep their order and find all keys", []{
+				std::string json = "{";
+				for (int ix = 99; ix >= 0; --ix)
+					json += "\"k" + std::to_string(ix) + "\":" + std::to_string(ix) + (ix ? "," : "}");
+				auto doc = krystal::parseString(json, krystal::ObjectOrder::InsertionOrder);
+				
+				int expected = 99;
+				for (auto item : doc.items())
+					checkEqual(item.value.numberAs<int>(), expected--);
+				for (int ix = 0; ix < 100; ++ix)
+					checkEqual(doc["k" + std::to_string(ix)].numberAs<int>(), ix);
+				checkFalse(doc.contains("k100"));
+			});
+			
+			test("duplicate keys should keep their first position and the latest value", []{
+				auto doc = krystal::parseString(R"({"a":1,"b":2,"a":3})", krystal::ObjectOrder::InsertionOrder);
+				
+				checkEqual(doc.size(), 2);
+				auto it = doc.items().begin();
+				checkEqual((*it).key.str(), "a");
+				checkEqual((*it).value.number(), 3);
+			});
+		});
+		
+		group("editing", []{
+			test("documents should be editable through root()", []{
+				auto doc = krystal::parseString(R"({"name":"zombies","delay":1.5,"waves":[1,2,3],"old":true})");
+				auto& root = doc.root();
+				
+				root["delay"] = doc.make(2.5);
+				root.emplace("title", doc.make("a string too long to be stored inline"));
+				checkTrue(root.erase("old"));
+				checkFalse(root.erase("missing"));
+				
+				auto& waves = root["waves"];
+				waves.insert(0, doc.make(0));
+				waves.erase(3);
+				waves.emplace_back(doc.make(ValueKind::Object)).emplace("boss", doc.make(true));
+				
+				checkEqual(doc["delay"].number(), 2.5);
+				checkEqual(doc["title"].string(), "a string too long to be stored inline");
+				checkFalse(doc.contains("old"));
+				checkEqual(doc["waves"].size(), 4);
+				checkEqual(doc["waves"][0].number(), 0);
+				checkEqual(doc["waves"][2].number(), 2);
+				checkTrue(doc["waves"][3]["boss"].boolean());
+			});
+			
+			test("erasing from shaped objects should keep the other members in order", []{
+				auto doc = krystal::parseString(R"([{"a":1,"b":2,"c":3}])");
+				auto& obj = doc.root()[0];
+				
+				checkTrue(obj.erase("b"));
+				std::string keys;
+				for (auto key : obj.keys())
+					keys += key.str();
+				checkEqual(keys, "ac");
+			});
+			
+			test("clones should share values with their origin until modified", []{
+				auto base = krystal::parseString(R"({"config":{"port":80,"hosts":["a","b"]},"static":{"deep":[1,2,3]}})");
+				auto clone = base.clone();
+				
+				checkEqual(clone["config"]["port"].number(), 80);
+				checkTrue(&clone["static"]["deep"] == &base["static"]["deep"]);
+				
+				clone.root()["config"]["port"] = clone.make(8080);
+				clone.root()["config"]["hosts"].emplace_back(clone.make("c"));
+				
+				checkEqual(clone["config"]["port"].number(), 8080);
+				checkEqual(clone["config"]["hosts"].size(), 3);
+				checkEqual(base["config"]["port"].number(), 80);
+				checkEqual(base["config"]["hosts"].size(), 2);
+				checkTrue(&clone["static"]["deep"] == &base["static"]["deep"]);
+				checkTrue(clone.memoryUsed() < base.memoryUsed());
+			});
+			
+			test("clones of clones should keep all their origins alive", []{
+				auto first = krystal::parseString(R"({"a":{"text":"a string too long to be stored inline"},"b":[{"x":1},{"x":2}]})");
+				auto second = first.clone();
+				second.root()["b"][1].emplace("y", second.make(3));
+				
+				auto third = second.clone();
+				first = krystal::parseString("[]");
+				second = krystal::parseString("[]");
+				
+				checkEqual(third["a"]["text"].string(), "a string too long to be stored inline");
+				checkEqual(third["b"][1]["y"].number(), 3);
+				third.root()["b"][0]["x"] = third.make(10);
+				checkEqual(third["b"][0]["x"].number(), 10);
+			});
+			
+			test("documents with clones should not be modifiable", []{
+				auto base = krystal::parseString(R"({"a":1})");
+				auto clone = base.clone();
+				bool threw = false;
+				try { base.root(); } catch (std::runtime_error&) { threw = true; }
+				checkTrue(threw);
+			});
+		});
+		
+		group("copies", []{
+			test("subtrees should survive their document when copied to the heap", []{
+				krystal::Value levels;
+				{
+					auto doc = krystal::parseString(R"({"levels":[{"name":"a long level name","waves":[1,2]},{"name":"b","waves":[3]}],"junk":[1,2,3]})");
+					levels = krystal::Value::copyOf(doc["levels"]);
+				}
+				
+				checkEqual(levels.size(), 2);
+				checkEqual(levels[0]["name"].string(), "a long level name");
+				checkEqual(levels[1]["waves"][0].number(), 3);
+				
+				std::string keys;
+				for (auto key : levels[0].keys())
+					keys += key.str();
+				checkEqual(keys, "namewaves");
+			});
+			
+			test("make() should deep copy values from other documents", []{
+				auto target = krystal::parseString(R"({"items":[]})");
+				{
+					auto source = krystal::parseString(R"({"item":{"id":"an identifier of some length","tags":["x","y"]}})");
+					target.root()["items"].emplace_back(target.make(source["item"]));
+					target.root()["items"].emplace_back(target.make(krystal::Value{ "heap" }));
+				}
+				
+				checkEqual(target["items"].size(), 2);
+				checkEqual(target["items"][0]["id"].string(), "an identifier of some length");
+				checkEqual(target["items"][0]["tags"][1].string(), "y");
+				checkEqual(target["items"][1].string(), "heap");
+			});
+			
+			test("copyOf should make a document of a subtree, also of clones", []{
+				auto base = krystal::parseString(R"({"big":[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16],"small":{"a":[true,null]}})");
+				auto clone = base.clone();
+				clone.root()["small"].emplace("b", clone.make("a string too long to be stored inline"));
+				
+				auto small = decltype(clone)::copyOf(clone["small"]);
+				clone = base.clone();
+				
+				checkTrue(small.isObject());
+				checkEqual(small.size(), 2);
+				checkTrue(small["a"][0].boolean());
+				checkTrue(small["a"][1].isNull());
+				checkEqual(small["b"].string(), "a string too long to be stored inline");
+				checkTrue(small.memoryUsed() < base.memoryUsed());
+			});
+		});
+	});
+}
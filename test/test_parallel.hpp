@@ -0,0 +1,105 @@
+// test_parallel.hpp - part of krystal_test
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+// a JSON array of count records, over 1MB for a few thousand records
+static std::string recordsJSON(int count) {
+	std::string json { "[\n" };
+	for (int ix = 0; ix < count; ++ix) {
+		if (ix)
+			json += ",\n";
+		json += R"({"id":)" + std::to_string(ix) + R"(,"name":"record \"number\" )" + std::to_string(ix) + R"(","tags":["a","b,c",{"deep":[1,2,[3]]}],)"
+			+ R"("text":"lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua","flag":true})";
+	}
+	return json + "\n]";
+}
+
+
+void test_parallel() {
+	group("parallel parsing", []{
+		test("large arrays should parse to the same document as parse()", []{
+			auto json = recordsJSON(8000);
+			auto doc = krystal::parseParallel(json, krystal::ObjectOrder::Unordered, 4);
+			auto expected = krystal::parseString(json);
+			
+			if (checkEqual(doc.size(), 8000)) {
+				checkTrue(sameValues(doc.root(), expected.root()));
+				checkEqual(doc[7999]["id"].number(), 7999);
+				checkEqual(doc[4321]["name"].string(), "record \"number\" 4321");
+				checkTrue(doc.memoryUsed() >= expected.memoryUsed());
+			}
+		});
+		
+		test("large objects should parse with the latest duplicate key winning", []{
+			std::string json { "{" };
+			for (int ix = 0; ix < 20000; ++ix)
+				json += R"("key)" + std::to_string(ix % 10000) + R"(":{"value":)" + std::to_string(ix) + R"(,"pad":"padding to make this a large enough document"},)";
+			json += R"("last":[]})";
+			
+			auto doc = krystal::parseParallel(json, krystal::ObjectOrder::InsertionOrder, 8);
+			if (checkEqual(doc.size(), 10001)) {
+				checkEqual(doc["key0"]["value"].number(), 10000);
+				checkEqual(doc["key9999"]["value"].number(), 19999);
+				checkEqual((*doc.keys().begin()).str(), "key0");
+				checkTrue(doc["last"].isArray());
+			}
+		});
+		
+		test("invalid documents should report the same error as parse()", []{
+			auto json = recordsJSON(8000);
+			json.insert(json.find(",\n", json.size() / 2) + 1, "x");
+			
+			krystal::ParseError parallelError, error;
+			auto doc = krystal::parseParallel(json, parallelError, krystal::ObjectOrder::Unordered, 4);
+			krystal::parseString(json, error);
+			
+			checkTrue(doc.isNull());
+			checkTrue(bool(parallelError));
+			checkTrue(parallelError.code == error.code);
+			checkEqual(parallelError.offset, error.offset);
+		});
+		
+		test("parallel documents should be editable and clonable", []{
+			auto doc = krystal::parseParallel(recordsJSON(8000), krystal::ObjectOrder::Unordered, 4);
+			doc.root()[6000]["id"] = doc.make(-1);
+			
+			auto clone = doc.clone();
+			clone.root()[7000]["tags"].emplace_back(clone.make("new"));
+			doc = krystal::parseString("[]");
+			
+			checkEqual(clone[6000]["id"].number(), -1);
+			checkEqual(clone[7000]["tags"].size(), 4);
+			checkEqual(clone[7999]["tags"][2]["deep"][2][0].number(), 3);
+		});
+		
+		test("independent parses on many threads at once should match sequential ones", []{
+			std::vector<std::string> inputs;
+			for (auto name : { "tiny", "teensy", "medium-large", "rapidjson-insane" })
+				inputs.push_back(readTextFile(std::string{"perftests/"} + name + ".json"));
+			inputs.push_back(recordsJSON(500));
+			inputs.push_back(R"(["esc\u00e9ped \"strings\" \ud83d\ude00", "tab\there", "\u65e5\u672c"])");
+			
+			std::vector<decltype(krystal::parseString(""))> expected;
+			for (auto& json : inputs)
+				expected.push_back(krystal::parseString(json));
+			
+			const int threadCount = 8, rounds = 10;
+			std::vector<int> mismatches(threadCount, 0);
+			std::vector<std::thread> threads;
+			for (int t = 0; t < threadCount; ++t)
+				threads.emplace_back([&, t]{
+					for (int round = 0; round < rounds; ++round)
+						for (size_t ix = 0; ix < inputs.size(); ++ix) {
+							auto& json = inputs[(ix + static_cast<size_t>(t)) % inputs.size()];
+							auto doc = krystal::parseString(json);
+							if (! sameValues(doc.root(), expected[(ix + static_cast<size_t>(t)) % inputs.size()].root()))
+								++mismatches[static_cast<size_t>(t)];
+						}
+				});
+			for (auto& thread : threads)
+				thread.join();
+			
+			for (auto count : mismatches)
+				checkEqual(count, 0);
+		});
+	});
+}
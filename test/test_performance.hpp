@@ -1,6 +1,51 @@
 // test_performance.hpp - part of krystal_test
 // (c) 2013-6 by Arthur Langereis (@zenmumbler)
 
+struct BindTextBox {
+	std::string text;
+	double x, y, width, height;
+};
+
+namespace krystal {
+	template <> struct Fields<BindTextBox> {
+		static constexpr auto list() {
+			return std::make_tuple(
+				field("text", &BindTextBox::text),
+				field("x", &BindTextBox::x),
+				field("y", &BindTextBox::y),
+				field("width", &BindTextBox::width),
+				field("height", &BindTextBox::height)
+			);
+		}
+	};
+}
+
+
+// visit every value in a tree, summing the lengths of all keys
+template <typename ValueType>
+size_t keyBytesByIterator(const ValueType& val) {
+	size_t bytes = 0;
+	if (val.isContainer()) {
+		for (auto kv : val) {
+			if (val.isObject())
+				bytes += kv.first.string().size();
+			bytes += keyBytesByIterator(kv.second);
+		}
+	}
+	return bytes;
+}
+
+template <typename ValueType>
+size_t keyBytesByItems(const ValueType& val) {
+	size_t bytes = 0;
+	if (val.isContainer()) {
+		for (auto item : val.items())
+			bytes += item.key.size() + keyBytesByItems(item.value);
+	}
+	return bytes;
+}
+
+
 void test_performance() {
 	group("performance tests", []{
 		using namespace std::chrono;
@@ -17,6 +62,23 @@ void test_performance() {
 			std::cout << "Perf: 100K times tiny file took " << duration_cast<milliseconds>(t1 - t0).count() << "ms.\n";
 		});
 		
+		test("100.000 parses of invalid tiny file", []{
+			// the same file with a stray comma just past the middle
+			auto perf_file = readTextFile("perftests/teensy.json");
+			auto comma = perf_file.find(',', perf_file.size() / 2);
+			perf_file.insert(comma, ",");
+			
+			krystal::ParseError error;
+			auto t0 = high_resolution_clock::now();
+			for (int x = 0; x < 100000; ++x) {
+				auto doc = krystal::parseString(perf_file, error);
+			}
+			auto t1 = high_resolution_clock::now();
+			
+			checkTrue(bool(error));
+			std::cout << "Perf: 100K times invalid tiny file took " << duration_cast<milliseconds>(t1 - t0).count() << "ms.\n";
+		});
+		
 		test("medium sized compact file (200KB)", []{
 			auto perf_file = readTextFile("perftests/medium-large.json");
 			auto t0 = high_resolution_clock::now();
@@ -25,7 +87,7 @@ void test_performance() {
 			
 			std::cout << "Perf: medium file took " << duration_cast<milliseconds>(t1 - t0).count() << "ms.\n";
 		});
-
+		
 		test("rapidjson's insane test file (670KB)", []{
 			auto perf_file = readTextFile("perftests/rapidjson-insane.json");
 			auto t0 = high_resolution_clock::now();
@@ -34,7 +96,7 @@ void test_performance() {
 			
 			std::cout << "Perf: rapidjson's file took " << duration_cast<milliseconds>(t1 - t0).count() << "ms.\n";
 		});
-
+		
 		test("very large but very simple file (4.1MB)", []{
 			auto perf_file = readTextFile("perftests/large-but-boring.json");
 			auto t0 = high_resolution_clock::now();
@@ -43,6 +105,243 @@ void test_performance() {
 			
 			std::cout << "Perf: large file took " << duration_cast<milliseconds>(t1 - t0).count() << "ms.\n";
 		});
-
+		
+		test("iterating all members of rapidjson's file 20 times, pairs vs items()", []{
+			auto perf_file = readTextFile("perftests/rapidjson-insane.json");
+			auto doc = krystal::parseString(perf_file);
+			size_t pair_bytes = 0, item_bytes = 0;
+			
+			auto t0 = high_resolution_clock::now();
+			for (int x = 0; x < 20; ++x)
+				pair_bytes += keyBytesByIterator(doc["a"]);
+			auto t1 = high_resolution_clock::now();
+			for (int x = 0; x < 20; ++x)
+				item_bytes += keyBytesByItems(doc["a"]);
+			auto t2 = high_resolution_clock::now();
+			
+			checkEqual(pair_bytes, item_bytes);
+			std::cout << "Perf: iterating with pairs took " << duration_cast<microseconds>(t1 - t0).count() << "us, with items() took " << duration_cast<microseconds>(t2 - t1).count() << "us.\n";
+		});
+		
+		test("unordered and insertion ordered objects, 20 parses and walks of rapidjson's file", []{
+			auto perf_file = readTextFile("perftests/rapidjson-insane.json");
+			
+			auto parse_and_walk = [&](krystal::ObjectOrder order) {
+				size_t bytes = 0;
+				auto t0 = high_resolution_clock::now();
+				for (int x = 0; x < 20; ++x) {
+					auto doc = krystal::parseString(perf_file, order);
+					bytes += keyBytesByItems(doc["a"]);
+				}
+				auto t1 = high_resolution_clock::now();
+				checkEqual(bytes, 20 * keyBytesByItems(krystal::parseString(perf_file)["a"]));
+				return duration_cast<milliseconds>(t1 - t0).count();
+			};
+			
+			auto unordered_ms = parse_and_walk(krystal::ObjectOrder::Unordered);
+			auto ordered_ms = parse_and_walk(krystal::ObjectOrder::InsertionOrder);
+			std::cout << "Perf: unordered objects took " << unordered_ms << "ms, insertion ordered objects took " << ordered_ms << "ms.\n";
+		});
+		
+		test("virtual and static delegate calls, 20 parses of rapidjson's file", []{
+			auto perf_file = readTextFile("perftests/rapidjson-insane.json");
+			
+			auto parse_with = [&](auto reader_tag) {
+				using ReaderType = typename decltype(reader_tag)::type;
+				auto t0 = high_resolution_clock::now();
+				for (int x = 0; x < 20; ++x) {
+					krystal::DocumentBuilder builder;
+					ReaderType reader { builder };
+					krystal::ReaderStream<std::string::const_iterator> stream { perf_file.cbegin(), perf_file.cend() };
+					reader.parseDocument(stream);
+					checkTrue(builder.document().isContainer());
+				}
+				return duration_cast<milliseconds>(high_resolution_clock::now() - t0).count();
+			};
+			
+			auto virtual_ms = parse_with(std::common_type<krystal::Reader>{});
+			auto static_ms = parse_with(std::common_type<krystal::BasicReader<krystal::DocumentBuilder>>{});
+			
+			std::cout << "Perf: virtual delegate calls took " << virtual_ms << "ms, static delegate calls took " << static_ms << "ms.\n";
+		});
+		
+		test("1M element number array into a std::vector<float>", []{
+			std::string numbers_json { "[" };
+			for (int x = 0; x < 1000000; ++x) {
+				if (x) numbers_json += ',';
+				numbers_json += std::to_string(x % 4096) + ((x & 1) ? ".25" : "");
+			}
+			numbers_json += "]";
+			
+			auto t0 = high_resolution_clock::now();
+			auto doc = krystal::parseString(numbers_json);
+			std::vector<float> dom_numbers(doc.size());
+			for (size_t ix = 0; ix < doc.size(); ++ix)
+				dom_numbers[ix] = doc[ix].numberAs<float>();
+			auto t1 = high_resolution_clock::now();
+			
+			std::vector<float> direct_numbers;
+			krystal::parseNumbers(numbers_json, direct_numbers);
+			auto t2 = high_resolution_clock::now();
+			
+			checkTrue(dom_numbers == direct_numbers);
+			std::cout << "Perf: 1M numbers via document took " << duration_cast<milliseconds>(t1 - t0).count() << "ms, "
+			          << "via parseNumbers took " << duration_cast<milliseconds>(t2 - t1).count() << "ms.\n";
+		});
+		
+		test("medium sized file into structs, via document and directly", []{
+			auto perf_file = readTextFile("perftests/medium-large.json");
+			
+			auto t0 = high_resolution_clock::now();
+			auto doc = krystal::parseString(perf_file);
+			std::vector<BindTextBox> dom_boxes(doc.size());
+			for (size_t ix = 0; ix < doc.size(); ++ix) {
+				const auto& item = doc[ix];
+				auto& box = dom_boxes[ix];
+				box.text = item["text"].string();
+				box.x = item["x"].number();
+				box.y = item["y"].number();
+				box.width = item["width"].number();
+				box.height = item["height"].number();
+			}
+			auto t1 = high_resolution_clock::now();
+			
+			std::vector<BindTextBox> direct_boxes;
+			krystal::parseInto(direct_boxes, perf_file);
+			auto t2 = high_resolution_clock::now();
+			
+			checkEqual(dom_boxes.size(), direct_boxes.size());
+			std::cout << "Perf: medium file into structs via document took " << duration_cast<microseconds>(t1 - t0).count() << "us, "
+			          << "via parseInto took " << duration_cast<microseconds>(t2 - t1).count() << "us.\n";
+		});
+		
+		test("1000 modified copies of a medium sized file, via clone and via reparse", []{
+			auto perf_file = readTextFile("perftests/medium-large.json");
+			auto base = krystal::parseString(perf_file);
+			
+			size_t clone_bytes = 0, parse_bytes = 0;
+			auto t0 = high_resolution_clock::now();
+			for (int x = 0; x < 1000; ++x) {
+				auto doc = base.clone();
+				doc.root()[x % doc.size()]["x"] = doc.make(x);
+				clone_bytes += doc.memoryUsed();
+				checkEqual(doc[x % doc.size()]["x"].number(), x);
+			}
+			auto t1 = high_resolution_clock::now();
+			for (int x = 0; x < 1000; ++x) {
+				auto doc = krystal::parseString(perf_file);
+				doc.root()[x % doc.size()]["x"] = doc.make(x);
+				parse_bytes += doc.memoryUsed();
+				checkEqual(doc[x % doc.size()]["x"].number(), x);
+			}
+			auto t2 = high_resolution_clock::now();
+			
+			std::cout << "Perf: 1000 copies via clone took " << duration_cast<milliseconds>(t1 - t0).count() << "ms using " << clone_bytes / 1000 << " bytes each, "
+			          << "via reparse took " << duration_cast<milliseconds>(t2 - t1).count() << "ms using " << parse_bytes / 1000 << " bytes each.\n";
+		});
+		
+		test("extracting a subtree of rapidjson's file 20 times, to the heap and to a new document", []{
+			auto perf_file = readTextFile("perftests/rapidjson-insane.json");
+			auto doc = krystal::parseString(perf_file);
+			size_t heap_bytes = 0, doc_bytes = 0, sub_bytes = 0;
+			
+			auto t0 = high_resolution_clock::now();
+			for (int x = 0; x < 20; ++x) {
+				auto sub = krystal::Value::copyOf(doc["a"]);
+				heap_bytes += keyBytesByItems(sub);
+			}
+			auto t1 = high_resolution_clock::now();
+			for (int x = 0; x < 20; ++x) {
+				auto sub = decltype(doc)::copyOf(doc["a"]);
+				doc_bytes += keyBytesByItems(sub.root());
+				sub_bytes = sub.memoryUsed();
+			}
+			auto t2 = high_resolution_clock::now();
+			
+			checkEqual(heap_bytes, 20 * keyBytesByItems(doc["a"]));
+			checkEqual(doc_bytes, heap_bytes);
+			std::cout << "Perf: extracting to the heap took " << duration_cast<milliseconds>(t1 - t0).count() << "ms, "
+			          << "to a new document took " << duration_cast<milliseconds>(t2 - t1).count() << "ms using "
+			          << sub_bytes << " of the original's " << doc.memoryUsed() << " bytes.\n";
+		});
+		
+		test("loading and querying the large file from JSON and from a snapshot, 10 times", []{
+			auto perf_file = readTextFile("perftests/large-but-boring.json");
+			auto data = krystal::makeSnapshot(krystal::parseString(perf_file));
+			size_t parsed = 0, loaded = 0;
+			
+			auto t0 = high_resolution_clock::now();
+			for (int x = 0; x < 10; ++x) {
+				auto doc = krystal::parseString(perf_file);
+				parsed += doc["exampleCitationsFromMasterId"].size();
+			}
+			auto t1 = high_resolution_clock::now();
+			for (int x = 0; x < 10; ++x) {
+				krystal::Snapshot snap { data };
+				loaded += snap["exampleCitationsFromMasterId"].size();
+			}
+			auto t2 = high_resolution_clock::now();
+			
+			checkEqual(parsed, loaded);
+			std::cout << "Perf: loading large file from JSON took " << duration_cast<milliseconds>(t1 - t0).count() << "ms, "
+			          << "from a " << data.size() << " byte snapshot took " << duration_cast<microseconds>(t2 - t1).count() << "us.\n";
+		});
+		
+		test("JSON, MessagePack and CBOR, 20 parses and emits of rapidjson's and the medium file", []{
+			for (auto name : { "rapidjson-insane", "medium-large" }) {
+				auto json = readTextFile(std::string{"perftests/"} + name + ".json");
+				auto doc = krystal::parseString(json);
+				std::string msgpack, cbor;
+				
+				auto t0 = high_resolution_clock::now();
+				for (int x = 0; x < 20; ++x)
+					msgpack = krystal::writeMessagePack(doc);
+				auto t1 = high_resolution_clock::now();
+				for (int x = 0; x < 20; ++x)
+					cbor = krystal::writeCBOR(doc);
+				auto t2 = high_resolution_clock::now();
+				for (int x = 0; x < 20; ++x)
+					checkEqual(krystal::parseString(json).size(), doc.size());
+				auto t3 = high_resolution_clock::now();
+				for (int x = 0; x < 20; ++x)
+					checkEqual(krystal::parseMessagePack(msgpack).size(), doc.size());
+				auto t4 = high_resolution_clock::now();
+				for (int x = 0; x < 20; ++x)
+					checkEqual(krystal::parseCBOR(cbor).size(), doc.size());
+				auto t5 = high_resolution_clock::now();
+				
+				// MB/s of the input or output, durations are in us for 20 runs
+				auto throughput = [](size_t size, high_resolution_clock::duration time) {
+					return static_cast<double>(20 * size) / std::max<long long>(1, duration_cast<microseconds>(time).count());
+				};
+				std::cout << "Perf: " << name << " (JSON " << json.size() << "B, MessagePack " << msgpack.size() << "B, CBOR " << cbor.size() << "B) "
+				          << "parse JSON " << throughput(json.size(), t3 - t2) << "MB/s, MessagePack " << throughput(msgpack.size(), t4 - t3) << "MB/s, CBOR " << throughput(cbor.size(), t5 - t4) << "MB/s; "
+				          << "emit MessagePack " << throughput(msgpack.size(), t1 - t0) << "MB/s, CBOR " << throughput(cbor.size(), t2 - t1) << "MB/s.\n";
+			}
+		});
+		
+		test("memory used per value for each perftests file", []{
+			for (auto name : { "teensy", "medium-large", "rapidjson-insane", "large-but-boring" }) {
+				auto perf_file = readTextFile(std::string{"perftests/"} + name + ".json");
+				auto doc = krystal::parseString(perf_file);
+				
+				using BasicValue = decltype(doc)::ValueType;
+				std::function<size_t(const BasicValue&)> count_values = [&](const BasicValue& val) -> size_t {
+					size_t count = 1;
+					if (val.isContainer())
+						for (auto kv : val)
+							count += count_values(kv.second);
+					return count;
+				};
+				
+				size_t values = 1;
+				for (auto kv : doc)
+					values += count_values(kv.second);
+				
+				std::cout << "Mem: " << name << " has " << values << " values using " << doc.memoryUsed() << " bytes, "
+				          << (double(doc.memoryUsed()) / values) << " bytes/value (value node is " << sizeof(BasicValue) << " bytes).\n";
+			}
+		});
+	
 	});
 }
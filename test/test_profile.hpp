@@ -0,0 +1,65 @@
+// test_profile.hpp - part of krystal_test
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+void test_profile() {
+	group("parse profiles", []{
+		test("tokens, strings and depth should be counted", []{
+			krystal::ParseProfile profile;
+			auto doc = krystal::parseProfiled(R"({"a": [1, 2.5, "x\n", true, false, null], "bc": {}})", profile);
+			
+			checkTrue(doc.isObject());
+			checkEqual(profile.count(TokenKind::Key), 2);
+			checkEqual(profile.count(TokenKind::Number), 2);
+			checkEqual(profile.count(TokenKind::String), 1);
+			checkEqual(profile.count(TokenKind::True), 1);
+			checkEqual(profile.count(TokenKind::False), 1);
+			checkEqual(profile.count(TokenKind::Null), 1);
+			checkEqual(profile.count(TokenKind::ArrayBegin), 1);
+			checkEqual(profile.count(TokenKind::ArrayEnd), 1);
+			checkEqual(profile.count(TokenKind::ObjectBegin), 2);
+			checkEqual(profile.count(TokenKind::ObjectEnd), 2);
+			checkEqual(profile.stringBytes, 5);
+			checkEqual(profile.escapes, 1);
+			checkEqual(profile.maxDepth, 2);
+			checkEqual(profile.numberSlowPaths, 0);
+			checkTrue(profile.lakeBlocks >= 1);
+			checkEqual(profile.lakeBytes, doc.memoryUsed());
+		});
+		
+		test("numbers that cannot be converted exactly should count as slow paths", []{
+			krystal::ParseProfile profile;
+			krystal::parseProfiled("[1e300, 12345678901234567890, 0.1e-30, 9007199254740993, 1.5e22, 123.456]", profile);
+			checkEqual(profile.numberSlowPaths, 4);
+		});
+		
+		test("profiled parses should build the same document and time their phases", []{
+			auto json = readTextFile("perftests/rapidjson-insane.json");
+			krystal::ParseProfile profile;
+			auto doc = krystal::parseProfiled(json, profile);
+			
+			checkTrue(sameValues(doc.root(), krystal::parseString(json).root()));
+			checkTrue(profile.timeOf(ParsePhase::String).count() > 0);
+			checkTrue(profile.timeOf(ParsePhase::Number).count() > 0);
+			checkTrue(profile.timeOf(ParsePhase::Building).count() > 0);
+			checkTrue(profile.totalTime >= profile.timeOf(ParsePhase::Building));
+		});
+		
+		test("readers without instrumentation should not grow", []{
+			struct Counter final {
+				bool nullValue() { return true; }
+				bool falseValue() { return true; }
+				bool trueValue() { return true; }
+				bool numberValue(double) { return true; }
+				bool stringValue(StringRef, bool) { return true; }
+				bool arrayBegin() { return true; }
+				bool arrayEnd() { return true; }
+				bool objectBegin() { return true; }
+				bool objectEnd() { return true; }
+				void error(const ParseError&) {}
+			};
+			
+			checkTrue(std::is_empty<krystal::NoInstrumentation>::value);
+			checkTrue(sizeof(krystal::BasicReader<Counter>) < sizeof(krystal::BasicReader<Counter, krystal::ParseProfile>));
+		});
+	});
+}
@@ -3,6 +3,453 @@
 
 void test_reader() {
 	group("reader class", []{
+		group("numbers", []{
+			test("integers should be parsed exactly up to 2^53 and rounded beyond", []{
+				auto doc = krystal::parseString("[0, -1, 9007199254740992, -9007199254740991, 9007199254740993, 123456789012345678]");
+				checkEqual(doc[0].number(), 0.0);
+				checkEqual(doc[1].number(), -1.0);
+				checkEqual(doc[2].number(), 9007199254740992.0);
+				checkEqual(doc[3].numberAs<int64_t>(), -9007199254740991);
+				checkEqual(doc[4].number(), 9007199254740992.0);
+				checkEqual(doc[5].number(), 123456789012345678.0);
+			});
+			
+			test("short decimals should be correctly rounded", []{
+				auto doc = krystal::parseString("[0.1, 98.6, -0.005, 1.5e-7, 2.5E+10]");
+				checkEqual(doc[0].number(), 0.1);
+				checkEqual(doc[1].number(), 98.6);
+				checkEqual(doc[2].number(), -0.005);
+				checkEqual(doc[3].number(), 1.5e-7);
+				checkEqual(doc[4].number(), 2.5e10);
+			});
+			
+			test("numbers with more than 19 significant digits should keep their magnitude", []{
+				auto doc = krystal::parseString("[123456789012345678901234567890, 0.000000000000000000000000000001]");
+				checkTrue(std::abs(doc[0].number() / 1.2345678901234568e29 - 1.0) < 1e-15);
+				checkTrue(std::abs(doc[1].number() / 1e-30 - 1.0) < 1e-15);
+			});
+		});
 		
+		group("number arrays", []{
+			test("flat number arrays should be read into a vector", []{
+				std::vector<double> numbers;
+				checkTrue(krystal::parseNumbers("[1, 2.5, -3, 4e2]", numbers));
+				checkTrue(numbers == std::vector<double>({ 1, 2.5, -3, 400 }));
+			});
+			
+			test("nested number arrays should be flattened", []{
+				std::vector<float> numbers;
+				checkTrue(krystal::parseNumbers("[[0.5, 1], [2, 3], []]", numbers));
+				checkTrue(numbers == std::vector<float>({ 0.5f, 1, 2, 3 }));
+			});
+			
+			test("arrays with non-number values should fail", []{
+				std::vector<int> numbers;
+				checkFalse(krystal::parseNumbers("[1, 2, \"3\"]", numbers));
+				checkFalse(krystal::parseNumbers("[1, null]", numbers));
+				checkFalse(krystal::parseNumbers("{\"a\": 1}", numbers));
+				checkFalse(krystal::parseNumbers("[1, 2", numbers));
+				checkTrue(numbers.empty());
+			});
+			
+			test("a failed parse should leave the numbers read before it", []{
+				std::vector<double> numbers { 7, 8 };
+				checkTrue(krystal::parseNumbers("[9]", numbers));
+				checkFalse(krystal::parseNumbers("[1, 2, 3, false]", numbers));
+				checkTrue(numbers == std::vector<double>({ 7, 8, 9 }));
+			});
+			
+			test("copyNumbers should copy all numbers of an array value", []{
+				auto doc = krystal::parseString("[[10, 20, 30, 40]]");
+				float dest[8] = {};
+				checkEqual(doc[0].copyNumbers(dest, 8), 4);
+				checkEqual(dest[0], 10.0f);
+				checkEqual(dest[3], 40.0f);
+				
+				int partial[2] = {};
+				checkEqual(doc[0].copyNumbers(partial, 2), 2);
+				checkEqual(partial[1], 20);
+			});
+			
+			test("copyNumbers should throw for arrays with non-number values", []{
+				auto doc = krystal::parseString("[1, true]");
+				double dest[2];
+				bool threw = false;
+				try { doc.copyNumbers(dest, 2); } catch (std::runtime_error&) { threw = true; }
+				checkTrue(threw);
+			});
+			
+			test("copyNumbers should not write to dest if it throws", []{
+				auto doc = krystal::parseString("[1, 2, \"3\", 4]");
+				int dest[4] = { -1, -1, -1, -1 };
+				bool threw = false;
+				try { doc.copyNumbers(dest, 4); } catch (std::runtime_error&) { threw = true; }
+				checkTrue(threw);
+				checkEqual(dest[0], -1);
+				checkEqual(dest[1], -1);
+				
+				checkEqual(doc.copyNumbers(dest, 2), 2);
+				checkEqual(dest[1], 2);
+			});
+		});
+		
+		group("errors", []{
+			using krystal::ErrorCode;
+			
+			auto errorFor = [](const std::string& json) {
+				krystal::ParseError error;
+				krystal::parseString(json, error);
+				return error;
+			};
+			
+			test("valid documents should not report an error", []{
+				krystal::ParseError error;
+				auto doc = krystal::parseString("{\"a\": [1, true]}", error);
+				checkTrue(doc.isObject());
+				checkFalse(bool(error));
+			});
+			
+			test("errors should be reported by code", [=]{
+				checkTrue(errorFor("").code == ErrorCode::UnexpectedEnd);
+				checkTrue(errorFor("42").code == ErrorCode::ExpectedContainer);
+				checkTrue(errorFor("[1] x").code == ErrorCode::TrailingData);
+				checkTrue(errorFor("[1, ]").code == ErrorCode::ExpectedValue);
+				checkTrue(errorFor("[tru]").code == ErrorCode::InvalidLiteral);
+				checkTrue(errorFor("[-]").code == ErrorCode::MissingIntegerDigits);
+				checkTrue(errorFor("[1.]").code == ErrorCode::MissingFractionDigits);
+				checkTrue(errorFor("[1e+]").code == ErrorCode::MissingExponentDigits);
+				checkTrue(errorFor("{a: 1}").code == ErrorCode::ExpectedQuote);
+				checkTrue(errorFor("[\"\\x\"]").code == ErrorCode::InvalidEscape);
+				checkTrue(errorFor("[\"\\u12g4\"]").code == ErrorCode::InvalidHexDigit);
+				checkTrue(errorFor("[\"\\uD834x\"]").code == ErrorCode::ExpectedLowSurrogate);
+				checkTrue(errorFor("[\"\\uD834\\u0041\"]").code == ErrorCode::InvalidLowSurrogate);
+				checkTrue(errorFor("[\"\t\"]").code == ErrorCode::UnescapedControlChar);
+				checkTrue(errorFor("[1 2]").code == ErrorCode::ExpectedCommaOrBracket);
+				checkTrue(errorFor("{\"a\": 1 \"b\"}").code == ErrorCode::ExpectedCommaOrBrace);
+				checkTrue(errorFor("{\"a\" 1}").code == ErrorCode::ExpectedColon);
+				checkTrue(errorFor("{\"a\": [1, 2").code == ErrorCode::UnexpectedEnd);
+				checkTrue(errorFor("[\"abc").code == ErrorCode::UnexpectedEnd);
+			});
+			
+			test("errors should report the offset, line and column", [=]{
+				auto error = errorFor("{\n  \"a\": 1,\n  \"b\": x\n}");
+				checkTrue(error.code == ErrorCode::ExpectedValue);
+				checkEqual(error.offset, 19);
+				checkEqual(error.line, 3);
+				checkEqual(error.column, 8);
+				checkEqual(error.found, 'x');
+			});
+			
+			test("error messages should be formatted on request", [=]{
+				checkEqual(errorFor("[1 2]").message(), std::string("Expected `,` or `]` but found `2` at line 1, column 4."));
+				checkEqual(errorFor("[1").message(), std::string("Unexpected end of input at line 1, column 3."));
+			});
+			
+			test("a delegate should be able to stop the parse", []{
+				struct FirstNumbers final : krystal::ReaderDelegate {
+					int seen = 0;
+					bool nullValue() override { return true; }
+					bool falseValue() override { return true; }
+					bool trueValue() override { return true; }
+					bool numberValue(double) override { return ++seen < 3; }
+					bool stringValue(StringRef, bool) override { return true; }
+					bool arrayBegin() override { return true; }
+					bool arrayEnd() override { return true; }
+					bool objectBegin() override { return true; }
+					bool objectEnd() override { return true; }
+					void error(const krystal::ParseError&) override {}
+				};
+				
+				std::string json = "[1, 2, 3, 4, 5]";
+				FirstNumbers delegate;
+				krystal::BasicReader<FirstNumbers> reader { delegate };
+				krystal::ReaderStream<std::string::const_iterator> stream { json.cbegin(), json.cend() };
+				
+				checkFalse(reader.parseDocument(stream));
+				checkEqual(delegate.seen, 3);
+				checkTrue(reader.error().code == ErrorCode::Aborted);
+				checkEqual(reader.error().offset, 8);
+			});
+			
+			test("a reader should report only the error of the document it parsed last", []{
+				std::vector<double> numbers;
+				krystal::NumberArrayBuilder<double> builder { numbers };
+				krystal::BasicReader<krystal::NumberArrayBuilder<double>> reader { builder };
+				auto parse = [&](const std::string& json) {
+					krystal::ReaderStream<std::string::const_iterator> stream { json.cbegin(), json.cend() };
+					return reader.parseDocument(stream);
+				};
+				
+				checkFalse(parse("[\n\n1 2]"));
+				checkEqual(reader.error().line, 3);
+				
+				checkTrue(parse("[1]"));
+				checkTrue(reader.error().code == ErrorCode::None);
+				
+				krystal::ParseError expected;
+				krystal::parseString("[x]", expected);
+				checkFalse(parse("[x]"));
+				checkTrue(reader.error().code == expected.code);
+				checkEqual(reader.error().line, 1);
+				checkEqual(reader.error().column, expected.column);
+				checkEqual(reader.error().offset, expected.offset);
+			});
+		});
+		
+		group("strings", []{
+			struct StringRecorder final {
+				std::vector<std::string> values;
+				std::vector<bool> escaped;
+				std::vector<const char*> data;
+				bool nullValue() { return true; }
+				bool falseValue() { return true; }
+				bool trueValue() { return true; }
+				bool numberValue(double) { return true; }
+				bool stringValue(StringRef str, bool hasEscapes) {
+					values.push_back(str.str());
+					escaped.push_back(hasEscapes);
+					data.push_back(str.data());
+					return true;
+				}
+				bool arrayBegin() { return true; }
+				bool arrayEnd() { return true; }
+				bool objectBegin() { return true; }
+				bool objectEnd() { return true; }
+				void error(const ParseError&) {}
+			};
+			
+			test("strings without escapes in contiguous input should point into the input", []{
+				std::string json = R"({"key": ["plain", "", "caf\u00e9 \"au\" lait"]})";
+				StringRecorder recorder;
+				krystal::BasicReader<StringRecorder> reader { recorder };
+				krystal::ReaderStream<std::string::const_iterator> stream { json.cbegin(), json.cend() };
+				
+				checkTrue(reader.parseDocument(stream));
+				checkEqual(recorder.values.size(), 4);
+				checkEqual(recorder.values[0], std::string("key"));
+				checkEqual(recorder.values[1], std::string("plain"));
+				checkEqual(recorder.values[2], std::string(""));
+				checkEqual(recorder.values[3], std::string("caf\xc3\xa9 \"au\" lait"));
+				
+				checkFalse(recorder.escaped[0]);
+				checkFalse(recorder.escaped[1]);
+				checkTrue(recorder.escaped[3]);
+				checkTrue(recorder.data[0] == json.data() + 2);
+				checkTrue(recorder.data[1] == json.data() + 10);
+			});
+			
+			test("strings from other input should be read char by char with the same result", []{
+				std::istringstream json { R"(["plain", "tab\there"])" };
+				json >> std::noskipws;
+				StringRecorder recorder;
+				krystal::BasicReader<StringRecorder> reader { recorder };
+				krystal::ReaderStream<std::istream_iterator<char>> stream { std::istream_iterator<char>{json}, {} };
+				
+				checkTrue(reader.parseDocument(stream));
+				checkEqual(recorder.values[0], std::string("plain"));
+				checkEqual(recorder.values[1], std::string("tab\there"));
+				checkFalse(recorder.escaped[0]);
+				checkTrue(recorder.escaped[1]);
+			});
+			
+			test("errors after a plain prefix should be reported at their own position", []{
+				auto errorAt = [](const std::string& json) {
+					StringRecorder recorder;
+					krystal::BasicReader<StringRecorder> reader { recorder };
+					krystal::ReaderStream<std::string::const_iterator> stream { json.cbegin(), json.cend() };
+					reader.parseDocument(stream);
+					return reader.error();
+				};
+				
+				checkTrue(errorAt("[\"abc\tdef\"]").code == ErrorCode::UnescapedControlChar);
+				checkEqual(errorAt("[\"abc\tdef\"]").offset, 6);
+				checkTrue(errorAt("[\"abc\\q\"]").code == ErrorCode::InvalidEscape);
+				checkTrue(errorAt("[\"abcdef").code == ErrorCode::UnexpectedEnd);
+				checkEqual(errorAt("[\"abcdef").offset, 8);
+			});
+			
+			// parses from a string and char by char from a stream, both must agree
+			auto readBoth = [](const std::string& json, bool validate = true) {
+				StringRecorder inPlace, byChar;
+				krystal::BasicReader<StringRecorder> r1 { inPlace }, r2 { byChar };
+				r1.setValidateUTF8(validate);
+				r2.setValidateUTF8(validate);
+				krystal::ReaderStream<std::string::const_iterator> s1 { json.cbegin(), json.cend() };
+				std::istringstream input { json };
+				input >> std::noskipws;
+				krystal::ReaderStream<std::istream_iterator<char>> s2 { std::istream_iterator<char>{input}, {} };
+				
+				r1.parseDocument(s1);
+				r2.parseDocument(s2);
+				checkTrue(r1.error().code == r2.error().code);
+				checkEqual(r1.error().offset, r2.error().offset);
+				checkTrue(inPlace.values == byChar.values);
+				return std::make_pair(r1.error(), inPlace.values);
+			};
+			
+			test("well-formed UTF-8 of every length should be accepted", [=]{
+				auto result = readBoth("[\"a \xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 \xf4\x8f\xbf\xbf\", \"" + std::string(20, 'x') + "\xce\xbb" + std::string(20, 'y') + "\"]");
+				checkTrue(result.first.code == ErrorCode::None);
+				checkEqual(result.second.size(), 2);
+				checkEqual(result.second[0], std::string("a \xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 \xf4\x8f\xbf\xbf"));
+				checkEqual(result.second[1].size(), 42);
+			});
+			
+			test("malformed UTF-8 should fail at the offending byte", [=]{
+				auto invalid = [=](const std::string& bytes, int found) {
+					auto error = readBoth("[\"abcdefghij" + bytes + "\"]").first;
+					checkTrue(error.code == ErrorCode::InvalidUTF8);
+					checkEqual(error.found, found);
+				};
+				
+				invalid("\x80", 0x80);                 // continuation without lead
+				invalid("\xc0\xaf", 0xc0);             // overlong
+				invalid("\xe0\x80\x80", 0x80);         // overlong
+				invalid("\xed\xa0\x80", 0xa0);         // surrogate
+				invalid("\xf4\x90\x80\x80", 0x90);     // beyond U+10FFFF
+				invalid("\xf5\x80\x80\x80", 0xf5);
+				invalid("\xe2\x82", '"');              // cut short
+				invalid("\xc3x", 'x');
+				
+				checkTrue(readBoth("[\"\xe2\x82").first.code == ErrorCode::UnexpectedEnd);
+			});
+			
+			test("UTF-8 validation should be optional", [=]{
+				auto result = readBoth("[\"\xff\xc0\xaf\"]", false);
+				checkTrue(result.first.code == ErrorCode::None);
+				checkEqual(result.second[0], std::string("\xff\xc0\xaf"));
+			});
+			
+			test("the scratch buffer should grow past its inline chars and keep its capacity", []{
+				krystal::ScratchBuffer buffer;
+				std::string text(300, 'q');
+				buffer.append(text.data(), text.data() + 100);
+				checkTrue(buffer.isInline());
+				
+				buffer.append(text.data() + 100, text.data() + 299);
+				buffer.push_back('!');
+				checkFalse(buffer.isInline());
+				checkEqual(std::string(buffer.data(), buffer.size()), std::string(299, 'q') + "!");
+				
+				auto capacity = buffer.capacity();
+				buffer.clear();
+				checkEqual(buffer.size(), 0);
+				checkEqual(buffer.capacity(), capacity);
+				
+				buffer.append(text.data(), text.data() + 10);
+				krystal::ScratchBuffer heapMoved { std::move(buffer) };
+				checkEqual(std::string(heapMoved.data(), heapMoved.size()), std::string(10, 'q'));
+				checkEqual(buffer.size(), 0);
+				
+				krystal::ScratchBuffer small;
+				small.push_back('a');
+				krystal::ScratchBuffer inlineMoved { std::move(small) };
+				checkTrue(inlineMoved.isInline());
+				checkEqual(std::string(inlineMoved.data(), inlineMoved.size()), "a");
+			});
+			
+			test("\\u escapes should decode to UTF-8, including surrogate pairs", [=]{
+				auto result = readBoth(R"(["\u0041\u00e9\u20AC\uD83D\uDE00\u0000x"])");
+				checkTrue(result.first.code == ErrorCode::None);
+				checkEqual(result.second[0], std::string("A\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80") + '\0' + "x");
+				
+				checkTrue(readBoth(R"(["\u12G4"])").first.code == ErrorCode::InvalidHexDigit);
+				checkEqual(readBoth(R"(["\u12G4"])").first.found, 'G');
+				checkTrue(readBoth(R"(["\uD83Dx"])").first.code == ErrorCode::ExpectedLowSurrogate);
+				checkTrue(readBoth(R"(["\uD83D\u0041"])").first.code == ErrorCode::InvalidLowSurrogate);
+			});
+		});
+		
+		group("literals", []{
+			// parses from a string and from a stream, the errors must agree
+			auto errorsFor = [](const std::string& json) {
+				krystal::ParseError inPlace, byChar;
+				auto doc = krystal::parseString(json, inPlace);
+				std::istringstream input { json };
+				krystal::parseStream(input, byChar);
+				checkTrue(inPlace.code == byChar.code);
+				checkEqual(inPlace.offset, byChar.offset);
+				checkEqual(inPlace.found, byChar.found);
+				return inPlace;
+			};
+			
+			test("true, false and null should be read in any position", [=]{
+				auto doc = krystal::parseString(R"([true,false,null,{"t":true,"f":false,"n":null},[null],true])");
+				checkEqual(doc.size(), 6);
+				checkTrue(doc[0].isTrue());
+				checkTrue(doc[1].isFalse());
+				checkTrue(doc[2].isNull());
+				checkTrue(doc[3]["f"].isFalse());
+				checkTrue(doc[4][0].isNull());
+				checkTrue(doc[5].isTrue());
+				checkTrue(errorsFor("[true,false,null]").code == ErrorCode::None);
+			});
+			
+			test("invalid literals should fail past their letters", [=]{
+				auto invalid = [=](const std::string& json, ptrdiff_t offset) {
+					auto error = errorsFor(json);
+					checkTrue(error.code == ErrorCode::InvalidLiteral);
+					checkEqual(error.offset, offset);
+					checkEqual(error.found, json[1]);
+				};
+				
+				invalid("[tru]", 4);
+				invalid("[truex]", 6);
+				invalid("[nulll]", 6);
+				invalid("[falsehood]", 7);
+				invalid("[fals", 5);
+				invalid("[nu", 3);
+				
+				checkTrue(errorsFor("[true1]").code == ErrorCode::ExpectedCommaOrBracket);
+				checkEqual(errorsFor("[true1]").offset, 5);
+				checkTrue(errorsFor("[True]").code == ErrorCode::ExpectedValue);
+				checkTrue(errorsFor("[\xff]").code == ErrorCode::ExpectedValue);
+			});
+		});
+		
+		group("nesting", []{
+			auto nested = [](size_t depth) {
+				return std::string(depth, '[') + std::string(depth, ']');
+			};
+			
+			auto parseWithDepth = [](const std::string& json, size_t maxDepth) {
+				krystal::DocumentBuilder builder;
+				krystal::BasicReader<krystal::DocumentBuilder> reader { builder, maxDepth };
+				krystal::ReaderStream<std::string::const_iterator> stream { json.cbegin(), json.cend() };
+				reader.parseDocument(stream);
+				return reader.error();
+			};
+			
+			test("nesting up to the max depth should parse", [=]{
+				checkFalse(bool(parseWithDepth(nested(10), 10)));
+				checkFalse(bool(parseWithDepth("[{\"a\": [{}, []]}]", 4)));
+				checkTrue(krystal::parseString(nested(krystal::Reader::DefaultMaxDepth)).isArray());
+			});
+			
+			test("nesting beyond the max depth should fail", [=]{
+				auto error = parseWithDepth(nested(11), 10);
+				checkTrue(error.code == krystal::ErrorCode::NestingTooDeep);
+				checkEqual(error.offset, 10);
+				checkTrue(parseWithDepth("[{\"a\": [{}, []]}]", 3).code == krystal::ErrorCode::NestingTooDeep);
+			});
+			
+			test("hostile nesting should fail without exhausting the stack", [=]{
+				krystal::ParseError error;
+				auto doc = krystal::parseString(std::string(1000000, '['), error);
+				checkTrue(doc.isNull());
+				checkTrue(error.code == krystal::ErrorCode::NestingTooDeep);
+			});
+			
+			test("the reader should not recurse for nested containers", []{
+				std::vector<double> numbers;
+				krystal::NumberArrayBuilder<double> builder { numbers };
+				krystal::BasicReader<krystal::NumberArrayBuilder<double>> reader { builder, 2000000 };
+				auto json = std::string(1000000, '[') + "42" + std::string(1000000, ']');
+				krystal::ReaderStream<std::string::const_iterator> stream { json.cbegin(), json.cend() };
+				
+				checkTrue(reader.parseDocument(stream));
+				checkEqual(numbers.size(), 1);
+			});
+		});
 	});
 }
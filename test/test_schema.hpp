@@ -0,0 +1,151 @@
+// test_schema.hpp - part of krystal_test
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+void test_schema() {
+	group("schema validation", []{
+		// the violation of a text, empty if it conforms
+		auto violationOf = [](const krystal::Schema& schema, const std::string& json) {
+			krystal::SchemaViolation violation;
+			auto valid = krystal::validate(json, schema, violation);
+			checkEqual(valid, ! violation);
+			return violation;
+		};
+		
+		test("types should be checked, integers being numbers without a fraction", [=]{
+			auto schema = krystal::parseSchema(R"({"type": "array", "items": {"type": ["integer", "string", "null"]}})");
+			
+			checkFalse(bool(violationOf(schema, R"([1, -20, 3e2, "x", null])")));
+			checkEqual(violationOf(schema, R"([1, 2.5])").message, "a number with a fraction is not an allowed type");
+			checkEqual(violationOf(schema, R"([1, 2.5])").path, "/1");
+			checkEqual(violationOf(schema, R"([true])").message, "true is not an allowed type");
+			checkEqual(violationOf(schema, R"([[]])").message, "array is not an allowed type");
+			checkEqual(violationOf(schema, R"({})").message, "object is not an allowed type");
+			checkEqual(violationOf(schema, R"({})").path, "");
+		});
+		
+		test("properties, required and additionalProperties should be checked per object", [=]{
+			auto schema = krystal::parseSchema(R"({
+				"type": "object",
+				"required": ["id", "name"],
+				"properties": {
+					"id": {"type": "integer", "minimum": 1},
+					"name": {"type": "string"},
+					"tags": {"type": "array", "items": {"type": "string"}}
+				},
+				"additionalProperties": false
+			})");
+			
+			checkFalse(bool(violationOf(schema, R"({"name": "a", "id": 1})")));
+			checkFalse(bool(violationOf(schema, R"({"id": 2, "tags": ["x", "y"], "name": ""})")));
+			checkEqual(violationOf(schema, R"({"id": 1})").message, "required member name is missing");
+			checkEqual(violationOf(schema, R"({"id": 1, "name": "a", "extra": 0})").message, "member is not allowed");
+			checkEqual(violationOf(schema, R"({"id": 1, "name": "a", "extra": 0})").path, "/extra");
+			checkEqual(violationOf(schema, R"({"id": 1, "name": "a", "tags": ["x", 1]})").path, "/tags/1");
+			checkEqual(violationOf(schema, R"({"id": 0, "name": "a"})").message, "0 is less than the minimum 1");
+			
+			auto open = krystal::parseSchema(R"({"properties": {"a": {"type": "number"}}, "additionalProperties": {"type": "string"}})");
+			checkFalse(bool(violationOf(open, R"({"a": 1, "b": "x"})")));
+			checkEqual(violationOf(open, R"({"a": 1, "b": 2})").path, "/b");
+		});
+		
+		test("nested required members should be reported at their object", [=]{
+			auto schema = krystal::parseSchema(R"({"items": {"properties": {"child": {"required": ["x"]}}}})");
+			auto violation = violationOf(schema, R"([{}, {"child": {"x": 1}}, {"child": {"y/~": {}}}])");
+			checkEqual(violation.message, "required member x is missing");
+			checkEqual(violation.path, "/2/child");
+			
+			auto escaped = krystal::parseSchema(R"({"additionalProperties": {"type": "number"}})");
+			checkEqual(violationOf(escaped, R"({"a/b~c": null})").path, "/a~1b~0c");
+		});
+		
+		test("enum, number ranges, string lengths and array sizes should be checked", [=]{
+			auto schema = krystal::parseSchema(R"({"properties": {
+				"kind": {"enum": ["circle", "square", null, 3]},
+				"size": {"type": "number", "exclusiveMinimum": 0, "maximum": 10},
+				"ratio": {"exclusiveMaximum": 1},
+				"name": {"type": "string", "minLength": 2, "maxLength": 4},
+				"points": {"type": "array", "minItems": 1, "maxItems": 2}
+			}})");
+			
+			checkFalse(bool(violationOf(schema, R"({"kind": "circle", "size": 10, "ratio": 0.5, "name": "été", "points": [1]})")));
+			checkFalse(bool(violationOf(schema, R"({"kind": null})")));
+			checkFalse(bool(violationOf(schema, R"({"kind": 3})")));
+			checkEqual(violationOf(schema, R"({"kind": "oval"})").message, "string is not one of the enum values");
+			checkEqual(violationOf(schema, R"({"kind": true})").message, "true is not one of the enum values");
+			checkEqual(violationOf(schema, R"({"kind": 4})").message, "4 is not one of the enum values");
+			checkEqual(violationOf(schema, R"({"size": 0})").message, "0 is not greater than 0");
+			checkEqual(violationOf(schema, R"({"size": 10.5})").message, "10.5 is greater than the maximum 10");
+			checkEqual(violationOf(schema, R"({"ratio": 1})").message, "1 is not less than 1");
+			checkEqual(violationOf(schema, R"({"name": "x"})").message, "string is shorter than 2 characters");
+			checkEqual(violationOf(schema, R"({"name": "étés!"})").message, "string is longer than 4 characters");
+			checkEqual(violationOf(schema, R"({"points": []})").message, "array has fewer than 1 elements");
+			checkEqual(violationOf(schema, R"({"points": [1, 2, 3]})").message, "array has more than 2 elements");
+			checkEqual(violationOf(schema, R"({"points": [1, 2, 3]})").path, "/points");
+			
+			auto huge = krystal::parseSchema(R"({"properties": {
+				"name": {"maxLength": 1e30},
+				"points": {"minItems": 1e300}
+			}})");
+			checkFalse(bool(violationOf(huge, R"({"name": "a long enough string"})")));
+			checkTrue(bool(violationOf(huge, R"({"points": [1, 2, 3]})")));
+		});
+		
+		test("boolean schemas should allow everything or nothing", [=]{
+			auto schema = krystal::parseSchema(R"({"properties": {"any": true, "none": false}})");
+			checkFalse(bool(violationOf(schema, R"({"any": [{"deep": [null]}]})")));
+			checkEqual(violationOf(schema, R"({"none": null})").message, "member is not allowed");
+			
+			auto empty = krystal::parseSchema(R"({"items": false})");
+			checkFalse(bool(violationOf(empty, "[]")));
+			checkEqual(violationOf(empty, "[[]]").message, "value is not allowed");
+		});
+		
+		test("unsupported keywords and malformed schemas should throw", []{
+			auto throws = [](const std::string& json) {
+				bool threw = false;
+				try { krystal::parseSchema(json); } catch (std::runtime_error&) { threw = true; }
+				return threw;
+			};
+			
+			checkTrue(throws(R"({"pattern": "^a"})"));
+			checkTrue(throws(R"({"type": "float"})"));
+			checkTrue(throws(R"({"items": [{}]})"));
+			checkTrue(throws(R"({"maxLength": -1})"));
+			checkTrue(throws(R"({"enum": [[1]]})"));
+			checkTrue(throws(R"({"type": )"));
+			krystal::parseSchema(R"({"$schema": "http://json-schema.org/draft-07/schema#", "title": "t", "description": "d"})");
+		});
+		
+		test("parseValidated should build valid documents and stop at the first violation", []{
+			auto schema = krystal::parseSchema(R"({"items": {"required": ["id"], "properties": {"id": {"type": "integer"}}}})");
+			auto json = recordsJSON(2000);
+			
+			krystal::SchemaViolation violation;
+			auto doc = krystal::parseValidated(json, schema, violation);
+			checkFalse(bool(violation));
+			checkTrue(sameValues(doc.root(), krystal::parseString(json).root()));
+			
+			json.replace(json.find(R"("id":5,)"), 7, R"("id":"5",)");
+			krystal::ParseError error;
+			auto invalid = krystal::parseValidated(json.begin(), json.end(), schema, violation, error);
+			checkTrue(invalid.isNull());
+			checkTrue(error.code == krystal::ErrorCode::Aborted);
+			checkEqual(violation.path, "/5/id");
+			checkTrue(static_cast<size_t>(error.offset) < json.size() / 100);
+		});
+		
+		test("a validator should be reusable for many messages after reset()", []{
+			auto schema = krystal::parseSchema(R"({"required": ["type"], "properties": {"type": {"enum": ["ping", "pong"]}}})");
+			krystal::SchemaValidator<> validator { schema };
+			krystal::BasicReader<krystal::SchemaValidator<>> reader { validator };
+			
+			int valid = 0;
+			for (std::string message : { R"({"type": "ping"})", R"({"type": "pang"})", R"({"kind": "ping"})", R"({"type": "pong", "n": 1})" }) {
+				validator.reset();
+				krystal::ReaderStream<std::string::const_iterator> stream { message.cbegin(), message.cend() };
+				valid += reader.parseDocument(stream);
+			}
+			checkEqual(valid, 2);
+		});
+	});
+}
@@ -0,0 +1,107 @@
+// test_snapshot.hpp - part of krystal_test
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+void test_snapshot() {
+	group("snapshots", []{
+		test("a snapshot should answer like the document it was made of", []{
+			auto doc = krystal::parseString(R"({"name":"a name too long to be inline","short":"abc","n":-1.5,"t":true,"f":false,"z":null,"list":[1,[2,3],{"k":"v"}],"empty":{},"none":[]})");
+			auto data = krystal::makeSnapshot(doc);
+			krystal::Snapshot snap { data };
+			
+			if (checkTrue(snap.isObject()) && checkEqual(snap.size(), 9)) {
+				checkEqual(snap["name"].string(), "a name too long to be inline");
+				checkEqual(snap["short"].stringRef(), "abc");
+				checkEqual(snap["n"].number(), -1.5);
+				checkTrue(snap["t"].boolean());
+				checkFalse(snap["f"].boolean());
+				checkTrue(snap["z"].isNull());
+				checkEqual(snap["list"].size(), 3);
+				checkEqual(snap["list"][1][1].numberAs<int>(), 3);
+				checkEqual(snap["list"][2]["k"].string(), "v");
+				checkEqual(snap["empty"].size(), 0);
+				checkFalse(snap["empty"].contains("k"));
+				checkEqual(snap["none"].size(), 0);
+				checkTrue(snap.contains("list"));
+				checkFalse(snap.contains("lis"));
+				checkFalse(snap.contains("lists"));
+			}
+			
+			bool threw = false;
+			try { snap["missing"]; } catch (std::out_of_range&) { threw = true; }
+			checkTrue(threw);
+		});
+		
+		test("snapshot members should iterate in the order of the document", []{
+			auto doc = krystal::parseString(R"({"zz":1,"a long key of some length":2,"m":3,"b":4,"y":5,"c":6,"x":7,"d":8,"w":9,"e":10})", krystal::ObjectOrder::InsertionOrder);
+			auto data = krystal::makeSnapshot(doc);
+			krystal::Snapshot snap { data };
+			
+			std::string keys;
+			for (auto item : snap.items()) {
+				keys += item.key.str() + ",";
+				checkEqual(item.value.numberAs<size_t>(), item.index + 1);
+				checkEqual(&snap[item.key.str()], &item.value);
+			}
+			checkEqual(keys, "zz,a long key of some length,m,b,y,c,x,d,w,e,");
+			
+			auto shaped = krystal::parseString(R"([{"b":1,"a":2},{"b":3,"a":4}])");
+			auto shapedData = krystal::makeSnapshot(shaped);
+			krystal::Snapshot shapedSnap { shapedData };
+			std::string shapedKeys;
+			for (auto key : shapedSnap[1].keys())
+				shapedKeys += key.str();
+			checkEqual(shapedKeys, "ba");
+			checkEqual(shapedSnap[1]["a"].number(), 4);
+		});
+		
+		test("snapshots should be readable at any address", []{
+			auto base = krystal::parseString(R"({"config":{"hosts":["a host name that is long","b"]}})");
+			auto clone = base.clone();
+			clone.root()["config"].emplace("port", clone.make(8080));
+			
+			auto data = krystal::makeSnapshot(clone);
+			std::vector<uint64_t> moved((data.size() + 7) / 8);
+			std::memcpy(moved.data(), data.data(), data.size());
+			data.assign(data.size(), '\0');
+			
+			krystal::Snapshot snap { moved.data(), moved.size() * 8 };
+			checkEqual(snap["config"]["hosts"][0].string(), "a host name that is long");
+			checkEqual(snap["config"]["port"].number(), 8080);
+		});
+		
+		test("invalid snapshot data should be rejected", []{
+			auto data = krystal::makeSnapshot(krystal::parseString("[1,2,3]"));
+			
+			auto rejects = [](const std::string& bad) {
+				try { krystal::Snapshot snap { bad }; } catch (std::runtime_error&) { return true; }
+				return false;
+			};
+			
+			checkFalse(rejects(data));
+			checkTrue(rejects(data.substr(0, data.size() - 8)));
+			checkTrue(rejects(data.substr(0, 8)));
+			checkTrue(rejects("JSON" + data.substr(4)));
+		});
+		
+#ifdef KRYSTAL_HAS_MMAP
+		test("mapped snapshot files should be queried in place", []{
+			auto doc = krystal::parseString(readTextFile("perftests/medium-large.json"));
+			std::string path { "snapshot_test.krys" };
+			{
+				std::ofstream file { path, std::ios::binary };
+				auto data = krystal::makeSnapshot(doc);
+				file.write(data.data(), static_cast<std::streamsize>(data.size()));
+			}
+			
+			{
+				krystal::MappedSnapshot mapped { path };
+				if (checkEqual(mapped.size(), doc.size())) {
+					checkEqual(mapped[10]["text"].string(), doc[10]["text"].string());
+					checkEqual(mapped[doc.size() - 1]["x"].number(), doc[doc.size() - 1]["x"].number());
+				}
+			}
+			std::remove(path.c_str());
+		});
+#endif
+	});
+}
@@ -0,0 +1,97 @@
+// test_stream.hpp - part of krystal_test
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+void test_stream() {
+	group("array streams", []{
+		test("elements of a top-level array should be read one at a time", []{
+			std::string json { R"( [ 1, {"a": [2, 3]}, "four", [], null ] )" };
+			auto stream = krystal::streamArray(json);
+			std::vector<krystal::ValueKind> kinds;
+			
+			for (auto& elem : stream)
+				kinds.push_back(elem.root().type());
+			
+			checkFalse(bool(stream.error()));
+			checkEqual(stream.count(), 5);
+			checkTrue(kinds == (std::vector<krystal::ValueKind>{ ValueKind::Number, ValueKind::Object, ValueKind::String, ValueKind::Array, ValueKind::Null }));
+		});
+		
+		test("empty arrays should have no elements", []{
+			std::string json { " [ ]\n" };
+			auto stream = krystal::streamArray(json);
+			checkTrue(stream.begin() == stream.end());
+			checkFalse(bool(stream.error()));
+		});
+		
+		test("errors should stop the stream and be reported like parse() does", []{
+			auto errorOf = [](const std::string& json) {
+				auto stream = krystal::streamArray(json);
+				while (stream.next())
+					;
+				return stream.error();
+			};
+			
+			checkTrue(errorOf(R"({"a": 1})").code == ErrorCode::ExpectedContainer);
+			checkTrue(errorOf("[1, 2] 3").code == ErrorCode::TrailingData);
+			checkTrue(errorOf("[1, [2, 3]").code == ErrorCode::UnexpectedEnd);
+			
+			std::string json { "[1,\n 2\n 3]" };
+			krystal::ParseError expected;
+			krystal::parseString(json, expected);
+			auto error = errorOf(json);
+			checkTrue(error.code == ErrorCode::ExpectedCommaOrBracket);
+			checkEqual(error.offset, expected.offset);
+			checkEqual(error.line, expected.line);
+			checkEqual(error.column, expected.column);
+		});
+		
+		test("element documents should reuse their memory and can be cloned to keep them", []{
+			auto json = recordsJSON(2000);
+			auto doc = krystal::parseString(json);
+			auto stream = krystal::streamArray(json);
+			size_t maxMemory = 0;
+			std::vector<decltype(stream)::DocumentClass> kept;
+			
+			for (auto& elem : stream) {
+				auto index = stream.count() - 1;
+				checkTrue(sameValues(elem.root(), doc[index]));
+				maxMemory = std::max(maxMemory, elem.memoryUsed());
+				if (index % 500 == 0)
+					kept.push_back(elem.clone());
+			}
+			
+			checkEqual(stream.count(), 2000);
+			checkTrue(maxMemory < 2048);
+			if (checkEqual(kept.size(), 4))
+				checkEqual(kept[3]["id"].number(), 1500);
+		});
+		
+		test("files should be streamed through a buffer or mapped into memory", []{
+			auto json = recordsJSON(500);
+			auto doc = krystal::parseString(json);
+			std::string path { "stream_test.json" };
+			{
+				std::ofstream file { path, std::ios::binary };
+				file << json;
+			}
+			
+			{
+				krystal::FileSource file { path, 61 }; // odd size so tokens straddle buffers
+				size_t index = 0;
+				for (auto& elem : krystal::streamArray(file))
+					checkTrue(sameValues(elem.root(), doc[index++]));
+				checkEqual(index, 500);
+			}
+#ifdef KRYSTAL_HAS_MMAP
+			{
+				krystal::MappedFile file { path };
+				size_t index = 0;
+				for (auto& elem : krystal::streamArray(file))
+					checkTrue(sameValues(elem.root(), doc[index++]));
+				checkEqual(index, 500);
+			}
+#endif
+			std::remove(path.c_str());
+		});
+	});
+}
@@ -0,0 +1,175 @@
+// test_tape.hpp - part of krystal_test
+// (c) 2013-6 by Arthur Langereis (@zenmumbler)
+
+// writes each event it gets as a short token, stopping at the limit'th event
+struct EventLog final {
+	std::string log;
+	int events = 0, limit = -1;
+	krystal::ErrorCode code = krystal::ErrorCode::None;
+	
+	bool add(const std::string& token) {
+		log += token + ' ';
+		return ++events != limit;
+	}
+	
+	bool nullValue() { return add("n"); }
+	bool falseValue() { return add("f"); }
+	bool trueValue() { return add("t"); }
+	bool numberValue(double num) { return add(std::to_string(num)); }
+	bool stringValue(krystal::StringRef str, bool hasEscapes) { return add((hasEscapes ? "\\\"" : "\"") + str.str() + '"'); }
+	bool arrayBegin() { return add("["); }
+	bool arrayEnd() { return add("]"); }
+	bool objectBegin() { return add("{"); }
+	bool objectEnd() { return add("}"); }
+	void error(const krystal::ParseError& err) { code = err.code; }
+};
+
+
+void test_tape() {
+	group("event tape", []{
+		test("a replayed tape should give the same events as a parse", []{
+			std::string json = R"({"a": [1, -2.5, true, false, null], "b\n": "xé", "c": {"d": [], "e": {}}})";
+			EventLog parsed, replayed;
+			krystal::BasicReader<EventLog> reader { parsed };
+			krystal::ReaderStream<std::string::const_iterator> stream { json.cbegin(), json.cend() };
+			checkTrue(reader.parseDocument(stream));
+			
+			krystal::EventTape tape;
+			checkTrue(krystal::record(json, tape));
+			checkTrue(tape.complete());
+			checkEqual(tape.size(), parsed.events);
+			checkTrue(tape.replay(replayed));
+			checkEqual(replayed.log, parsed.log);
+			checkTrue(replayed.code == krystal::ErrorCode::None);
+			
+			// a tape can be replayed any number of times
+			replayed.log.clear();
+			checkTrue(tape.replay(replayed));
+			checkEqual(replayed.log, parsed.log);
+		});
+		
+		test("plain strings should be referenced in the input, others copied", []{
+			std::string json = R"(["plain", "esc\"aped", {"key": ""}])";
+			krystal::EventTape tape;
+			checkTrue(krystal::record(json, tape));
+			
+			checkTrue(tape.string(1).data() == json.data() + 2);
+			checkEqual(tape.string(2).str(), "esc\"aped");
+			checkTrue(tape.hasEscapes(2));
+			checkTrue(tape.string(2).data() < json.data() || tape.string(2).data() >= json.data() + json.size());
+			checkEqual(tape.string(4).str(), "key");
+			checkEqual(tape.string(5).size(), 0);
+			
+			// char by char input has no stable chars to point to
+			std::istringstream stream { json };
+			stream >> std::noskipws;
+			krystal::ParseError error;
+			krystal::EventTape copied;
+			checkTrue(krystal::record(std::istream_iterator<char>{stream}, {}, copied, error));
+			for (size_t ix = 0; ix < copied.size(); ++ix)
+				if (copied.event(ix) == krystal::TapeEvent::String)
+					checkEqual(copied.string(ix).str(), tape.string(ix).str());
+			checkTrue(copied.string(1).data() != json.data() + 2);
+		});
+		
+		test("next(), member() and element() should step over whole values", []{
+			std::string json = R"({"skip": [[1, 2], {"x": [3]}], "list": [10, {"y": 1}, 30], "last": "z"})";
+			krystal::EventTape tape;
+			checkTrue(krystal::record(json, tape));
+			
+			checkEqual(tape.next(0), tape.size());
+			checkTrue(tape.event(2) == krystal::TapeEvent::ArrayBegin);
+			checkTrue(tape.event(tape.next(2)) == krystal::TapeEvent::String);
+			checkEqual(tape.string(tape.next(2)).str(), "list");
+			
+			auto list = tape.member(0, "list");
+			checkTrue(tape.event(list) == krystal::TapeEvent::ArrayBegin);
+			checkEqual(tape.number(tape.element(list, 0)), 10);
+			checkEqual(tape.number(tape.element(list, 2)), 30);
+			checkEqual(tape.number(tape.member(tape.element(list, 1), "y")), 1);
+			checkEqual(tape.string(tape.member(0, "last")).str(), "z");
+			checkTrue(tape.element(list, 3) == krystal::EventTape::NotFound);
+			checkTrue(tape.member(0, "x") == krystal::EventTape::NotFound);
+			checkTrue(tape.member(list, "y") == krystal::EventTape::NotFound);
+			
+			EventLog sub;
+			checkTrue(tape.replayValue(sub, tape.element(list, 1)));
+			checkEqual(sub.log, "{ \"y\" 1.000000 } ");
+			auto doc = krystal::parseTape(tape, tape.member(0, "skip"));
+			checkEqual(doc.size(), 2);
+			checkEqual(doc[1]["x"][0].number(), 3);
+		});
+		
+		test("values that are not on the tape should give an error and a Null document", []{
+			std::string json = R"({"config": {"a": 1}, "list": [1]})";
+			krystal::EventTape tape;
+			checkTrue(krystal::record(json, tape));
+			
+			EventLog missing;
+			checkFalse(tape.replayValue(missing, tape.member(0, "absent")));
+			checkTrue(missing.code == krystal::ErrorCode::ExpectedValue);
+			checkEqual(missing.events, 0);
+			checkFalse(tape.replayValue(missing, tape.size()));
+			
+			checkTrue(krystal::parseTape(tape, tape.member(0, "absent")).isNull());
+			checkTrue(krystal::parseTape(tape, tape.element(tape.member(0, "list"), 1)).isNull());
+			checkEqual(krystal::parseTape(tape, tape.member(0, "config"))["a"].number(), 1);
+		});
+		
+		test("documents built from a tape should equal parsed ones", []{
+			for (auto name : { "medium-large", "rapidjson-insane" }) {
+				auto json = readTextFile(std::string{"perftests/"} + name + ".json");
+				krystal::EventTape tape;
+				checkTrue(krystal::record(json, tape));
+				checkTrue(sameValues(krystal::parseTape(tape).root(), krystal::parseString(json).root()));
+				
+				auto ordered = krystal::parseTape(tape, krystal::ObjectOrder::InsertionOrder);
+				checkTrue(sameValues(ordered.root(), krystal::parseString(json, krystal::ObjectOrder::InsertionOrder).root()));
+			}
+		});
+		
+		test("several consumers should run off one recording", []{
+			auto json = recordsJSON(100);
+			krystal::EventTape tape;
+			checkTrue(krystal::record(json, tape));
+			
+			krystal::SchemaViolation violation;
+			auto schema = krystal::parseSchema(R"({"items": {"required": ["id"], "properties": {"flag": {"type": "boolean"}}}})");
+			krystal::SchemaValidator<> validator { schema };
+			checkTrue(tape.replay(validator));
+			checkFalse(bool(validator.violation()));
+			
+			auto strict = krystal::parseSchema(R"({"items": {"properties": {"flag": {"type": "number"}}}})");
+			krystal::SchemaValidator<> failing { strict };
+			checkFalse(tape.replay(failing));
+			checkEqual(failing.violation().path, "/0/flag");
+			
+			checkEqual(krystal::parseTape(tape).size(), 100);
+		});
+		
+		test("errors should be recorded and passed on, aborts reported to the delegate", []{
+			std::string json = R"({"a": [1, 2}, "b": 3})";
+			krystal::EventTape tape;
+			checkFalse(krystal::record(json, tape));
+			checkFalse(tape.complete());
+			checkTrue(tape.error().code == krystal::ErrorCode::ExpectedCommaOrBracket);
+			
+			EventLog log;
+			checkFalse(tape.replay(log));
+			checkEqual(log.log, "{ \"a\" [ 1.000000 2.000000 ");
+			checkTrue(log.code == krystal::ErrorCode::ExpectedCommaOrBracket);
+			checkTrue(krystal::parseTape(tape).isNull());
+			
+			checkTrue(krystal::record("[1, [2], 3]", tape));
+			EventLog stopping;
+			stopping.limit = 3;
+			checkFalse(tape.replay(stopping));
+			checkEqual(stopping.events, 3);
+			checkTrue(stopping.code == krystal::ErrorCode::Aborted);
+			
+			tape.clear();
+			checkTrue(tape.empty());
+			checkTrue(krystal::parseTape(tape).isNull());
+		});
+	});
+}
@@ -48,6 +48,38 @@ void test_value() {
 				checkEqual(b1_val.boolean(), b1);
 				checkEqual(b2_val.boolean(), b2);
 			});
+			
+			test("strings on both sides of the inline length should keep their chars", []{
+				for (auto str : { "", "1234567", "12345678", "123456789", "1234567890abcdef" }) {
+					auto val = Value{ str };
+					checkEqual(val.stringRef().size(), std::strlen(str));
+					checkEqual(val.string(), str);
+					
+					auto moved = std::move(val);
+					checkEqual(moved.string(), str);
+					checkEqual(Value::copyOf(moved).string(), str);
+				}
+			});
+			
+			test("strings of 4 GiB or more should throw before reading their chars", []{
+				if (sizeof(size_t) <= sizeof(uint32_t))
+					return;
+				
+				auto threw = false;
+				try {
+					Value val { StringRef{ "tiny", size_t{ std::numeric_limits<uint32_t>::max() } + 1 } };
+				}
+				catch (const std::length_error&) {
+					threw = true;
+				}
+				checkTrue(threw);
+			});
+		});
+		
+		group("layout", []{
+			test("values should be 16 bytes", []{
+				checkEqual(sizeof(Value), 16);
+			});
 		});
 		
 		group("moves", []{
@@ -103,6 +135,47 @@ void test_value() {
 				checkEqual(dest["important"].string(), "don't forget");
 				checkEqual(dest["monkeys"].numberAs<int>(), 12);
 			});
+			
+			test("moving should keep the data of every storage kind", []{
+				auto ordered = Value{ krystal::ObjectOrder::InsertionOrder };
+				ordered.emplace("b", 1);
+				ordered.emplace("a", 2);
+				
+				auto moved = std::move(ordered);
+				checkEqual(ordered.type(), ValueKind::Null);
+				checkEqual(moved.size(), 2);
+				checkEqual((*moved.keys().begin()).str(), "b");
+				
+				auto assigned = Value{ "a string too long to be stored inline" };
+				assigned = std::move(moved);
+				checkEqual(moved.type(), ValueKind::Null);
+				checkEqual(assigned["a"].number(), 2);
+				
+				auto doc = krystal::parseString(R"({"shaped":{"x":1,"y":2},"text":"a string too long to be stored inline","short":"inline"})");
+				using DocValue = decltype(doc)::ValueType;
+				
+				DocValue shaped = std::move(doc.root()["shaped"]);
+				checkEqual(doc["shaped"].type(), ValueKind::Null);
+				checkEqual(shaped["y"].number(), 2);
+				
+				DocValue text;
+				text = std::move(doc.root()["text"]);
+				checkEqual(text.string(), "a string too long to be stored inline");
+				
+				DocValue inlined = std::move(doc.root()["short"]);
+				checkEqual(inlined.string(), "inline");
+				
+				doc.root()["text"] = std::move(text);
+				auto clone = doc.clone();
+				DocValue shared = std::move(clone.root()["text"]);
+				checkEqual(clone["text"].type(), ValueKind::Null);
+				checkEqual(shared.string(), "a string too long to be stored inline");
+				checkTrue(shared.stringRef().data() == doc["text"].stringRef().data());
+				
+				DocValue reassigned = doc.make(1);
+				reassigned = std::move(shared);
+				checkEqual(reassigned.string(), "a string too long to be stored inline");
+			});
 		});
 		
 		group("type tests", []{
@@ -169,6 +242,27 @@ void test_value() {
 				}
 				checkEqual(count, arr.size());
 			});
+			
+			test("items() and values() should yield indexes and value references", []{
+				auto arr = Value{ ValueKind::Array };
+				arr.emplace_back(0);
+				arr.emplace_back(100);
+				arr.emplace_back(200);
+				
+				size_t count = 0;
+				for (auto item : arr.items()) {
+					checkTrue(item.key.empty());
+					checkEqual(item.index, count);
+					checkTrue(&item.value == &arr[count]);
+					++count;
+				}
+				checkEqual(count, arr.size());
+				
+				int sum = 0;
+				for (const auto& val : arr.values())
+					sum += val.numberAs<int>();
+				checkEqual(sum, 300);
+			});
 		});
 
 		group("objects", []{
@@ -188,6 +282,98 @@ void test_value() {
 				}
 				checkEqual(obj.size(), count);
 			});
+			
+			test("keys() and items() should yield key refs and value references", []{
+				auto obj = Value{ ValueKind::Object };
+				obj.emplace("key0", 0);
+				obj.emplace("key1", 1);
+				obj.emplace("a much longer key than fits inline", 2);
+				
+				size_t count = 0;
+				for (auto item : obj.items()) {
+					checkEqual(item.index, count);
+					checkTrue(&item.value == &obj[item.key.str()]);
+					++count;
+				}
+				checkEqual(count, obj.size());
+				
+				int found = 0;
+				for (auto key : obj.keys())
+					found += key == "key0" || key == "key1" || key == krystal::StringRef("a much longer key than fits inline");
+				checkEqual(found, 3);
+			});
+			
+			test("keys() should throw for non-object values", []{
+				auto arr = Value{ ValueKind::Array };
+				bool threw = false;
+				try { arr.keys(); } catch (std::runtime_error&) { threw = true; }
+				checkTrue(threw);
+			});
+			
+			test("insertion ordered objects should iterate in insertion order", []{
+				auto obj = Value{ krystal::ObjectOrder::InsertionOrder };
+				checkTrue(obj.isObject());
+				
+				for (int ix = 19; ix >= 0; --ix)
+					obj.emplace("key" + std::to_string(ix), ix);
+				obj.emplace("key7", 700);
+				
+				checkEqual(obj.size(), 20);
+				checkEqual(obj["key7"].numberAs<int>(), 700);
+				
+				int expected = 19;
+				for (auto kv : obj) {
+					checkEqual(kv.first.string(), "key" + std::to_string(expected));
+					--expected;
+				}
+				checkEqual(expected, -1);
+			});
+		});
+		
+		group("copies", []{
+			test("copyOf should deep copy heap values", []{
+				auto obj = Value{ krystal::ObjectOrder::InsertionOrder };
+				obj.emplace("name", "a string too long to be stored inline");
+				auto& list = obj.emplace("list", ValueKind::Array);
+				list.emplace_back(1);
+				list.emplace_back(Value{ ValueKind::Object }).emplace("deep", true);
+				
+				auto copy = Value::copyOf(obj);
+				obj["list"].erase(size_t{0});
+				obj.emplace("name", "short");
+				
+				checkEqual(copy.size(), 2);
+				checkEqual(copy["name"].string(), "a string too long to be stored inline");
+				checkEqual(copy["list"].size(), 2);
+				checkEqual(copy["list"][0].number(), 1);
+				checkTrue(copy["list"][1]["deep"].boolean());
+				checkEqual((*copy.keys().begin()).str(), "name");
+			});
+			
+			test("copyOf should copy values of every storage kind", []{
+				auto base = krystal::parseString(R"({"shaped":{"x":1,"y":[true,null]},"text":"a string too long to be stored inline","short":"inline","num":4.5})");
+				auto clone = base.clone();
+				
+				for (auto doc : { &base, &clone }) {
+					auto shaped = Value::copyOf((*doc)["shaped"]);
+					checkEqual(shaped.size(), 2);
+					checkEqual(shaped["x"].number(), 1);
+					checkTrue(shaped["y"][0].boolean());
+					checkTrue(shaped["y"][1].isNull());
+					
+					checkEqual(Value::copyOf((*doc)["text"]).string(), "a string too long to be stored inline");
+					checkEqual(Value::copyOf((*doc)["short"]).string(), "inline");
+					checkEqual(Value::copyOf((*doc)["num"]).number(), 4.5);
+				}
+				
+				auto ordered = Value{ krystal::ObjectOrder::InsertionOrder };
+				ordered.emplace("b", Value::copyOf(clone["shaped"]));
+				ordered.emplace("a", "short");
+				auto copy = Value::copyOf(ordered);
+				checkEqual((*copy.keys().begin()).str(), "b");
+				checkEqual(copy["b"]["y"].size(), 2);
+				checkEqual(copy["a"].string(), "short");
+			});
 		});
 	});
 }
@@ -6,16 +6,22 @@
 
 #include "alloc.hpp"
 
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <iostream>
+#include <iterator>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 namespace krystal {
 
 
-enum class ValueKind {
+enum class ValueKind : uint8_t {
 	Null,
 	False,
 	True,
@@ -26,9 +32,125 @@ enum class ValueKind {
 };
 
 
+// Objects built as Unordered are hash maps, iterated in hash order.
+// InsertionOrder objects keep their members in a vector in the order
+// they were added and iterate in that order.
+enum class ObjectOrder : uint8_t {
+	Unordered,
+	InsertionOrder
+};
+
+
 template <template<typename T> class Allocator>
 class Iterator;
 
+template <template<typename T> class Allocator, typename Get>
+class View;
+
+template <template<typename T> class Allocator>
+struct GetItem;
+template <template<typename T> class Allocator>
+struct GetKey;
+template <template<typename T> class Allocator>
+struct GetValue;
+
+template <typename ValueClass>
+class Document;
+
+class DocumentBuilder;
+
+
+// A StringRef points at the chars of a string owned by someone else, it is
+// what the views below yield for keys so that iterating allocates nothing.
+// The chars are not null-terminated.
+class StringRef {
+	const char* data_ = nullptr;
+	size_t size_ = 0;
+	
+public:
+	constexpr StringRef() {}
+	constexpr StringRef(const char* data, size_t size) : data_{data}, size_{size} {}
+	StringRef(const char* str) : data_{str}, size_{std::strlen(str)} {}
+	StringRef(const std::string& str) : data_{str.data()}, size_{str.size()} {}
+	
+	constexpr const char* data() const { return data_; }
+	constexpr size_t size() const { return size_; }
+	constexpr size_t length() const { return size_; }
+	constexpr bool empty() const { return size_ == 0; }
+	
+	constexpr const char* begin() const { return data_; }
+	constexpr const char* end() const { return data_ + size_; }
+	constexpr char operator[](size_t index) const { return data_[index]; }
+	
+	std::string str() const { return { data_, size_ }; }
+	
+	friend bool operator ==(StringRef a, StringRef b) {
+		return a.size_ == b.size_ && (a.size_ == 0 || std::memcmp(a.data_, b.data_, a.size_) == 0);
+	}
+	friend bool operator !=(StringRef a, StringRef b) { return !(a == b); }
+	
+	friend std::ostream& operator<<(std::ostream& os, StringRef ref) {
+		return os.write(ref.data_, static_cast<std::streamsize>(ref.size_));
+	}
+};
+
+
+// A Shape is the ordered list of keys shared by objects that have the exact
+// same members in the same order, typically the records of a large array.
+// Objects with a shape store only their values, in key order, and look up
+// members by index into the shape.
+class Shape {
+	std::vector<std::string> keys_;
+	std::unordered_map<std::string, uint32_t> index_;
+	
+	// small shapes are scanned linearly, which beats hashing the key
+	static constexpr size_t IndexThreshold = 8;
+	
+public:
+	static constexpr size_t npos = ~size_t{0};
+	
+	Shape() {}
+	
+	template <typename InputIterator>
+	Shape(InputIterator first, InputIterator last)
+	: keys_(first, last)
+	{
+		if (keys_.size() > IndexThreshold) {
+			index_.reserve(keys_.size());
+			for (uint32_t ix = 0; ix < keys_.size(); ++ix)
+				index_.emplace(keys_[ix], ix);
+		}
+	}
+	
+	size_t size() const { return keys_.size(); }
+	const std::string& key(size_t index) const { return keys_[index]; }
+	const std::vector<std::string>& keys() const { return keys_; }
+	
+	size_t indexOf(const std::string& key) const {
+		if (keys_.size() > IndexThreshold) {
+			auto it = index_.find(key);
+			return it == index_.end() ? npos : it->second;
+		}
+		
+		for (size_t ix = 0; ix < keys_.size(); ++ix)
+			if (keys_[ix] == key)
+				return ix;
+		return npos;
+	}
+	
+	// a shape can only be used if all of its keys are unique
+	bool hasUniqueKeys() const {
+		if (keys_.size() > IndexThreshold)
+			return index_.size() == keys_.size();
+		
+		for (size_t ix = 1; ix < keys_.size(); ++ix)
+			for (size_t jx = 0; jx < ix; ++jx)
+				if (keys_[ix] == keys_[jx])
+					return false;
+		return true;
+	}
+};
+
 
 template <template<typename T> class Allocator = std::allocator>
 class BasicValue {
@@ -37,7 +159,6 @@ class BasicValue {
 	using ValueType = BasicValue<Allocator>;
 	
 	using StringAlloc = AllocType<char>;
-	using StringData = std::basic_string<char, std::char_traits<char>, StringAlloc>;
 	
 	using ArrayAlloc = AllocType<ValueType>;
 	using ArrayData = std::vector<ValueType, ArrayAlloc>;
@@ -45,170 +166,397 @@ class BasicValue {
 	using ObjectAlloc = AllocType<std::pair<const std::string, ValueType>>;
 	using ObjectData = std::unordered_map<std::string, ValueType, std::hash<std::string>, std::equal_to<std::string>, ObjectAlloc>;
 	
-	using ArrayIterator = typename ArrayData::const_iterator;
-	using ObjectIterator = typename ObjectData::const_iterator;
-	
+	struct ShapedData;
+	struct OrderedData;
 	
 	friend class Iterator<Allocator>;
+	friend class DocumentBuilder;
+	friend class Document<ValueType>;
+	
+	// Values are 16 bytes: a small header followed by an 8 byte payload.
+	// Numbers and strings of up to 8 chars are stored inline, longer strings
+	// and all containers are allocated out-of-line with the value's allocator.
+	enum Storage : uint8_t {
+		Direct,       // number, bool, null, external string or keyed object
+		InlineString, // string chars are stored in inline_
+		ShapedObject, // object stores values in key order of a shared Shape
+		OrderedObject, // object stores key-value entries in insertion order
+		Shared        // long string or container owned by another document
+	};
+	
+	static constexpr size_t MaxInlineString = 8;
 	
 	ValueKind kind_;
+	Storage storage_ = Direct;
+	uint32_t size_ = 0; // length of string values
 	union {
-		StringData str_;
-		ArrayData arr_;
-		ObjectData obj_;
 		double num_;
+		char inline_[MaxInlineString];
+		char* chars_;
+		ArrayData* arr_;
+		ObjectData* obj_;
+		ShapedData* shaped_;
+		OrderedData* ordered_;
+		const BasicValue* ref_; // Shared values
 	};
 	
-public:
-	BasicValue() : BasicValue(ValueKind::Null) {}
-	BasicValue(const BasicValue& rhs) = delete;
-	BasicValue<Allocator>& operator=(const BasicValue<Allocator>& rhs) = delete;
+	template <typename T, typename... Args>
+	static T* create(AllocType<T> alloc, Args&&... args) {
+		auto ptr = alloc.allocate(1);
+		new (ptr) T(std::forward<Args>(args)...);
+		return ptr;
+	}
 	
-	BasicValue(BasicValue<Allocator>&& rhs) noexcept
-	: kind_{rhs.kind_}
-	{
+	template <typename T, typename ContainerAlloc>
+	static void destroy(T* ptr, const ContainerAlloc& containerAlloc) {
+		AllocType<T> alloc { containerAlloc };
+		ptr->~T();
+		alloc.deallocate(ptr, 1);
+	}
+	
+	// arena allocators free all memory at once, no need to return string blocks
+	void releaseChars(std::true_type) {}
+	void releaseChars(std::false_type) { StringAlloc{}.deallocate(chars_, size_); }
+	
+	template <typename StringAllocArg>
+	void initString(const char* data, size_t length, StringAllocArg&& alloc) {
+		if (length > std::numeric_limits<uint32_t>::max())
+			throw std::length_error("Trying to make a string value of 4 GiB or more.");
+		size_ = static_cast<uint32_t>(length);
+		if (length <= MaxInlineString) {
+			storage_ = InlineString;
+			std::memcpy(inline_, data, length);
+		}
+		else {
+			chars_ = StringAlloc(std::forward<StringAllocArg>(alloc)).allocate(length);
+			std::memcpy(chars_, data, length);
+		}
+	}
+	
+	template <typename AllocArg>
+	void initContainer(AllocArg&& args) {
 		switch(kind_) {
 			case ValueKind::String:
-				new (&str_) decltype(str_){std::move(rhs.str_)};
+				storage_ = InlineString;
+				std::memset(inline_, 0, sizeof(inline_));
 				break;
 			case ValueKind::Array:
-				new (&arr_) decltype(arr_){std::move(rhs.arr_)};
+				arr_ = create<ArrayData>(AllocType<ArrayData>(args), ArrayAlloc(args));
 				break;
 			case ValueKind::Object:
-				new (&obj_) decltype(obj_){std::move(rhs.obj_)};
+				obj_ = create<ObjectData>(AllocType<ObjectData>(args), ObjectAlloc(args));
 				break;
-			case ValueKind::Number:
-				num_ = rhs.num_;
+			default:
+				num_ = 0.0;
+				break;
+		}
+	}
+	
+	void release() {
+		if (isShared())
+			return;
+		
+		switch(kind_) {
+			case ValueKind::String:
+				if (storage_ != InlineString)
+					releaseChars(is_arena_allocator<StringAlloc>{});
+				break;
+			case ValueKind::Array:
+				destroy(arr_, arr_->get_allocator());
+				break;
+			case ValueKind::Object:
+				if (isShaped())
+					destroy(shaped_, shaped_->values.get_allocator());
+				else if (isOrdered())
+					destroy(ordered_, ordered_->entries.get_allocator());
+				else
+					destroy(obj_, obj_->get_allocator());
 				break;
 			default:
 				break;
 		}
+	}
+	
+	void take(BasicValue<Allocator>& rhs) {
+		kind_ = rhs.kind_;
+		storage_ = rhs.storage_;
+		size_ = rhs.size_;
+		std::memcpy(inline_, rhs.inline_, sizeof(inline_));
 		
-		// -- destruct and reset rhs's data
-		rhs.~BasicValue();
 		rhs.kind_ = ValueKind::Null;
+		rhs.storage_ = Direct;
 	}
 	
-	BasicValue<Allocator>& operator=(BasicValue<Allocator>&& rhs) noexcept {
-		if (kind_ == rhs.kind_) {
-			// -- no need for con/destructors, straight up move assignment
-			switch(kind_) {
-				case ValueKind::String:
-					str_ = std::move(rhs.str_);
-					break;
-				case ValueKind::Array:
-					arr_ = std::move(rhs.arr_);
-					break;
-				case ValueKind::Object:
-					obj_ = std::move(rhs.obj_);
-					break;
-				case ValueKind::Number:
-					num_ = rhs.num_;
-					break;
-				default:
-					break;
-			}
+	const char* chars() const {
+		if (storage_ == InlineString)
+			return inline_;
+		return isShared() ? ref_->chars() : chars_;
+	}
+	
+	bool isShaped() const { return storage_ == ShapedObject; }
+	bool isOrdered() const { return storage_ == OrderedObject; }
+	bool isShared() const { return storage_ == Shared; }
+	const Shape* shape() const { return shaped_->shape; }
+	
+	// the dense value storage of arrays and shaped objects
+	ArrayData& elements() { return isShaped() ? shaped_->values : *arr_; }
+	const ArrayData& elements() const { return isShaped() ? shaped_->values : *arr_; }
+	
+	// shaped object constructor, only used by DocumentBuilder
+	BasicValue(const Shape* shape, const Lake* args)
+	: kind_{ValueKind::Object}, storage_{ShapedObject}
+	{
+		shaped_ = create<ShapedData>(AllocType<ShapedData>(args), shape, ArrayAlloc(args));
+	}
+	
+	void setShape(const Shape* shape) { shaped_->shape = shape; }
+	
+	// convert a shaped object into an ordered object, used when
+	// a member is added that is not part of the shape
+	void unshape() {
+		auto shaped = shaped_;
+		auto& values = shaped->values;
+		
+		ordered_ = create<OrderedData>(AllocType<OrderedData>(values.get_allocator()), values.get_allocator());
+		ordered_->entries.reserve(values.size() + 1);
+		for (size_t ix = 0; ix < values.size(); ++ix) {
+			auto& key = shaped->shape->key(ix);
+			ordered_->append(key.data(), key.size(), std::move(values[ix]));
 		}
-		else {
-			this->~BasicValue();
-			kind_ = rhs.kind_;
-			switch(kind_) {
-				case ValueKind::String:
-					new (&str_) decltype(str_){std::move(rhs.str_)};
-					break;
-				case ValueKind::Array:
-					new (&arr_) decltype(arr_){std::move(rhs.arr_)};
-					break;
-				case ValueKind::Object:
-					new (&obj_) decltype(obj_){std::move(rhs.obj_)};
-					break;
-				case ValueKind::Number:
-					num_ = rhs.num_;
-					break;
-				default:
-					break;
-			}
+		
+		storage_ = OrderedObject;
+		destroy(shaped, values.get_allocator());
+	}
+	
+	template <typename AllocArg>
+	void initObject(ObjectOrder order, AllocArg&& args) {
+		if (order == ObjectOrder::InsertionOrder) {
+			storage_ = OrderedObject;
+			ordered_ = create<OrderedData>(AllocType<OrderedData>(args), args);
+		}
+		else
+			initContainer(args);
+	}
+	
+	// Documents cloned from another document share its values until they
+	// are modified. A shared value refers to the original, except for
+	// scalars and inline strings, which are copied as they are.
+	struct ShareTag {};
+	
+	BasicValue(ShareTag, const BasicValue<Allocator>& target)
+	: kind_{target.kind_}, storage_{target.storage_}, size_{target.size_}
+	{
+		std::memcpy(inline_, target.inline_, sizeof(inline_));
+		
+		bool owning = storage_ == ShapedObject || storage_ == OrderedObject
+			|| (storage_ == Direct && (kind_ == ValueKind::String || isContainer()));
+		if (owning) {
+			storage_ = Shared;
+			ref_ = &target;
 		}
+	}
+	
+	static void shareAll(const ArrayData& from, ArrayData& to) {
+		to.reserve(from.size());
+		for (auto& value : from)
+			to.push_back(ValueType{ ShareTag{}, value });
+	}
+	
+	// replace a shared container by a copy of its members allocated with
+	// alloc, the members themselves are shared with the original
+	template <typename AllocArg>
+	void unshare(const AllocArg& alloc) {
+		auto& src = *ref_;
+		storage_ = src.storage_;
 		
-		// -- destruct and reset rhs's data
-		rhs.~BasicValue();
-		rhs.kind_ = ValueKind::Null;
+		if (src.isShaped()) {
+			shaped_ = create<ShapedData>(AllocType<ShapedData>(alloc), src.shape(), ArrayAlloc(alloc));
+			shareAll(src.shaped_->values, shaped_->values);
+		}
+		else if (src.isOrdered()) {
+			ordered_ = create<OrderedData>(AllocType<OrderedData>(alloc), alloc);
+			ordered_->entries.reserve(src.ordered_->entries.size());
+			for (auto& entry : src.ordered_->entries)
+				ordered_->append(entry.key.chars(), entry.key.size_, ValueType{ ShareTag{}, entry.value });
+		}
+		else if (src.isObject()) {
+			obj_ = create<ObjectData>(AllocType<ObjectData>(alloc), ObjectAlloc(alloc));
+			obj_->reserve(src.obj_->size());
+			for (auto& kv : *src.obj_)
+				obj_->emplace(kv.first, ValueType{ ShareTag{}, kv.second });
+		}
+		else {
+			arr_ = create<ArrayData>(AllocType<ArrayData>(alloc), ArrayAlloc(alloc));
+			shareAll(*src.arr_, *arr_);
+		}
+	}
+	
+	// shared children are unshared before they are handed out for editing
+	void unshareChild(ValueType& child) const {
+		if (! child.isShared() || ! child.isContainer())
+			return;
 		
-		return *this;
+		if (isShaped())
+			child.unshare(shaped_->values.get_allocator());
+		else if (isOrdered())
+			child.unshare(ordered_->entries.get_allocator());
+		else if (isObject())
+			child.unshare(obj_->get_allocator());
+		else
+			child.unshare(arr_->get_allocator());
 	}
 	
-	~BasicValue() {
+	template <template<typename T> class OtherAllocator>
+	friend class BasicValue;
+	
+	// deep copy source, which may use another allocator, into this null value.
+	// Containers are presized and shaped objects become ordered objects, so
+	// the copy does not depend on the source's document in any way.
+	template <template<typename T> class SourceAllocator, typename AllocArg>
+	void copyFrom(const BasicValue<SourceAllocator>& source, const AllocArg& alloc) {
+		auto src = &source;
+		while (src->isShared())
+			src = src->ref_;
+		
+		kind_ = src->kind_;
 		switch(kind_) {
 			case ValueKind::String:
-				str_.~basic_string();
+				initString(src->chars(), src->size_, alloc);
 				break;
-			case ValueKind::Array:
-				arr_.~vector();
+			case ValueKind::Array: {
+				auto& from = *src->arr_;
+				arr_ = create<ArrayData>(AllocType<ArrayData>(alloc), ArrayAlloc(alloc));
+				arr_->resize(from.size());
+				for (size_t ix = 0; ix < from.size(); ++ix)
+					(*arr_)[ix].copyFrom(from[ix], alloc);
 				break;
+			}
 			case ValueKind::Object:
-				obj_.~unordered_map();
+				if (src->isShaped() || src->isOrdered()) {
+					storage_ = OrderedObject;
+					ordered_ = create<OrderedData>(AllocType<OrderedData>(alloc), alloc);
+					ordered_->entries.reserve(src->size());
+					for (auto item : src->items())
+						ordered_->append(item.key.data(), item.key.size()).copyFrom(item.value, alloc);
+				}
+				else {
+					obj_ = create<ObjectData>(AllocType<ObjectData>(alloc), ObjectAlloc(alloc));
+					obj_->reserve(src->obj_->size());
+					for (auto& kv : *src->obj_)
+						obj_->emplace(std::piecewise_construct, std::forward_as_tuple(kv.first), std::forward_as_tuple()).first->second.copyFrom(kv.second, alloc);
+				}
 				break;
 			default:
+				num_ = src->num_;
 				break;
 		}
 	}
 	
+	void checkMutable() const {
+		if (isShared())
+			throw std::runtime_error("Trying to modify a value that is shared with another document.");
+	}
+	
+	// string constructor for the keys of ordered objects
+	template <typename StringAllocArg>
+	BasicValue(const char* data, size_t length, const StringAllocArg& alloc)
+	: kind_{ValueKind::String}
+	{
+		initString(data, length, alloc);
+	}
+	
+public:
+	BasicValue() : kind_{ValueKind::Null}, num_{0.0} {}
+	BasicValue(const BasicValue& rhs) = delete;
+	BasicValue<Allocator>& operator=(const BasicValue<Allocator>& rhs) = delete;
+	
+	BasicValue(BasicValue<Allocator>&& rhs) noexcept {
+		take(rhs);
+	}
+	
+	BasicValue<Allocator>& operator=(BasicValue<Allocator>&& rhs) noexcept {
+		if (this != &rhs) {
+			release();
+			take(rhs);
+		}
+		return *this;
+	}
+	
+	~BasicValue() {
+		release();
+	}
+	
 	
 	// conversion constructors
 	BasicValue(ValueKind kind, const Lake* args)
 	: kind_{kind}
 	{
-		switch(kind_) {
-			case ValueKind::String:
-				new (&str_) decltype(str_){ StringAlloc(args) };
-				break;
-			case ValueKind::Array:
-				new (&arr_) decltype(arr_){ ArrayAlloc(args) };
-				break;
-			case ValueKind::Object:
-				new (&obj_) decltype(obj_){ ObjectAlloc{args} };
-				break;
-			default:
-				num_ = 0.0;
-				break;
-		}
+		initContainer(args);
 	}
 	
 	BasicValue(ValueKind kind)
 	: kind_{kind}
 	{
-		switch(kind_) {
-			case ValueKind::String:
-				new (&str_) decltype(str_){ StringAlloc{} };
-				break;
-			case ValueKind::Array:
-				new (&arr_) decltype(arr_){ ArrayAlloc{} };
-				break;
-			case ValueKind::Object:
-				new (&obj_) decltype(obj_){ ObjectAlloc{} };
-				break;
-			default:
-				num_ = 0.0;
-				break;
-		}
+		initContainer(AllocType<char>{});
+	}
+	
+	// an empty object with the given member order
+	BasicValue(ObjectOrder order, const Lake* args)
+	: kind_{ValueKind::Object}
+	{
+		initObject(order, args);
+	}
+	
+	BasicValue(ObjectOrder order)
+	: kind_{ValueKind::Object}
+	{
+		initObject(order, AllocType<char>{});
 	}
 	
 	BasicValue(const std::string& sval, const Lake* args)
 	: kind_{ValueKind::String}
 	{
-		new (&str_) decltype(str_){ std::begin(sval), std::end(sval), StringAlloc{ args } };
+		initString(sval.data(), sval.size(), args);
 	}
 	
 	BasicValue(const std::string& sval)
 	: kind_{ValueKind::String}
 	{
-		new (&str_) decltype(str_){ std::begin(sval), std::end(sval), StringAlloc{} };
+		initString(sval.data(), sval.size(), StringAlloc{});
+	}
+	
+	BasicValue(StringRef sval, const Lake* args)
+	: kind_{ValueKind::String}
+	{
+		initString(sval.data(), sval.size(), args);
+	}
+	
+	BasicValue(StringRef sval)
+	: kind_{ValueKind::String}
+	{
+		initString(sval.data(), sval.size(), StringAlloc{});
 	}
 	
 	BasicValue(const char* ccval, const Lake* args) : BasicValue(std::string{ccval}, args) {}
 	
 	BasicValue(const char* ccval) : BasicValue(std::string{ccval}) {}
 	
+	// deep copies of a value with any allocator, e.g. to keep a part of a
+	// document after the document itself is gone
+	template <template<typename T> class SourceAllocator>
+	static BasicValue<Allocator> copyOf(const BasicValue<SourceAllocator>& source, const Lake* args) {
+		BasicValue<Allocator> copy;
+		copy.copyFrom(source, args);
+		return copy;
+	}
+	
+	template <template<typename T> class SourceAllocator>
+	static BasicValue<Allocator> copyOf(const BasicValue<SourceAllocator>& source) {
+		BasicValue<Allocator> copy;
+		copy.copyFrom(source, AllocType<char>{});
+		return copy;
+	}
+	
 	constexpr explicit BasicValue(int ival) : kind_{ValueKind::Number}, num_ { (double)ival } {}
 	constexpr explicit BasicValue(double dval) : kind_{ValueKind::Number}, num_ { dval } {}
 	constexpr explicit BasicValue(bool bval) : kind_{bval ? ValueKind::True : ValueKind::False}, num_ { 0.0 } {}
@@ -246,19 +594,66 @@ public:
 		return static_cast<Arith>(num);
 	}
 	
+	// copy up to count numbers from an array of numbers into dest, returns
+	// the number of values copied; throws if any of the first count values
+	// is not a number, without writing to dest
+	template <typename Arith>
+	size_t copyNumbers(Arith* dest, size_t count) const {
+		if (! isArray())
+			throw std::runtime_error("Trying to call copyNumbers() on a non-array value.");
+		if (isShared())
+			return ref_->copyNumbers(dest, count);
+		
+		auto& values = *arr_;
+		if (count > values.size())
+			count = values.size();
+		
+		bool allNumbers = true;
+		for (size_t ix = 0; ix < count; ++ix)
+			allNumbers &= values[ix].kind_ == ValueKind::Number;
+		if (! allNumbers)
+			throw std::runtime_error("Trying to call copyNumbers() on an array with non-number values.");
+		
+		for (size_t ix = 0; ix < count; ++ix)
+			dest[ix] = static_cast<Arith>(values[ix].num_);
+		return count;
+	}
+	
 	std::string string() const {
 		if (! isString())
 			throw std::runtime_error("Trying to call string() on a non-string value.");
 		
-		return { std::begin(str_), std::end(str_) };
+		return { chars(), size_ };
 	}
 	
+	StringRef stringRef() const {
+		if (! isString())
+			throw std::runtime_error("Trying to call stringRef() on a non-string value.");
+		
+		return { chars(), size_ };
+	}
+	
+	
+	// the value that holds this value's data, the original in another document
+	// if this value is shared with it by a clone. Values with the same origin
+	// are equal without looking at their contents.
+	const BasicValue<Allocator>& origin() const {
+		auto value = this;
+		while (value->isShared())
+			value = value->ref_;
+		return *value;
+	}
 	
 	size_t size() const {
-		if (isObject())
-			return obj_.size();
+		if (isShared())
+			return ref_->size();
+		if (isObject()) {
+			if (isShaped())
+				return shaped_->values.size();
+			return isOrdered() ? ordered_->entries.size() : obj_->size();
+		}
 		if (isArray())
-			return arr_.size();
+			return arr_->size();
 		return 1;
 	}
 	
@@ -266,68 +661,178 @@ public:
 		if (! isObject())
 			throw std::runtime_error("Trying to check for a key in a non-object value.");
 		
-		return obj_.find(key) != obj_.cend();
+		if (isShared())
+			return ref_->contains(key);
+		if (isShaped())
+			return shape()->indexOf(key) != Shape::npos;
+		if (isOrdered())
+			return ordered_->find(key.data(), key.size()) != OrderedData::npos;
+		return obj_->find(key) != obj_->cend();
 	}
 	
 	template <typename ...Args>
 	BasicValue<Allocator>& emplace(std::string key, Args&&... args) {
 		if (! isObject())
 			throw std::runtime_error("Trying to insert a keyval into a non-object value.");
+		checkMutable();
+		
+		if (isShaped()) {
+			auto index = shape()->indexOf(key);
+			if (index != Shape::npos) {
+				auto& values = shaped_->values;
+				values[index] = ValueType(std::forward<Args>(args)...);
+				return values[index];
+			}
+			unshape();
+		}
+		
+		if (isOrdered()) {
+			auto index = ordered_->find(key.data(), key.size());
+			if (index != OrderedData::npos) {
+				// duplicate key, latest wins but keeps the position of the first
+				auto& value = ordered_->entries[index].value;
+				value = ValueType(std::forward<Args>(args)...);
+				return value;
+			}
+			return ordered_->append(key.data(), key.size(), std::forward<Args>(args)...);
+		}
 		
 		if (contains(key))
-			obj_.erase(key); // duplicate key, latest wins as per behaviour in all other JSON parsers
+			obj_->erase(key); // duplicate key, latest wins as per behaviour in all other JSON parsers
 		
-		return obj_.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(args...)).first.operator*().second;
+		return obj_->emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...)).first.operator*().second;
 	}
 	
 	template <typename ...Args>
 	BasicValue<Allocator>& emplace_back(Args&&... args) {
 		if (! isArray())
 			throw std::runtime_error("Trying to push_back a value into a non-array value.");
+		checkMutable();
 		
-		arr_.emplace_back(std::forward<Args>(args)...);
-		return arr_.back();
+		arr_->emplace_back(std::forward<Args>(args)...);
+		return arr_->back();
+	}
+	
+	// make room for count members in an array or object, shaped objects are not resized
+	void reserve(size_t count) {
+		if (! isContainer())
+			throw std::runtime_error("Trying to call reserve() on a non-container value.");
+		checkMutable();
+		
+		if (isArray())
+			arr_->reserve(count);
+		else if (isOrdered())
+			ordered_->entries.reserve(count);
+		else if (! isShaped())
+			obj_->reserve(count);
+	}
+	
+	template <typename ...Args>
+	BasicValue<Allocator>& insert(size_t index, Args&&... args) {
+		if (! isArray())
+			throw std::runtime_error("Trying to insert a value into a non-array value.");
+		checkMutable();
+		if (index > arr_->size())
+			throw std::out_of_range("Insert position is past the end of the array.");
+		
+		return *arr_->emplace(arr_->begin() + index, std::forward<Args>(args)...);
+	}
+	
+	// returns false if the object has no member with this key
+	bool erase(const std::string& key) {
+		if (! isObject())
+			throw std::runtime_error("Trying to erase a keyval from a non-object value.");
+		checkMutable();
+		
+		if (isShaped()) {
+			if (shape()->indexOf(key) == Shape::npos)
+				return false;
+			unshape();
+		}
+		if (isOrdered())
+			return ordered_->erase(key.data(), key.size());
+		return obj_->erase(key) > 0;
+	}
+	
+	void erase(const size_t index) {
+		if (! isArray())
+			throw std::runtime_error("Trying to erase a value by index from a non-array value.");
+		checkMutable();
+		if (index >= arr_->size())
+			throw std::out_of_range("Array index out of range.");
+		
+		arr_->erase(arr_->begin() + index);
 	}
 	
 	const BasicValue<Allocator>& operator[](const std::string& key) const {
 		if (! isObject())
 			throw std::runtime_error("Trying to retrieve a sub-value by key from a non-object value.");
 		
-		return obj_.at(key);
+		if (isShared())
+			return (*ref_)[key];
+		if (isShaped()) {
+			auto index = shape()->indexOf(key);
+			if (index == Shape::npos)
+				throw std::out_of_range("Key not found in object value.");
+			return shaped_->values[index];
+		}
+		if (isOrdered()) {
+			auto index = ordered_->find(key.data(), key.size());
+			if (index == OrderedData::npos)
+				throw std::out_of_range("Key not found in object value.");
+			return ordered_->entries[index].value;
+		}
+		return obj_->at(key);
 	}
 	
 	BasicValue<Allocator>& operator[](const std::string& key) {
-		return const_cast<BasicValue<Allocator>&>(const_cast<const BasicValue<Allocator>*>(this)->operator[](key));
+		checkMutable();
+		auto& child = const_cast<BasicValue<Allocator>&>(const_cast<const BasicValue<Allocator>*>(this)->operator[](key));
+		unshareChild(child);
+		return child;
 	}
 	
 	const BasicValue<Allocator>& operator[](const size_t index) const {
 		if (! isArray())
 			throw std::runtime_error("Trying to retrieve a sub-value by index from a non-array value.");
 		
-		return arr_.at(index);
+		if (isShared())
+			return (*ref_)[index];
+		return arr_->at(index);
 	}
 	
 	BasicValue<Allocator>& operator[](const size_t index) {
-		return const_cast<BasicValue<Allocator>&>(const_cast<const BasicValue<Allocator>*>(this)->operator[](index));
+		checkMutable();
+		auto& child = const_cast<BasicValue<Allocator>&>(const_cast<const BasicValue<Allocator>*>(this)->operator[](index));
+		unshareChild(child);
+		return child;
 	}
 	
 	Iterator<Allocator> begin() const;
 	Iterator<Allocator> end() const;
 	
+	// iteration without allocations: items() yields the key, index and value
+	// of each member, keys() the keys of an object and values() the values
+	View<Allocator, GetItem<Allocator>> items() const;
+	View<Allocator, GetKey<Allocator>> keys() const;
+	View<Allocator, GetValue<Allocator>> values() const;
+	
 	
 	void debugPrint(std::ostream& os) const {
 		switch(kind_) {
 			case ValueKind::String:
-				os << '"' << str_ << '"';
+				os << '"';
+				os.write(chars(), size_);
+				os << '"';
 				break;
 			case ValueKind::Number:
 				os << num_;
 				break;
 			case ValueKind::Object:
-				os << "Object[" << obj_.size() << "]";
+				os << "Object[" << size() << "]";
 				break;
 			case ValueKind::Array:
-				os << "Array[" << arr_.size() << "]";
+				os << "Array[" << size() << "]";
 				break;
 			case ValueKind::True:
 				os << "true";
@@ -344,8 +849,117 @@ public:
 };
 
 
+template <template<typename T> class Allocator>
+struct BasicValue<Allocator>::ShapedData {
+	const Shape* shape;
+	ArrayData values;
+	
+	ShapedData(const Shape* s, const ArrayAlloc& alloc) : shape{s}, values{alloc} {}
+};
+
+
+// Ordered objects keep their members in a vector. Like shapes, small
+// objects are searched linearly and larger ones get an open addressing
+// index of entry positions once they outgrow the scan.
+template <template<typename T> class Allocator>
+struct BasicValue<Allocator>::OrderedData {
+	struct Entry {
+		ValueType key; // always a string
+		ValueType value;
+	};
+	
+	using Entries = std::vector<Entry, AllocType<Entry>>;
+	using Index = std::vector<uint32_t, AllocType<uint32_t>>;
+	
+	static constexpr size_t IndexThreshold = 8;
+	static constexpr size_t npos = ~size_t{0};
+	
+	Entries entries;
+	Index index; // entry position + 1 per slot, 0 for empty slots
+	
+	template <typename AllocArg>
+	OrderedData(const AllocArg& alloc) : entries{ AllocType<Entry>(alloc) }, index{ AllocType<uint32_t>(alloc) } {}
+	
+	static size_t hash(const char* key, size_t length) {
+		uint32_t h = 2166136261u;
+		for (size_t ix = 0; ix < length; ++ix)
+			h = (h ^ static_cast<uint8_t>(key[ix])) * 16777619u;
+		return h;
+	}
+	
+	static bool keyEquals(const ValueType& entryKey, const char* key, size_t length) {
+		return entryKey.size_ == length && std::memcmp(entryKey.chars(), key, length) == 0;
+	}
+	
+	size_t find(const char* key, size_t length) const {
+		if (index.empty()) {
+			for (size_t ix = 0; ix < entries.size(); ++ix)
+				if (keyEquals(entries[ix].key, key, length))
+					return ix;
+			return npos;
+		}
+		
+		auto mask = index.size() - 1;
+		for (auto slot = hash(key, length) & mask; index[slot]; slot = (slot + 1) & mask) {
+			auto ix = index[slot] - 1;
+			if (keyEquals(entries[ix].key, key, length))
+				return ix;
+		}
+		return npos;
+	}
+	
+	void addToIndex(size_t ix) {
+		auto& key = entries[ix].key;
+		auto mask = index.size() - 1;
+		auto slot = hash(key.chars(), key.size_) & mask;
+		while (index[slot])
+			slot = (slot + 1) & mask;
+		index[slot] = static_cast<uint32_t>(ix + 1);
+	}
+	
+	// the index is kept at most half full
+	void reindex() {
+		size_t capacity = 32;
+		while (capacity < entries.size() * 2)
+			capacity *= 2;
+		index.assign(capacity, 0);
+		for (size_t ix = 0; ix < entries.size(); ++ix)
+			addToIndex(ix);
+	}
+	
+	bool erase(const char* key, size_t length) {
+		auto ix = find(key, length);
+		if (ix == npos)
+			return false;
+		
+		entries.erase(entries.begin() + ix);
+		if (entries.size() > IndexThreshold)
+			reindex();
+		else
+			index.clear();
+		return true;
+	}
+	
+	// add a member without checking for an existing key
+	template <typename... Args>
+	ValueType& append(const char* key, size_t length, Args&&... args) {
+		entries.push_back({ ValueType{ key, length, entries.get_allocator() }, ValueType(std::forward<Args>(args)...) });
+		
+		if (entries.size() > IndexThreshold) {
+			if (entries.size() * 2 > index.size())
+				reindex();
+			else
+				addToIndex(entries.size() - 1);
+		}
+		return entries.back().value;
+	}
+};
+
+
 using Value = BasicValue<>;
 
+static_assert(sizeof(Value) == 16, "krystal values should be 16 bytes");
+
 
 template <template<typename T> class Allocator>
 std::ostream& operator<<(std::ostream& os, const BasicValue<Allocator>& t) {
@@ -356,23 +970,38 @@ std::ostream& operator<<(std::ostream& os, const BasicValue<Allocator>& t) {
 
 template <template<typename T> class Allocator>
 class Iterator {
-	using KeyType = BasicValue<Allocator>;
+	// keys are plain heap values, the iterator has no access to a value's allocator
+	using KeyType = BasicValue<>;
 	using MappedType = const BasicValue<Allocator>&;
 	
-	using ArrayIterator = typename BasicValue<Allocator>::ArrayIterator;
-	using ObjectIterator = typename BasicValue<Allocator>::ObjectIterator;
+	using ArrayIterator = typename BasicValue<Allocator>::ArrayData::const_iterator;
+	using ObjectIterator = typename BasicValue<Allocator>::ObjectData::const_iterator;
+	using OrderedIterator = typename BasicValue<Allocator>::OrderedData::Entries::const_iterator;
+	
+	enum Mode : uint8_t {
+		Elements, // array
+		Shaped,   // values of a shaped object, keys come from the shape
+		Keyed,    // hash map object
+		Ordered   // entries of an ordered object
+	};
 	
-	bool isObject;
-	int arrIndex = 0;
+	Mode mode;
+	int arrIndex = 0; // position in iteration order, also for objects
+	const Shape* shape = nullptr;
 	ArrayIterator arrIt;
 	ObjectIterator objIt;
+	OrderedIterator ordIt;
 	
 	friend class BasicValue<Allocator>;
 	
 	Iterator(ArrayIterator a_it, int index = 0)
-	: isObject(false), arrIt(a_it), arrIndex(index) {}
+	: mode(Elements), arrIndex(index), arrIt(a_it) {}
+	Iterator(ArrayIterator a_it, const Shape* a_shape)
+	: mode(Shaped), shape(a_shape), arrIt(a_it) {}
 	Iterator(ObjectIterator o_it)
-	: isObject(true), objIt(o_it) {}
+	: mode(Keyed), objIt(o_it) {}
+	Iterator(OrderedIterator e_it)
+	: mode(Ordered), ordIt(e_it) {}
 	
 public:
 	// standard iterator interop
@@ -381,20 +1010,43 @@ public:
 	
 	
 	reference current() const {
-		if (isObject)
-			return { BasicValue<Allocator>{objIt->first}, objIt->second };
-		return { BasicValue<Allocator>{arrIndex}, *arrIt };
+		switch (mode) {
+			case Keyed: return { KeyType{objIt->first}, objIt->second };
+			case Ordered: return { KeyType{ordIt->key.string()}, ordIt->value };
+			case Shaped: return { KeyType{shape->key(arrIndex)}, *arrIt };
+			default: return { KeyType{arrIndex}, *arrIt };
+		}
 	}
 	
 	reference operator *() const { return current(); }
 	reference operator ->() const { return current(); }
+	
+	// the current member without constructing a key value,
+	// key() is empty for array elements
+	StringRef key() const {
+		switch (mode) {
+			case Keyed: return objIt->first;
+			case Ordered: return { ordIt->key.chars(), ordIt->key.size_ };
+			case Shaped: return shape->key(arrIndex);
+			default: return {};
+		}
+	}
+	size_t index() const { return static_cast<size_t>(arrIndex); }
+	const BasicValue<Allocator>& value() const {
+		switch (mode) {
+			case Keyed: return objIt->second;
+			case Ordered: return ordIt->value;
+			default: return *arrIt;
+		}
+	}
+	
 	const Iterator& operator ++() {
-		if (isObject)
-			++objIt;
-		else {
-			++arrIt;
-			++arrIndex;
+		switch (mode) {
+			case Keyed: ++objIt; break;
+			case Ordered: ++ordIt; break;
+			default: ++arrIt; break;
 		}
+		++arrIndex;
 		return *this;
 	}
 	Iterator operator ++(int) {
@@ -404,9 +1056,11 @@ public:
 	}
 	
 	bool operator ==(const Iterator& rhs) const {
-		if (isObject)
-			return objIt == rhs.objIt;
-		return arrIt == rhs.arrIt;
+		switch (mode) {
+			case Keyed: return objIt == rhs.objIt;
+			case Ordered: return ordIt == rhs.ordIt;
+			default: return arrIt == rhs.arrIt;
+		}
 	}
 	bool operator !=(const Iterator& rhs) const {
 		return !this->operator==(rhs);
@@ -420,9 +1074,15 @@ Iterator<Allocator> BasicValue<Allocator>::begin() const {
 	if (! isContainer())
 		throw std::runtime_error("Trying to call begin() on a non-container value.");
 	
+	if (isShared())
+		return ref_->begin();
+	if (isShaped())
+		return { shaped_->values.begin(), shape() };
+	if (isOrdered())
+		return { ordered_->entries.begin() };
 	if (isObject())
-		return { obj_.begin() };
-	return { arr_.begin() };
+		return { obj_->begin() };
+	return { arr_->begin() };
 }
 
 template <template<typename T> class Allocator>
@@ -430,9 +1090,100 @@ Iterator<Allocator> BasicValue<Allocator>::end() const {
 	if (! isContainer())
 		throw std::runtime_error("Trying to call end() on a non-container value.");
 	
+	if (isShared())
+		return ref_->end();
+	if (isShaped())
+		return { shaped_->values.end(), shape() };
+	if (isOrdered())
+		return { ordered_->entries.end() };
 	if (isObject())
-		return { obj_.end() };
-	return { arr_.end() };
+		return { obj_->end() };
+	return { arr_->end() };
+}
+
+
+template <template<typename T> class Allocator>
+struct Item {
+	StringRef key; // empty for array elements
+	size_t index;
+	const BasicValue<Allocator>& value;
+};
+
+template <template<typename T> class Allocator>
+struct GetItem {
+	static Item<Allocator> get(const Iterator<Allocator>& it) { return { it.key(), it.index(), it.value() }; }
+};
+
+template <template<typename T> class Allocator>
+struct GetKey {
+	static StringRef get(const Iterator<Allocator>& it) { return it.key(); }
+};
+
+template <template<typename T> class Allocator>
+struct GetValue {
+	static const BasicValue<Allocator>& get(const Iterator<Allocator>& it) { return it.value(); }
+};
+
+
+// A View is a range over the members of a container that yields
+// what Get takes from each position, for use in range-based for.
+template <template<typename T> class Allocator, typename Get>
+class View {
+	Iterator<Allocator> first_, last_;
+	
+public:
+	class iterator {
+		Iterator<Allocator> it_;
+		
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using reference = decltype(Get::get(std::declval<const Iterator<Allocator>&>()));
+		using value_type = typename std::decay<reference>::type;
+		using difference_type = ptrdiff_t;
+		using pointer = void;
+		
+		explicit iterator(const Iterator<Allocator>& it) : it_(it) {}
+		
+		reference operator *() const { return Get::get(it_); }
+		iterator& operator ++() {
+			++it_;
+			return *this;
+		}
+		iterator operator ++(int) {
+			iterator ret(*this);
+			++it_;
+			return ret;
+		}
+		
+		bool operator ==(const iterator& rhs) const { return it_ == rhs.it_; }
+		bool operator !=(const iterator& rhs) const { return it_ != rhs.it_; }
+	};
+	
+	View(Iterator<Allocator> first, Iterator<Allocator> last)
+	: first_(first), last_(last)
+	{}
+	
+	iterator begin() const { return iterator{ first_ }; }
+	iterator end() const { return iterator{ last_ }; }
+};
+
+
+template <template<typename T> class Allocator>
+View<Allocator, GetItem<Allocator>> BasicValue<Allocator>::items() const {
+	return { begin(), end() };
+}
+
+template <template<typename T> class Allocator>
+View<Allocator, GetKey<Allocator>> BasicValue<Allocator>::keys() const {
+	if (! isObject())
+		throw std::runtime_error("Trying to call keys() on a non-object value.");
+	
+	return { begin(), end() };
+}
+
+template <template<typename T> class Allocator>
+View<Allocator, GetValue<Allocator>> BasicValue<Allocator>::values() const {
+	return { begin(), end() };
 }
 
 